@@ -35,13 +35,15 @@ from The Open Group.
 #include "xkbsrv.h"
 #include "xserver-properties.h"
 #include "exevents.h"
-#define unused __attribute__((unused))
+#include "lorie.h"
 
 unused DeviceIntPtr lorieMouse, lorieMouseRelative, lorieTouch, lorieKeyboard;
 
 void
 ProcessInputEvents(void) {
+    lorieInputProcessed();
     mieqProcessInputEvents();
+    lorieLatencyTouchesDelivered();
 }
 
 void
@@ -147,7 +149,7 @@ lorieMouseProc(DeviceIntPtr pDevice, int onoff) {
 #undef NAXES
 }
 
-unused static int
+static int
 lorieMouseRelativeProc(DeviceIntPtr device, int what)
 {
 #define NAXES 2
@@ -249,11 +251,11 @@ lorieTouchProc(DeviceIntPtr device, int what)
 void
 InitInput(unused int argc, unused char *argv[]) {
     lorieMouse = AddInputDevice(serverClient, lorieMouseProc, TRUE);
-//    lorieMouseRelative = AddInputDevice(serverClient, lorieMouseRelativeProc, TRUE);
+    lorieMouseRelative = AddInputDevice(serverClient, lorieMouseRelativeProc, TRUE);
     lorieTouch = AddInputDevice(serverClient, lorieTouchProc, TRUE);
     lorieKeyboard = AddInputDevice(serverClient, lorieKeybdProc, TRUE);
     AssignTypeAndName(lorieMouse, MakeAtom(XI_MOUSE, sizeof(XI_MOUSE) - 1, TRUE), "Xvfb mouse");
-//    AssignTypeAndName(lorieMouseRelative, MakeAtom(XI_MOUSE, sizeof(XI_MOUSE) - 1, TRUE), "Xvfb relative mouse");
+    AssignTypeAndName(lorieMouseRelative, MakeAtom(XI_MOUSE, sizeof(XI_MOUSE) - 1, TRUE), "Xvfb relative mouse");
     AssignTypeAndName(lorieTouch, MakeAtom(XI_TOUCHSCREEN, sizeof(XI_TOUCHSCREEN) - 1, TRUE), "Xvfb touch");
     AssignTypeAndName(lorieKeyboard, MakeAtom(XI_KEYBOARD, sizeof(XI_KEYBOARD) - 1, TRUE), "Xvfb keyboard");
     (void) mieqInit();
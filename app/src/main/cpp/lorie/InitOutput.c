@@ -43,6 +43,7 @@ from The Open Group.
 #include <libxcvt/libxcvt.h>
 #include <X11/X.h>
 #include <X11/Xos.h>
+#include <X11/Xatom.h>
 #include <android/log.h>
 #include <android/native_window.h>
 #include <android/hardware_buffer.h>
@@ -58,6 +59,9 @@ from The Open Group.
 #include "randrstr.h"
 #include "damagestr.h"
 #include "cursorstr.h"
+#include "present.h"
+#include "syncsrv.h"
+#include "list.h"
 
 #include "renderer.h"
 #include "inpututils.h"
@@ -66,10 +70,29 @@ from The Open Group.
 #define unused __attribute__((unused))
 
 #define MAX_FPS 120
+#define HIDDEN_FPS 1
+
+// Levels of ComponentCallbacks2.onTrimMemory
+#define TRIM_MEMORY_UI_HIDDEN 20
+#define TRIM_MEMORY_BACKGROUND 40
+#define TRIM_MEMORY_MODERATE 60
+#define TRIM_MEMORY_COMPLETE 80
+
+#define MAX_OUTPUTS RENDERER_MAX_OUTPUTS
+#define LUT_PROPERTY "COLOR_LUT_3D"
 
 extern DeviceIntPtr lorieMouse, lorieKeyboard;
 extern __GLXprovider androidProvider;
 
+typedef struct {
+    RROutputPtr output;
+    RRCrtcPtr crtc;
+    struct ANativeWindow* win;
+    // Additional outputs have their own buffers, the first output shows root buffer directly.
+    struct AHardwareBuffer* buf;
+    BoxRec box; // Part of the screen shown by the output, empty if CRTC is disabled
+} lorieOutputRec, *lorieOutputPtr;
+
 typedef struct {
     int width;
     int height;
@@ -77,22 +100,59 @@ typedef struct {
     CreateScreenResourcesProcPtr createScreenResources;
 
     DamagePtr pDamage;
+    lorieTileDamagePtr tiles;
+    Bool tileDamage;
     OsTimerPtr pTimer;
+    Bool timerIdle;
 
-    RROutputPtr output;
-    RRCrtcPtr crtc;
+    struct xorg_list vblankQueue;
+    uint64_t msc, ust;
+
+    // Pixmap of a full-screen window flipped by Present, it is shown instead of the root buffer.
+    struct {
+        PixmapPtr pPixmap;
+        DamagePtr pDamage;
+        renderer_window_ptr window;
+        uint64_t eventId;
+        Bool pending, dirty;
+    } flip;
+    SyncCounter *visibleCounter;
+
+    lorieOutputRec outputs[MAX_OUTPUTS];
 
-    struct ANativeWindow* win;
     struct AHardwareBuffer* buf;
+    Bool shadow;
+    void *shadowData;
+    int compressIdle;
+    int rasterThreads;
+    int coalesceDepth;
+    Bool rawMotion;
+    Bool compositor;
+    Bool rootless;
     Bool cursorMoved;
+    unsigned int redraw; // Outputs which should be redrawn without damage, i.e. to show new video frame
+    int cursorX, cursorY, drawnCursorX, drawnCursorY;
     Bool locked;
+    Bool contentLost;
     ARect r;
+
+    struct {
+        int rendererLevel, slabLevel, shadowLevel;
+        size_t released[TRIM_MEMORY_COMPLETE / 5 + 1]; // Bytes released at every level, for statistics
+    } trim;
 } lorieScreenInfo, *lorieScreenInfoPtr;
 ScreenPtr pScreenPtr;
 
 static lorieScreenInfo lorieScreen = {
         .width = 1280,
         .height = 1024,
+        .rasterThreads = -1,
+        .coalesceDepth = 64,
+        .trim = {
+            .rendererLevel = TRIM_MEMORY_UI_HIDDEN,
+            .slabLevel = TRIM_MEMORY_BACKGROUND,
+            .shadowLevel = TRIM_MEMORY_MODERATE,
+        },
 };
 
 lorieScreenInfoPtr pvfb = &lorieScreen;
@@ -130,8 +190,74 @@ ddxBeforeReset(void) {
 void
 ddxInputThreadInit(void) {}
 #endif
-void ddxUseMsg(void) {}
-int ddxProcessArgument(unused int argc, unused char *argv[], unused int i) { return 0; }
+void ddxUseMsg(void) {
+    ErrorF("-tiledamage            track screen damage with bitmap of 64x64 tiles instead of region\n");
+    ErrorF("-shadow                render to cached system memory and copy damaged areas to screen buffer\n");
+    ErrorF("-compressidle secs     compress large pixmaps which were not accessed for given time\n");
+    ErrorF("-rasterthreads n       draw large operations with n threads (default: one per CPU core, 1 disables)\n");
+    ErrorF("-trimlevels r,p,s      onTrimMemory levels to release renderer, pixmap slabs and shadow buffer at\n");
+    ErrorF("-compositor            composite top-level windows on GPU (external compositing managers will not start)\n");
+    ErrorF("-rootless              show top-level windows as separate Android surface layers (Android 10+)\n");
+    ErrorF("-coalesce depth        drop outdated motion while more input events are queued (default: 64, 0 disables)\n");
+    ErrorF("-rawmotion             send XI2 raw motion of the pointer, including coalesced motion\n");
+}
+
+int ddxProcessArgument(int argc, char *argv[], int i) {
+    if (strcmp(argv[i], "-tiledamage") == 0) {
+        pvfb->tileDamage = TRUE;
+        return 1;
+    }
+
+    if (strcmp(argv[i], "-shadow") == 0) {
+        pvfb->shadow = TRUE;
+        return 1;
+    }
+
+    if (strcmp(argv[i], "-compositor") == 0) {
+        pvfb->compositor = TRUE;
+        return 1;
+    }
+
+    if (strcmp(argv[i], "-rootless") == 0) {
+        pvfb->rootless = TRUE;
+        return 1;
+    }
+
+    if (strcmp(argv[i], "-rasterthreads") == 0) {
+        if (++i >= argc)
+            UseMsg();
+        pvfb->rasterThreads = atoi(argv[i]);
+        return 2;
+    }
+
+    if (strcmp(argv[i], "-coalesce") == 0) {
+        if (++i >= argc)
+            UseMsg();
+        pvfb->coalesceDepth = atoi(argv[i]);
+        return 2;
+    }
+
+    if (strcmp(argv[i], "-rawmotion") == 0) {
+        pvfb->rawMotion = TRUE;
+        return 1;
+    }
+
+    if (strcmp(argv[i], "-compressidle") == 0) {
+        if (++i >= argc)
+            UseMsg();
+        pvfb->compressIdle = atoi(argv[i]);
+        return 2;
+    }
+
+    if (strcmp(argv[i], "-trimlevels") == 0) {
+        if (++i >= argc || sscanf(argv[i], "%d,%d,%d", &pvfb->trim.rendererLevel,
+                                  &pvfb->trim.slabLevel, &pvfb->trim.shadowLevel) != 3)
+            UseMsg();
+        return 2;
+    }
+
+    return 0;
+}
 
 static RRModePtr lorieCvt(int width, int height) {
     struct libxcvt_mode_info *info;
@@ -159,16 +285,27 @@ static RRModePtr lorieCvt(int width, int height) {
     return mode;
 }
 
+// Called on input thread with input lock held, cursor is moved on screen by the next frame.
 static void lorieMoveCursor(unused DeviceIntPtr pDev, unused ScreenPtr pScr, int x, int y) {
-    renderer_set_cursor_coordinates(x, y);
+    pvfb->cursorX = x;
+    pvfb->cursorY = y;
     pvfb->cursorMoved = TRUE;
 }
 
+static void lorieUpdateCursor(int width, int height, int xhot, int yhot, CARD32 *data) {
+    // Cursor drawn by renderer would be covered by window layers.
+    if (pvfb->rootless) {
+        lorieLayersSetCursor(width, height, xhot, yhot, data);
+        renderer_update_cursor(0, 0, 0, 0, NULL);
+    } else
+        renderer_update_cursor(width, height, xhot, yhot, data);
+}
+
 static void lorieSetCursor(unused DeviceIntPtr pDev, unused ScreenPtr pScr, CursorPtr pCurs, int x0, int y0) {
     CursorBitsPtr bits = pCurs ? pCurs->bits : NULL;
     if (pCurs && bits) {
         if (bits->argb)
-            renderer_update_cursor(bits->width, bits->width, bits->xhot, bits->yhot, bits->argb);
+            lorieUpdateCursor(bits->width, bits->height, bits->xhot, bits->yhot, bits->argb);
         else {
             CARD32 d, fg, bg, *p, data[bits->width * bits->height * 4];
             int x, y, stride, i, bit;
@@ -186,10 +323,10 @@ static void lorieSetCursor(unused DeviceIntPtr pDev, unused ScreenPtr pScr, Curs
                     *p++ = d;
                 }
 
-            renderer_update_cursor(bits->width, bits->height, bits->xhot, bits->yhot, data);
+            lorieUpdateCursor(bits->width, bits->height, bits->xhot, bits->yhot, data);
         }
     } else
-        renderer_update_cursor(0, 0, 0, 0, NULL);
+        lorieUpdateCursor(0, 0, 0, 0, NULL);
 
     lorieMoveCursor(NULL, NULL, x0, y0);
 }
@@ -209,30 +346,469 @@ static miPointerScreenFuncRec loriePointerCursorFuncs = {
     .WarpCursor = miPointerWarpCursor
 };
 
-static CARD32 lorieTimerCallback(unused OsTimerPtr timer, unused CARD32 time, void *arg) {
-    if (pvfb->win && pvfb->buf && RegionNotEmpty(DamageRegion(pvfb->pDamage))) {
-        ScreenPtr pScreen = (ScreenPtr) arg;
-        int usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN | AHARDWAREBUFFER_USAGE_CPU_READ_RARELY;
-        void *data;
+/*
+ * Damage layer unions every raw report to its region before calling this. Region is emptied right away,
+ * so that union is a copy of the reported region instead of a merge with everything damaged since last frame.
+ */
+static void lorieDamageReport(DamagePtr pDamage, RegionPtr pRegion, unused void *closure) {
+    if (pvfb->tiles)
+        lorieTileDamageAddRegion(pvfb->tiles, pRegion);
+    DamageEmpty(pDamage);
+}
 
-        if (pvfb->locked)
-            AHardwareBuffer_unlock(pvfb->buf, NULL);
+static Bool lorieDamageNotEmpty(void) {
+    return pvfb->tiles ? lorieTileDamageNotEmpty(pvfb->tiles) : RegionNotEmpty(DamageRegion(pvfb->pDamage));
+}
 
-        pvfb->locked = FALSE;
-        renderer_redraw();
-        pvfb->locked = AHardwareBuffer_lock(pvfb->buf, usage, -1, NULL, &data) == 0;
-        if (pvfb->locked) {
-            pScreen->ModifyPixmapHeader(pScreen->GetScreenPixmap(pScreen), -1, -1, -1, -1, -1, data);
-            DamageEmpty(lorieScreen.pDamage);
-        }
-    } else if (pvfb->cursorMoved)
-        renderer_redraw();
+static void lorieDamageEmpty(void) {
+    if (pvfb->tiles)
+        lorieTileDamageEmpty(pvfb->tiles);
+    else
+        DamageEmpty(pvfb->pDamage);
+}
+
+/*
+ * Memory of AHardwareBuffer is write-combined or uncached on many SoCs, so fb operations which
+ * read the screen (blending, scrolling, GetImage) are very slow there. In shadow mode fb renders
+ * to regular cached memory and only damaged areas are written to hardware buffer before presenting.
+ */
+static void *lorieShadowAllocate(int stride, int height) {
+    void *data = NULL;
+    return posix_memalign(&data, 64, (size_t) stride * height) == 0 ? data : NULL;
+}
+
+// Returns damaged boxes, `spans` is used as storage for boxes made of dirty tiles.
+static int lorieDamageBoxes(PixmapPtr pPixmap, BoxPtr spans, int max, BoxPtr *boxes) {
+    int n;
+
+    if (!pvfb->tiles) {
+        *boxes = RegionRects(DamageRegion(pvfb->pDamage));
+        return RegionNumRects(DamageRegion(pvfb->pDamage));
+    }
+
+    *boxes = spans;
+    n = lorieTileDamageSpans(pvfb->tiles, spans, max);
+    if (n < 0) {
+        spans[0] = (BoxRec) { .x1 = 0, .y1 = 0, .x2 = pPixmap->drawable.width, .y2 = pPixmap->drawable.height };
+        n = 1;
+    }
+    return n;
+}
+
+static Bool lorieBoxesIntersect(const BoxRec *boxes, int n, const BoxRec *box) {
+    int i;
+    for (i = 0; i < n; i++)
+        if (boxes[i].x1 < box->x2 && boxes[i].x2 > box->x1 && boxes[i].y1 < box->y2 && boxes[i].y2 > box->y1)
+            return TRUE;
+    return FALSE;
+}
+
+static Bool lorieBoxContains(const BoxRec *box, int x, int y) {
+    return x >= box->x1 && x < box->x2 && y >= box->y1 && y < box->y2;
+}
+
+void lorieRedraw(const BoxRec *box) {
+    int i;
+    for (i = 0; i < MAX_OUTPUTS; i++)
+        if (pvfb->outputs[i].win && lorieBoxesIntersect(box, 1, &pvfb->outputs[i].box))
+            pvfb->redraw |= 1 << i;
+}
+
+// Copies damaged part of `clip` from screen pixmap to the buffer which holds the screen starting at clip->x1, clip->y1.
+static void lorieCopyToBuffer(PixmapPtr pPixmap, struct AHardwareBuffer *buf, const BoxRec *clip, BoxPtr boxes, int n) {
+    AHardwareBuffer_Desc desc;
+    void *data;
+
+    AHardwareBuffer_describe(buf, &desc);
+    if (!pPixmap->devPrivate.ptr || AHardwareBuffer_lock(buf, AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, -1, NULL, &data) != 0)
+        return;
+
+    lorieCopyBoxes(data, desc.stride * 4, clip, pPixmap->devPrivate.ptr, pPixmap->devKind,
+                   pPixmap->drawable.width, pPixmap->drawable.height, boxes, n);
+    AHardwareBuffer_unlock(buf, NULL);
+}
+
+static void lorieShadowWriteback(PixmapPtr pPixmap, BoxPtr boxes, int n) {
+    BoxRec screen = { .x1 = 0, .y1 = 0, .x2 = pPixmap->drawable.width, .y2 = pPixmap->drawable.height };
+    lorieCopyToBuffer(pPixmap, pvfb->buf, &screen, boxes, n);
+}
+
+static Bool lorieVisible(void) {
+    int i;
+    for (i = 0; i < MAX_OUTPUTS; i++)
+        if (pvfb->outputs[i].win)
+            return TRUE;
+    return FALSE;
+}
+
+static void lorieOutputSetBuffer(int i) {
+    lorieOutputPtr out = &pvfb->outputs[i];
+    Bool enabled = out->box.x2 > out->box.x1;
+
+    if (i == 0)
+        renderer_set_buffer(0, pvfb->buf, 0, 0, enabled ? min(out->box.x2, pvfb->width) : pvfb->width,
+                            enabled ? min(out->box.y2, pvfb->height) : pvfb->height);
+    else
+        renderer_set_buffer(i, out->buf, out->box.x1, out->box.y1, out->box.x2 - out->box.x1, out->box.y2 - out->box.y1);
+}
+
+typedef struct {
+    struct xorg_list list;
+    uint64_t eventId;
+    uint64_t msc;
+} lorieVblankRec, *lorieVblankPtr;
 
+/*
+ * Vblanks are emulated with the same timer which presents frames, so Present completions are
+ * paced by frame rate while surface is attached and slow down to HIDDEN_FPS when it is not.
+ */
+static void lorieVblank(void) {
+    lorieVblankPtr vblank, tmp;
+
+    pvfb->msc++;
+    pvfb->ust = GetTimeInMicros();
+    if (pvfb->flip.pending) {
+        pvfb->flip.pending = FALSE;
+        present_event_notify(pvfb->flip.eventId, pvfb->ust, pvfb->msc);
+    }
+    xorg_list_for_each_entry_safe(vblank, tmp, &pvfb->vblankQueue, list) {
+        if (vblank->msc > pvfb->msc)
+            continue;
+
+        xorg_list_del(&vblank->list);
+        present_event_notify(vblank->eventId, pvfb->ust, pvfb->msc);
+        free(vblank);
+    }
+}
+
+static CARD32 lorieTimerCallback(unused OsTimerPtr timer, unused CARD32 time, void *arg) {
+    ScreenPtr pScreen = (ScreenPtr) arg;
+    PixmapPtr pPixmap = pScreen->GetScreenPixmap(pScreen);
+    unsigned int redraw;
+    int i, cursorX, cursorY;
+    Bool cursorMoved, damaged;
+
+    lorieVblank();
+
+    if (!lorieVisible()) {
+        // There is nothing to present to, timer only completes pending vblanks and stops when there are none.
+        pvfb->timerIdle = xorg_list_is_empty(&pvfb->vblankQueue);
+        return pvfb->timerIdle ? 0 : 1000 / HIDDEN_FPS;
+    }
+
+    // Renderer and layers are only touched on main thread, input thread leaves the cursor position for us.
+    input_lock();
+    cursorMoved = pvfb->cursorMoved;
+    cursorX = pvfb->cursorX;
+    cursorY = pvfb->cursorY;
     pvfb->cursorMoved = FALSE;
+    input_unlock();
+
+    // Cursor layer is moved by the same transaction as windows, outputs are not redrawn.
+    if (cursorMoved && pvfb->rootless)
+        lorieLayersMoveCursor(cursorX, cursorY);
+    else if (cursorMoved)
+        renderer_set_cursor_coordinates(cursorX, cursorY);
+
+    lorieCompositorUpdate(pScreen);
+    redraw = pvfb->redraw;
+
+    // Flipped pixmap goes to the texture directly, without being copied to shadow and root buffer first.
+    // Only the parts drawn since the last frame are uploaded unless the texture is new or was lost.
+    if (pvfb->flip.pPixmap && pvfb->outputs[0].win
+            && (pvfb->flip.dirty || (pvfb->flip.pDamage && RegionNotEmpty(DamageRegion(pvfb->flip.pDamage))))) {
+        PixmapPtr pFlip = pvfb->flip.pPixmap;
+        RegionPtr pRegion = pvfb->flip.pDamage ? DamageRegion(pvfb->flip.pDamage) : NULL;
+
+        renderer_window_upload(pvfb->flip.window, pFlip->drawable.width, pFlip->drawable.height, pFlip->devKind,
+                               pFlip->devPrivate.ptr, pvfb->flip.dirty || !pRegion ? NULL : RegionRects(pRegion),
+                               pvfb->flip.dirty || !pRegion ? 0 : RegionNumRects(pRegion));
+        if (pvfb->flip.pDamage)
+            DamageEmpty(pvfb->flip.pDamage);
+        pvfb->flip.dirty = FALSE;
+        redraw |= 1;
+    }
+
+    damaged = pvfb->buf && lorieDamageNotEmpty();
+    if (damaged) {
+        BoxRec spans[256], *boxes;
+        int n = lorieDamageBoxes(pPixmap, spans, ARRAY_SIZE(spans), &boxes);
+
+        // Outputs which do not show damaged area are not redrawn.
+        for (i = 0; i < MAX_OUTPUTS; i++)
+            if (pvfb->outputs[i].win && lorieBoxesIntersect(boxes, n, &pvfb->outputs[i].box))
+                redraw |= 1 << i;
+
+        for (i = 1; i < MAX_OUTPUTS; i++)
+            if ((redraw & (1 << i)) && pvfb->outputs[i].buf)
+                lorieCopyToBuffer(pPixmap, pvfb->outputs[i].buf, &pvfb->outputs[i].box, boxes, n);
+
+        if (pvfb->shadowData) {
+            lorieShadowWriteback(pPixmap, boxes, n);
+            lorieDamageEmpty();
+        } else if (redraw & 1) {
+            int usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN | AHARDWAREBUFFER_USAGE_CPU_READ_RARELY;
+            void *data;
+
+            if (pvfb->locked)
+                AHardwareBuffer_unlock(pvfb->buf, NULL);
+
+            pvfb->locked = FALSE;
+            renderer_redraw(0);
+            redraw &= ~1;
+            pvfb->locked = AHardwareBuffer_lock(pvfb->buf, usage, -1, NULL, &data) == 0;
+            if (pvfb->locked) {
+                pScreen->ModifyPixmapHeader(pPixmap, -1, -1, -1, -1, -1, data);
+                lorieDamageEmpty();
+            }
+        } else
+            lorieDamageEmpty();
+    }
+
+    if (cursorMoved && !pvfb->rootless) {
+        for (i = 0; i < MAX_OUTPUTS; i++)
+            if (pvfb->outputs[i].win && (lorieBoxContains(&pvfb->outputs[i].box, cursorX, cursorY)
+                    || lorieBoxContains(&pvfb->outputs[i].box, pvfb->drawnCursorX, pvfb->drawnCursorY)))
+                redraw |= 1 << i;
+        pvfb->drawnCursorX = cursorX;
+        pvfb->drawnCursorY = cursorY;
+    }
+
+    for (i = 0; i < MAX_OUTPUTS; i++)
+        if (redraw & (1 << i))
+            renderer_redraw(i);
+
+    if (damaged || redraw || cursorMoved)
+        lorieLatencyPresented();
+    pvfb->redraw = 0;
 
     return 1000/MAX_FPS;
 }
 
+static RRCrtcPtr lorieGetCrtc(unused WindowPtr pWin) {
+    return pvfb->outputs[0].crtc;
+}
+
+static int lorieGetUstMsc(unused RRCrtcPtr crtc, uint64_t *ust, uint64_t *msc) {
+    *ust = pvfb->ust;
+    *msc = pvfb->msc;
+    return Success;
+}
+
+static void lorieTimerWake(void) {
+    if (pvfb->timerIdle) {
+        pvfb->timerIdle = FALSE;
+        TimerSet(pvfb->pTimer, 0, 1000 / HIDDEN_FPS, lorieTimerCallback, pScreenPtr);
+    }
+}
+
+static int lorieQueueVblank(unused RRCrtcPtr crtc, uint64_t eventId, uint64_t msc) {
+    lorieVblankPtr vblank = calloc(1, sizeof(lorieVblankRec));
+    if (!vblank)
+        return BadAlloc;
+
+    vblank->eventId = eventId;
+    vblank->msc = msc;
+    xorg_list_append(&vblank->list, &pvfb->vblankQueue);
+    lorieTimerWake();
+
+    return Success;
+}
+
+static void lorieAbortVblank(unused RRCrtcPtr crtc, uint64_t eventId, unused uint64_t msc) {
+    lorieVblankPtr vblank, tmp;
+
+    xorg_list_for_each_entry_safe(vblank, tmp, &pvfb->vblankQueue, list) {
+        if (vblank->eventId == eventId) {
+            xorg_list_del(&vblank->list);
+            free(vblank);
+            break;
+        }
+    }
+}
+
+static void lorieFlipDamageReport(unused DamagePtr pDamage, unused RegionPtr pRegion, unused void *closure) {
+    // Client keeps drawing to the flipped pixmap between flips, it should be shown without waiting for next flip.
+    lorieTimerWake();
+}
+
+static void lorieFlipDamageDestroy(unused DamagePtr pDamage, unused void *closure) {
+    pvfb->flip.pDamage = NULL;
+}
+
+static void lorieSetFlipPixmap(ScreenPtr pScreen, PixmapPtr pPixmap) {
+    BoxRec box = { 0, 0, pScreen->width, pScreen->height };
+
+    if (pPixmap == pvfb->flip.pPixmap) {
+        // Same pixmap flipped again, everything drawn to it is already tracked by damage.
+        pvfb->flip.dirty |= pPixmap && !pvfb->flip.pDamage;
+        return;
+    }
+
+    if (pPixmap)
+        pPixmap->refcnt++;
+    if (pvfb->flip.pDamage)
+        DamageDestroy(pvfb->flip.pDamage);
+    if (pvfb->flip.pPixmap)
+        pScreen->DestroyPixmap(pvfb->flip.pPixmap);
+    pvfb->flip.pPixmap = pPixmap;
+    pvfb->flip.dirty = pPixmap != NULL;
+    if (pPixmap) {
+        pvfb->flip.pDamage = DamageCreate(lorieFlipDamageReport, lorieFlipDamageDestroy, DamageReportNonEmpty,
+                                          TRUE, pScreen, NULL);
+        if (pvfb->flip.pDamage)
+            DamageRegister(&pPixmap->drawable, pvfb->flip.pDamage);
+    }
+    renderer_set_scanout(pPixmap ? pvfb->flip.window : NULL);
+    lorieRedraw(&box);
+}
+
+/*
+ * Present core already checks that the window is not redirected and nothing overlaps it, so the
+ * window is the only thing visible on the screen. Its pixmap can be shown directly while other
+ * windows are not mapped over it, root pixmap is not updated at all during that time.
+ * Without -shadow root pixmap already is the locked hardware buffer and presenting it costs no copy,
+ * so flipping would only add a texture upload. With -shadow it saves both the Present copy to the
+ * shadow and the writeback to hardware buffer.
+ */
+static Bool lorieCheckFlip(RRCrtcPtr crtc, unused WindowPtr pWin, PixmapPtr pPixmap, unused Bool sync_flip) {
+    int i;
+
+    if (!pvfb->shadow)
+        return FALSE;
+
+    // Additional outputs copy their parts of the screen from root pixmap.
+    for (i = 1; i < MAX_OUTPUTS; i++)
+        if (pvfb->outputs[i].box.x2 > pvfb->outputs[i].box.x1)
+            return FALSE;
+
+    return crtc == pvfb->outputs[0].crtc && pPixmap->drawable.bitsPerPixel == 32 && pPixmap->devPrivate.ptr
+           && pPixmap->drawable.width == pvfb->width && pPixmap->drawable.height == pvfb->height;
+}
+
+static Bool lorieFlip(unused RRCrtcPtr crtc, uint64_t eventId, unused uint64_t target_msc, PixmapPtr pPixmap, unused Bool sync_flip) {
+    if (!pvfb->flip.window && !(pvfb->flip.window = renderer_window_create()))
+        return FALSE;
+
+    // Pixmap is uploaded and completion is reported by the next frame.
+    lorieResidencyAccess(pPixmap);
+    lorieSetFlipPixmap(pPixmap->drawable.pScreen, pPixmap);
+    pvfb->flip.eventId = eventId;
+    pvfb->flip.pending = TRUE;
+    lorieTimerWake();
+    return TRUE;
+}
+
+static void lorieUnflip(ScreenPtr pScreen, uint64_t eventId) {
+    // Present copies the flipped pixmap to root pixmap, it is shown with the next frame as usual.
+    lorieSetFlipPixmap(pScreen, NULL);
+    present_event_notify(eventId, pvfb->ust, pvfb->msc);
+}
+
+static present_screen_info_rec loriePresentInfo = {
+    .version = PRESENT_SCREEN_INFO_VERSION,
+    .get_crtc = lorieGetCrtc,
+    .get_ust_msc = lorieGetUstMsc,
+    .queue_vblank = lorieQueueVblank,
+    .abort_vblank = lorieAbortVblank,
+    .flush = VoidNoop,
+    .check_flip = lorieCheckFlip,
+    .flip = lorieFlip,
+    .unflip = lorieUnflip,
+    .capabilities = PresentCapabilityNone,
+};
+
+static void lorieVisibleQueryValue(unused void *pCounter, int64_t *value) {
+    *value = lorieVisible();
+}
+
+/*
+ * Shadow buffer duplicates the whole screen. While there is no surface it can be dropped
+ * and fb renders directly to the hardware buffer, just like without shadow.
+ */
+static size_t lorieShadowRelease(ScreenPtr pScreen) {
+    PixmapPtr pPixmap = pScreen->GetScreenPixmap(pScreen);
+    int usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN | AHARDWAREBUFFER_USAGE_CPU_READ_RARELY;
+    AHardwareBuffer_Desc desc;
+    void *data;
+
+    if (!pvfb->shadow || !pvfb->shadowData || lorieVisible() || !pvfb->buf)
+        return 0;
+
+    if (lorieDamageNotEmpty()) {
+        BoxRec spans[256], *boxes;
+        int n = lorieDamageBoxes(pPixmap, spans, ARRAY_SIZE(spans), &boxes);
+        lorieShadowWriteback(pPixmap, boxes, n);
+        lorieDamageEmpty();
+    }
+
+    AHardwareBuffer_describe(pvfb->buf, &desc);
+    if (AHardwareBuffer_lock(pvfb->buf, usage, -1, NULL, &data) != 0)
+        return 0;
+
+    pScreen->ModifyPixmapHeader(pPixmap, -1, -1, -1, -1, -1, data);
+    free(pvfb->shadowData);
+    pvfb->shadowData = NULL;
+    pvfb->locked = TRUE;
+    return (size_t) desc.stride * 4 * desc.height;
+}
+
+static void lorieShadowRestore(ScreenPtr pScreen) {
+    PixmapPtr pPixmap = pScreen->GetScreenPixmap(pScreen);
+    AHardwareBuffer_Desc desc;
+    void *data;
+
+    if (!pvfb->shadow || pvfb->shadowData || !pvfb->locked)
+        return;
+
+    AHardwareBuffer_describe(pvfb->buf, &desc);
+    data = lorieShadowAllocate(desc.stride * 4, desc.height);
+    if (!data)
+        return; // Keep rendering to hardware buffer, it is slower but correct.
+
+    memcpy(data, pPixmap->devPrivate.ptr, (size_t) pPixmap->devKind * pvfb->height);
+    AHardwareBuffer_unlock(pvfb->buf, NULL);
+    pScreen->ModifyPixmapHeader(pPixmap, -1, -1, -1, -1, -1, data);
+    pvfb->shadowData = data;
+    pvfb->locked = FALSE;
+}
+
+Bool lorieTrimMemory(unused ClientPtr pClient, void *closure) {
+    int level = (int) (int64_t) closure, slot = min(max(level, 0), TRIM_MEMORY_COMPLETE) / 5;
+    size_t renderer = 0, slabs = 0, shadow = 0;
+
+    if (!pScreenPtr)
+        return TRUE;
+
+    if (level >= pvfb->trim.rendererLevel)
+        renderer = renderer_trim();
+    if (level >= pvfb->trim.slabLevel)
+        slabs = lorieSlabTrim();
+    if (level >= pvfb->trim.shadowLevel)
+        shadow = lorieShadowRelease(pScreenPtr);
+
+    pvfb->trim.released[slot] += renderer + slabs + shadow;
+    __android_log_print(ANDROID_LOG_INFO, "Xlorie", "trim level %d: released renderer %zu KiB, slabs %zu KiB, "
+                        "shadow %zu KiB, %zu KiB at this level in total", level, renderer >> 10, slabs >> 10,
+                        shadow >> 10, pvfb->trim.released[slot] >> 10);
+    lorieSlabLogStats();
+    return TRUE;
+}
+
+static void lorieSetVisible(ScreenPtr pScreen, Bool visible) {
+    if (visible)
+        lorieShadowRestore(pScreen);
+
+    if (pvfb->visibleCounter)
+        SyncChangeCounter(pvfb->visibleCounter, visible);
+
+    // Restart timer immediately so presenting resumes at full rate with the next frame.
+    if (visible && pvfb->pTimer) {
+        pvfb->timerIdle = FALSE;
+        TimerSet(pvfb->pTimer, 0, 1, lorieTimerCallback, pScreen);
+    }
+}
+
 static Bool lorieCreateScreenResources(ScreenPtr pScreen) {
     Bool ret;
     pScreen->CreateScreenResources = pvfb->createScreenResources;
@@ -241,24 +817,38 @@ static Bool lorieCreateScreenResources(ScreenPtr pScreen) {
     if (!ret)
         return FALSE;
 
-    pvfb->pDamage = DamageCreate(NULL, NULL, DamageReportNone, TRUE, pScreen, NULL);
+    if (pvfb->tileDamage) {
+        // Damage is reported raw and applied to tiles bitmap, lorieDamageReport keeps damage region empty.
+        pvfb->tiles = lorieTileDamageCreate(pScreen->width, pScreen->height);
+        if (!pvfb->tiles)
+            FatalError("Couldn't setup tile damage\n");
+        pvfb->pDamage = DamageCreate(lorieDamageReport, NULL, DamageReportRawRegion, TRUE, pScreen, NULL);
+    } else
+        pvfb->pDamage = DamageCreate(NULL, NULL, DamageReportNone, TRUE, pScreen, NULL);
     if (!pvfb->pDamage)
         FatalError("Couldn't setup damage\n");
 
     DamageRegister(&(*pScreen->GetScreenPixmap)(pScreen)->drawable, pvfb->pDamage);
     pvfb->pTimer = TimerSet(NULL, 0, 1000 / MAX_FPS, lorieTimerCallback, pScreen);
-    renderer_set_buffer(pvfb->buf);
+    pvfb->timerIdle = FALSE;
+
+    // Clients can watch this counter to stop rendering while the session is in background.
+    pvfb->visibleCounter = SyncCreateSystemCounter("SCREEN-VISIBLE", lorieVisible(), 1,
+                                                   XSyncCounterUnrestricted, lorieVisibleQueryValue, NULL);
+    lorieOutputSetBuffer(0);
 
     return TRUE;
 }
 
 static Bool
 lorieCloseScreen(ScreenPtr pScreen) {
+    int i;
+
     pScreen->CloseScreen = pvfb->closeScreen;
 
-    if (pvfb->win && pvfb->locked) {
+    if (pvfb->outputs[0].win && pvfb->locked) {
         pScreen->ModifyPixmapHeader(pScreen->GetScreenPixmap(pScreen), -1, -1, -1, -1, -1, NULL);
-        ANativeWindow_unlockAndPost(pvfb->win);
+        ANativeWindow_unlockAndPost(pvfb->outputs[0].win);
         pvfb->locked = FALSE;
     }
 
@@ -274,48 +864,175 @@ lorieCloseScreen(ScreenPtr pScreen) {
         pvfb->buf = NULL;
     }
 
-    pvfb->output = NULL;
-    pvfb->crtc = NULL;
+    if (pvfb->tiles) {
+        lorieTileDamageDestroy(pvfb->tiles);
+        pvfb->tiles = NULL;
+    }
+
+    free(pvfb->shadowData);
+    pvfb->shadowData = NULL;
+
+    lorieSetFlipPixmap(pScreen, NULL);
+    renderer_window_destroy(pvfb->flip.window);
+    pvfb->flip.window = NULL;
+    pvfb->flip.pending = FALSE;
+
+    while (!xorg_list_is_empty(&pvfb->vblankQueue)) {
+        lorieVblankPtr vblank = xorg_list_first_entry(&pvfb->vblankQueue, lorieVblankRec, list);
+        xorg_list_del(&vblank->list);
+        free(vblank);
+    }
+
+    if (pvfb->pTimer) {
+        TimerFree(pvfb->pTimer);
+        pvfb->pTimer = NULL;
+    }
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (pvfb->outputs[i].buf)
+            AHardwareBuffer_release(pvfb->outputs[i].buf);
+        pvfb->outputs[i].buf = NULL;
+        pvfb->outputs[i].output = NULL;
+        pvfb->outputs[i].crtc = NULL;
+        pvfb->outputs[i].box = (BoxRec) {0};
+    }
+
+    pvfb->visibleCounter = NULL;
     pScreenPtr = NULL;
 
     return pScreen->CloseScreen(pScreen);
 }
 
-static Bool
-lorieRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height, CARD32 mmWidth, CARD32 mmHeight) {
+/*
+ * Root buffer is allocated with some spare room so most of resizes (like showing or hiding
+ * soft keyboard) can be done in place, without reallocating buffer and losing its contents.
+ */
+#define BUFFER_ALIGN(x) (((x) + 127) & ~127)
+
+static Bool lorieBufferFits(AHardwareBuffer_Desc *desc, int width, int height) {
+    // Buffer which is too large is a waste of memory, reallocate it in this case.
+    return width <= desc->width && height <= desc->height &&
+           (uint64_t) width * height * 4 >= (uint64_t) desc->width * desc->height;
+}
+
+static Bool lorieReallocateBuffer(ScreenPtr pScreen, int width, int height) {
+    PixmapPtr pPixmap = pScreen->GetScreenPixmap(pScreen);
+    struct AHardwareBuffer *old = pvfb->buf;
     AHardwareBuffer_Desc desc = {};
-    void* data;
+    void *data = NULL;
 
-    if (width != pvfb->width || height != pvfb->height) {
-        SetRootClip(pScreen, ROOT_CLIP_NONE);
-        DamageEmpty(lorieScreen.pDamage);
-        pScreen->ResizeWindow(pScreen->root, 0, 0, width, height, NULL);
+    desc.width = BUFFER_ALIGN(width);
+    desc.height = BUFFER_ALIGN(height);
+    desc.layers = 1;
+    desc.usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN;
+    desc.format = 5; // Corresponds to HAL_PIXEL_FORMAT_BGRA_8888
+
+    // I could use this, but in this case I must swap colours in shader.
+    // desc.format = AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM;
+
+    if (old) {
+        // Keep headroom of the old buffer so switching back (i.e. on rotation) will not reallocate it.
+        AHardwareBuffer_Desc oldDesc = {}, wide = desc;
+        AHardwareBuffer_describe(old, &oldDesc);
+        wide.width = max(desc.width, oldDesc.width);
+        wide.height = max(desc.height, oldDesc.height);
+        if (lorieBufferFits(&wide, width, height))
+            desc = wide;
+    }
 
-        if (pvfb->buf) {
-            AHardwareBuffer_release(pvfb->buf);
-            pvfb->buf = NULL;
-        }
+    if (AHardwareBuffer_allocate(&desc, &pvfb->buf) != 0) {
+        pvfb->buf = old;
+        return FALSE;
+    }
 
-        desc.width = width;
-        desc.height = height;
-        desc.layers = 1;
-        desc.usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN;
-        desc.format = 5; // Corresponds to HAL_PIXEL_FORMAT_BGRA_8888
+    AHardwareBuffer_describe(pvfb->buf, &desc);
+    if (pvfb->shadow)
+        data = lorieShadowAllocate(desc.stride * 4, desc.height);
+    else if (AHardwareBuffer_lock(pvfb->buf, desc.usage, -1, NULL, &data) != 0)
+        data = NULL;
 
-        // I could use this, but in this case I must swap colours in shader.
-        // desc.format = AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM;
+    if (!data) {
+        AHardwareBuffer_release(pvfb->buf);
+        pvfb->buf = old;
+        return FALSE;
+    }
 
-        AHardwareBuffer_allocate(&desc, &pvfb->buf);
-        renderer_set_buffer(pvfb->buf);
+    if (old) {
+        if ((pvfb->shadow || pvfb->locked) && pPixmap->devPrivate.ptr) {
+            // Copy part of the screen which survives resize to avoid repainting it.
+            int y, w = min(pvfb->width, width), h = min(pvfb->height, height);
+            for (y = 0; y < h; y++)
+                memcpy((char*) data + y * desc.stride * 4, (char*) pPixmap->devPrivate.ptr + y * pPixmap->devKind, w * 4);
+        } else
+            pvfb->contentLost = TRUE;
+        if (pvfb->locked)
+            AHardwareBuffer_unlock(old, NULL);
+        AHardwareBuffer_release(old);
+    }
 
-        AHardwareBuffer_describe(pvfb->buf, &desc);
-        AHardwareBuffer_lock(pvfb->buf, desc.usage, -1, NULL, &data);
-        pScreen->ModifyPixmapHeader(pScreen->GetScreenPixmap(pScreen), desc.width, desc.height, -1,
-                                    -1, desc.stride * 4, data);
+    if (pvfb->shadow) {
+        free(pvfb->shadowData);
+        pvfb->shadowData = data;
+    }
+    pvfb->locked = !pvfb->shadow;
+    pScreen->ModifyPixmapHeader(pPixmap, -1, -1, -1, -1, desc.stride * 4, data);
+    return TRUE;
+}
 
-        pvfb->width = pScreen->width = width;
-        pvfb->height = pScreen->height = height;
-        SetRootClip(pScreen, ROOT_CLIP_FULL);
+static void lorieExposeAll(ScreenPtr pScreen) {
+    // Resetting root clip makes every mapped window exposed.
+    SetRootClip(pScreen, ROOT_CLIP_NONE);
+    SetRootClip(pScreen, ROOT_CLIP_FULL);
+    pvfb->contentLost = FALSE;
+}
+
+static Bool
+lorieRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height, CARD32 mmWidth, CARD32 mmHeight) {
+    AHardwareBuffer_Desc desc = {};
+
+    if (width != pvfb->width || height != pvfb->height) {
+        Bool reallocated = FALSE;
+        pScreen->width = width;
+        pScreen->height = height;
+
+        if (pvfb->buf)
+            AHardwareBuffer_describe(pvfb->buf, &desc);
+
+        if (!pvfb->buf || !lorieBufferFits(&desc, width, height)) {
+            if (!lorieReallocateBuffer(pScreen, width, height)) {
+                pScreen->width = pvfb->width;
+                pScreen->height = pvfb->height;
+                return FALSE;
+            }
+            reallocated = TRUE;
+        }
+
+        if (pvfb->tiles) {
+            lorieTileDamageDestroy(pvfb->tiles);
+            pvfb->tiles = lorieTileDamageCreate(width, height);
+            if (!pvfb->tiles)
+                FatalError("Couldn't setup tile damage\n");
+        }
+        DamageEmpty(lorieScreen.pDamage);
+        pScreen->ModifyPixmapHeader(pScreen->GetScreenPixmap(pScreen), width, height, -1, -1, -1, NULL);
+        pvfb->width = width;
+        pvfb->height = height;
+        lorieOutputSetBuffer(0);
+
+        if (pvfb->shadow && reallocated) {
+            // New hardware buffer is empty, the whole shadow should be written to it.
+            BoxRec box = { .x1 = 0, .y1 = 0, .x2 = width, .y2 = height };
+            RegionRec reg;
+            RegionInit(&reg, &box, 1);
+            DamageRegionAppend(&pScreen->GetScreenPixmap(pScreen)->drawable, &reg);
+            RegionUninit(&reg);
+        }
+
+        // Root clip is not reset so only newly uncovered parts of windows get exposed.
+        if (pvfb->contentLost)
+            lorieExposeAll(pScreen);
+        else
+            SetRootClip(pScreen, ROOT_CLIP_FULL);
     }
 
     pScreen->mmWidth = mmWidth;
@@ -328,10 +1045,128 @@ lorieRRScreenSetSize(ScreenPtr pScreen, CARD16 width, CARD16 height, CARD32 mmWi
     return TRUE;
 }
 
+static Bool lorieOutputReallocate(lorieOutputPtr out, int width, int height) {
+    AHardwareBuffer_Desc desc = {};
+
+    if (out->buf) {
+        AHardwareBuffer_describe(out->buf, &desc);
+        if (width && height && lorieBufferFits(&desc, width, height))
+            return TRUE;
+        AHardwareBuffer_release(out->buf);
+        out->buf = NULL;
+    }
+
+    if (!width || !height)
+        return TRUE;
+
+    desc = (AHardwareBuffer_Desc) {
+        .width = BUFFER_ALIGN(width),
+        .height = BUFFER_ALIGN(height),
+        .layers = 1,
+        .format = 5, // Corresponds to HAL_PIXEL_FORMAT_BGRA_8888
+        .usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN,
+    };
+    return AHardwareBuffer_allocate(&desc, &out->buf) == 0;
+}
+
+static Bool lorieCrtcSet(ScreenPtr pScreen, lorieOutputPtr out, RRModePtr mode, int x, int y) {
+    int i = out - pvfb->outputs;
+    BoxRec box = {0};
+
+    if (mode)
+        box = (BoxRec) { .x1 = x, .y1 = y, .x2 = x + mode->mode.width, .y2 = y + mode->mode.height };
+
+    // Output which did not change should not be copied and redrawn again.
+    if (mode == out->crtc->mode && !memcmp(&box, &out->box, sizeof(box)))
+        return TRUE;
+
+    if (i > 0 && !lorieOutputReallocate(out, box.x2 - box.x1, box.y2 - box.y1))
+        return FALSE;
+
+    out->box = box;
+    if (!RRCrtcNotify(out->crtc, mode, x, y, RR_Rotate_0, NULL, mode ? 1 : 0, &out->output))
+        return FALSE;
+
+    // Additional output shows another part of the screen now, it should be copied to its buffer.
+    if (i > 0 && mode && pvfb->pDamage) {
+        RegionRec reg;
+        RegionInit(&reg, &box, 1);
+        DamageRegionAppend(&pScreen->GetScreenPixmap(pScreen)->drawable, &reg);
+        RegionUninit(&reg);
+    }
+
+    lorieOutputSetBuffer(i);
+    return TRUE;
+}
+
 static Bool
-lorieRRCrtcSet(unused ScreenPtr pScreen, RRCrtcPtr crtc, RRModePtr mode, int x, int y,
-               Rotation rotation, int numOutput, RROutputPtr *outputs) {
-  return RRCrtcNotify(crtc, mode, x, y, rotation, NULL, numOutput, outputs);
+lorieRRCrtcSet(ScreenPtr pScreen, RRCrtcPtr crtc, RRModePtr mode, int x, int y,
+               unused Rotation rotation, int numOutput, unused RROutputPtr *outputs) {
+    lorieOutputPtr out = crtc->devPrivate;
+
+    // Root buffer is shown by the first output directly, so its CRTC can not be moved.
+    if (out == pvfb->outputs && (x || y))
+        return FALSE;
+
+    return lorieCrtcSet(pScreen, out, numOutput ? mode : NULL, x, y);
+}
+
+/*
+ * Sizes of outputs are decided by Android. Outputs are placed left to right in order of their numbers
+ * and the screen is resized to fit all of them.
+ */
+static void lorieLayoutOutputs(ScreenPtr pScreen, lorieOutputPtr changed, RRModePtr changedMode) {
+    RRModePtr modes[MAX_OUTPUTS];
+    int i, x = 0, width = 0, height = 0;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        modes[i] = &pvfb->outputs[i] == changed ? changedMode : pvfb->outputs[i].crtc->mode;
+        if (modes[i]) {
+            width += modes[i]->mode.width;
+            height = max(height, modes[i]->mode.height);
+        }
+    }
+
+    if (!width || !height)
+        return;
+
+    RRScreenSizeSet(pScreen, width, height, width * 25.4 / monitorResolution, height * 25.4 / monitorResolution);
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        lorieCrtcSet(pScreen, &pvfb->outputs[i], modes[i], x, 0);
+        if (modes[i])
+            x += modes[i]->mode.width;
+    }
+}
+
+static Bool lorieRRCrtcSetGamma(unused ScreenPtr pScreen, RRCrtcPtr crtc) {
+    lorieOutputPtr out = crtc->devPrivate;
+
+    renderer_set_gamma(out - pvfb->outputs, crtc->gammaSize, crtc->gammaRed, crtc->gammaGreen, crtc->gammaBlue);
+    lorieRedraw(&out->box);
+    return TRUE;
+}
+
+/*
+ * 3D LUT is set with output property, an array of N^3 0xRRGGBB values with red changing fastest
+ * and N between 2 and 33. Empty property disables LUT.
+ */
+static Bool lorieRROutputSetProperty(unused ScreenPtr pScreen, RROutputPtr output, Atom property, RRPropertyValuePtr value) {
+    lorieOutputPtr out = output->devPrivate;
+    int size;
+
+    if (property != MakeAtom(LUT_PROPERTY, strlen(LUT_PROPERTY), TRUE))
+        return TRUE;
+
+    if (value->size && (value->type != XA_INTEGER || value->format != 32))
+        return FALSE;
+
+    for (size = 0; size <= 33 && size * size * size < value->size; size++);
+    if (value->size && (size < 2 || size > 33 || size * size * size != value->size))
+        return FALSE;
+
+    renderer_set_lut(out - pvfb->outputs, size, value->data);
+    lorieRedraw(&out->box);
+    return TRUE;
 }
 
 static Bool
@@ -344,7 +1179,9 @@ static Bool
 lorieRandRInit(ScreenPtr pScreen) {
     rrScrPrivPtr pScrPriv;
 #if RANDR_12_INTERFACE
+    Atom lut = MakeAtom(LUT_PROPERTY, strlen(LUT_PROPERTY), TRUE);
     RRModePtr mode;
+    int i;
 #endif
 
     if (!RRScreenInit(pScreen))
@@ -354,6 +1191,8 @@ lorieRandRInit(ScreenPtr pScreen) {
 #if RANDR_12_INTERFACE
     pScrPriv->rrCrtcSet = lorieRRCrtcSet;
     pScrPriv->rrScreenSetSize = lorieRRScreenSetSize;
+    pScrPriv->rrCrtcSetGamma = lorieRRCrtcSetGamma;
+    pScrPriv->rrOutputSetProperty = lorieRROutputSetProperty;
 
     RRScreenSetSizeRange(pScreen, 1, 1, 32767, 32767);
 
@@ -361,22 +1200,37 @@ lorieRandRInit(ScreenPtr pScreen) {
     if (!mode)
        return FALSE;
 
-    pvfb->crtc = RRCrtcCreate(pScreen, NULL);
-    if (!pvfb->crtc)
-       return FALSE;
-
-    /* This is to avoid xrandr to complain about the gamma missing */
-    RRCrtcGammaSetSize(pvfb->crtc, 256);
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        lorieOutputPtr out = &pvfb->outputs[i];
+        char name[16] = "screen";
+        if (i)
+            snprintf(name, sizeof(name), "external-%d", i);
+
+        out->crtc = RRCrtcCreate(pScreen, out);
+        if (!out->crtc)
+           return FALSE;
+
+        // Gamma ramp is applied by the renderer while drawing the output.
+        if (!RRCrtcGammaSetSize(out->crtc, 256))
+            return FALSE;
+
+        // Additional outputs are connected when Android reports external display.
+        out->output = RROutputCreate(pScreen, name, strlen(name), out);
+        if (!out->output)
+           return FALSE;
+        if (!( RROutputSetClones(out->output, NULL, 0)
+            && RROutputSetCrtcs(out->output, &out->crtc, 1)
+            && RROutputSetConnection(out->output, i ? RR_Disconnected : RR_Connected) ))
+            return FALSE;
+
+        if (RRConfigureOutputProperty(out->output, lut, FALSE, FALSE, FALSE, 0, NULL) != Success
+            || RRChangeOutputProperty(out->output, lut, XA_INTEGER, 32, PropModeReplace, 0, NULL, FALSE, FALSE) != Success)
+            return FALSE;
+    }
 
-    pvfb->output = RROutputCreate(pScreen, "screen", 6, NULL);
-    if (!pvfb->output)
-       return FALSE;
-    if (!( RROutputSetClones(pvfb->output, NULL, 0)
-        && RROutputSetModes(pvfb->output, &mode, 1, 0)
-        && RROutputSetCrtcs(pvfb->output, &pvfb->crtc, 1)
-        && RROutputSetConnection(pvfb->output, RR_Connected) ))
+    if (!RROutputSetModes(pvfb->outputs[0].output, &mode, 1, 0))
         return FALSE;
-    RRCrtcNotify(pvfb->crtc, mode, 0, 0, RR_Rotate_0, NULL, 1, &pvfb->output);
+    return lorieCrtcSet(pScreen, &pvfb->outputs[0], mode, 0, 0);
 #endif
     return TRUE;
 }
@@ -396,33 +1250,58 @@ lorieScreenInit(ScreenPtr pScreen, unused int argc, unused char **argv) {
 
     pScreenPtr = pScreen;
 
-    desc.width = pvfb->width;
-    desc.height = pvfb->height;
+    desc.width = BUFFER_ALIGN(pvfb->width);
+    desc.height = BUFFER_ALIGN(pvfb->height);
     desc.layers = 1;
     desc.usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN;
-    desc.format = AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM;
+    desc.format = 5; // Corresponds to HAL_PIXEL_FORMAT_BGRA_8888, the same as buffers allocated on resize
 
     AHardwareBuffer_allocate(&desc, &pvfb->buf);
 
     AHardwareBuffer_describe(pvfb->buf, &desc);
-    AHardwareBuffer_lock(pvfb->buf, desc.usage, -1, NULL, &data);
+    if (pvfb->shadow)
+        data = pvfb->shadowData = lorieShadowAllocate(desc.stride * 4, desc.height);
+    else
+        AHardwareBuffer_lock(pvfb->buf, desc.usage, -1, NULL, &data);
     if (!data)
         return FALSE;
 
-    pvfb->locked = TRUE;
+    pvfb->locked = !pvfb->shadow;
     miSetVisualTypesAndMasks(24, ((1 << TrueColor) | (1 << DirectColor)), 8, TrueColor, 0xFF0000, 0x00FF00, 0x0000FF);
     miSetPixmapDepths();
 
-    ret = fbScreenInit(pScreen, data, desc.width, desc.height, monitorResolution, monitorResolution, desc.stride, 32);
+    ret = fbScreenInit(pScreen, data, pvfb->width, pvfb->height, monitorResolution, monitorResolution, desc.stride, 32);
     if (ret)
         fbPictureInit(pScreen, 0, 0);
 
     if (!ret)
         return FALSE;
 
+    if (!lorieSlabInit(pScreen) || !lorieResidencyInit(pScreen, pvfb->compressIdle))
+        return FALSE;
+
+    if (!lorieParallelInit(pScreen, pvfb->rasterThreads))
+        return FALSE;
+
     if (!lorieRandRInit(pScreen))
        return FALSE;
 
+    xorg_list_init(&pvfb->vblankQueue);
+    if (!present_screen_init(pScreen, &loriePresentInfo))
+        return FALSE;
+
+    if (!lorieXvInit(pScreen))
+        return FALSE;
+
+    if (pvfb->rootless && !lorieLayersInit()) {
+        __android_log_print(ANDROID_LOG_ERROR, "Xlorie", "Surface layers are not supported, compositing windows on GPU instead");
+        pvfb->rootless = FALSE;
+        pvfb->compositor = TRUE;
+    }
+
+    if ((pvfb->compositor || pvfb->rootless) && !lorieCompositorInit(pScreen, pvfb->rootless))
+        return FALSE;
+
     miPointerInitialize(pScreen, &loriePointerSpriteFuncs, &loriePointerCursorFuncs, TRUE);
 
     pScreen->blackPixel = 0;
@@ -448,11 +1327,15 @@ lorieScreenInit(ScreenPtr pScreen, unused int argc, unused char **argv) {
 Bool lorieChangeWindow(unused ClientPtr pClient, void *closure) {
     struct ANativeWindow* win = (struct ANativeWindow*) closure;
     ScreenPtr pScreen = pScreenPtr;
-    RegionRec reg;
     BoxRec box = { .x1 = 0, .y1 = 0, .x2 = pScreen->root->drawable.width, .y2 = pScreen->root->drawable.height};
-    pvfb->win = win;
-    renderer_set_window(win);
-    renderer_set_buffer(pvfb->buf);
+    pvfb->outputs[0].win = win;
+    lorieSetVisible(pScreen, lorieVisible());
+    renderer_set_window(0, win);
+    lorieOutputSetBuffer(0);
+    if (pvfb->rootless)
+        lorieLayersSetParent(win);
+    // Texture could be lost while there was no surface.
+    pvfb->flip.dirty = pvfb->flip.pPixmap != NULL;
 
     if (CursorVisible && EnableCursor) {
         int x, y;
@@ -464,29 +1347,59 @@ Bool lorieChangeWindow(unused ClientPtr pClient, void *closure) {
         lorieSetCursor(NULL, NULL, pCursor, box.x2/2, box.y2/2);
     }
 
-    if (win) {
-        RegionInit(&reg, &box, 1);
-        pScreen->WindowExposures(pScreen->root, &reg);
-        DamageRegionAppend(&pScreen->GetScreenPixmap(pScreen)->drawable, &reg);
-        RegionUninit(&reg);
-    }
+    // Root buffer is owned by X server and survives surface loss, renderer already presented it
+    // to the new surface. Clients should repaint their windows only if buffer contents were lost.
+    if (win && pvfb->contentLost)
+        lorieExposeAll(pScreen);
 
     return TRUE;
 }
 
 void lorieConfigureNotify(int width, int height) {
     ScreenPtr pScreen = pScreenPtr;
-    if (pvfb->output && width && height) {
-        CARD32 mmWidth, mmHeight;
+    lorieOutputPtr out = &pvfb->outputs[0];
+    if (out->output && width && height) {
         RRModePtr mode = lorieCvt(width, height);
-        mmWidth = ((double) (mode->mode.width)) * 25.4 / monitorResolution;
-        mmHeight = ((double) (mode->mode.width)) * 25.4 / monitorResolution;
-        RROutputSetModes(pvfb->output, &mode, 1, 0);
-        RRCrtcNotify(pvfb->crtc, mode,0, 0,RR_Rotate_0, NULL, 1, &pvfb->output);
-        RRScreenSizeSet(pScreen, mode->mode.width, mode->mode.height, mmWidth, mmHeight);
+        RROutputSetModes(out->output, &mode, 1, 0);
+        lorieLayoutOutputs(pScreen, out, mode);
     }
 }
 
+Bool lorieOutputChanged(unused ClientPtr pClient, void *closure) {
+    lorieOutputChangePtr change = closure;
+    ScreenPtr pScreen = pScreenPtr;
+    lorieOutputPtr out;
+
+    if (!pScreen || change->output <= 0 || change->output >= MAX_OUTPUTS) {
+        if (change->win)
+            ANativeWindow_release(change->win);
+        free(change);
+        return TRUE;
+    }
+
+    out = &pvfb->outputs[change->output];
+    out->win = change->win;
+    renderer_set_window(change->output, change->win);
+
+    if (change->win && change->width > 0 && change->height > 0) {
+        RRModePtr mode = lorieCvt(change->width, change->height);
+        RROutputSetModes(out->output, &mode, 1, 0);
+        RROutputSetConnection(out->output, RR_Connected);
+        lorieLayoutOutputs(pScreen, out, mode);
+    } else if (!change->win) {
+        RROutputSetModes(out->output, NULL, 0, 0);
+        RROutputSetConnection(out->output, RR_Disconnected);
+        lorieLayoutOutputs(pScreen, out, NULL);
+    }
+
+    // Output buffer keeps its contents, it is presented to the new surface without copying.
+    lorieOutputSetBuffer(change->output);
+    lorieSetVisible(pScreen, lorieVisible());
+    RRTellChanged(pScreen);
+    free(change);
+    return TRUE;
+}
+
 void
 InitOutput(ScreenInfo * screen_info, int argc, char **argv) {
     int depths[] = { 1, 4, 8, 15, 16, 24, 32 };
@@ -511,6 +1424,8 @@ InitOutput(ScreenInfo * screen_info, int argc, char **argv) {
     renderer_init();
     xorgGlxCreateVendor();
     tx11_protocol_init();
+    lorieInputSetCoalescing(pvfb->coalesceDepth, pvfb->rawMotion);
+    lorieLatencyInit();
     GlxPushProvider(&androidProvider);
 
     if (-1 == AddScreen(lorieScreenInit, argc, argv)) {
@@ -105,6 +105,7 @@ static struct altKeysym_t {
 };
 
 void lorieKeysymKeyboardEvent(KeySym keysym, int down);
+void lorieTextInput(const KeySym *keysyms, int count);
 KeyCode lorieKeysymToKeycode(KeySym keysym, unsigned state, unsigned *new_state);
 
 /* Stolen from libX11 */
@@ -588,31 +589,27 @@ static int lorieIsAffectedByNumLock(KeyCode keycode) {
 	return 1;
 }
 
-static KeyCode lorieAddKeysym(KeySym keysym, unused unsigned state) {
-	DeviceIntPtr master;
-	XkbDescPtr xkb;
-	unsigned int key;
+/* Extends the range of changed keys by one key */
+static void lorieAddKeyChange(KeyCode *first, unsigned char *num, KeyCode key) {
+	unsigned int last;
 
-	XkbEventCauseRec cause;
-	XkbChangesRec changes;
+	if (*num == 0) {
+		*first = key;
+		*num = 1;
+		return;
+	}
+
+	last = max(*first + *num - 1, key);
+	*first = min(*first, key);
+	*num = last - *first + 1;
+}
 
+/* Binds keysym (both cases of it) to the key, the change is only recorded and is not sent */
+static void lorieBindKeysym(XkbDescPtr xkb, KeyCode key, KeySym keysym, XkbChangesPtr changes) {
 	int types[1];
 	KeySym *syms;
 	KeySym upper, lower;
 
-	master = GetMaster(lorieKeyboard, KEYBOARD_OR_FLOAT);
-	xkb = master->key->xkbInfo->desc;
-
-	static int curFakeKeyIdx = 0;
-	key = fakeKeys[curFakeKeyIdx++];
-	if (curFakeKeyIdx >= ARRAY_SIZE(fakeKeys))
-		curFakeKeyIdx = 0;
-
-	memset(&changes, 0, sizeof(changes));
-	memset(&cause, 0, sizeof(cause));
-
-	XkbSetCauseUnknown(&cause)
-
 	/*
 	 * Tools like xkbcomp get confused if there isn't a name
 	 * assigned to the keycode we're trying to use.
@@ -624,23 +621,45 @@ static KeyCode lorieAddKeysym(KeySym keysym, unused unsigned state) {
 		xkb->names->keys[key].name[2] = '0' + (key /  10) % 10;
 		xkb->names->keys[key].name[3] = '0' + (key /   1) % 10;
 
-		changes.names.changed |= XkbKeyNamesMask;
-		changes.names.first_key = key;
-		changes.names.num_keys = 1;
+		changes->names.changed |= XkbKeyNamesMask;
+		lorieAddKeyChange(&changes->names.first_key, &changes->names.num_keys, key);
 	}
 
 	XkbConvertCase(keysym, &lower, &upper);
 	types[XkbGroup1Index] = XkbAlphabeticIndex;
 
-	XkbChangeTypesOfKey(xkb, (int) key, 1, XkbGroup1Mask, types, &changes.map);
+	XkbChangeTypesOfKey(xkb, (int) key, 1, XkbGroup1Mask, types, &changes->map);
 
 	syms = XkbKeySymsPtr(xkb, key);
 	syms[0] = lower;
 	syms[1] = upper;
 
-	changes.map.changed |= XkbKeySymsMask;
-	changes.map.first_key_sym = key;
-	changes.map.num_key_syms = 1;
+	changes->map.changed |= XkbKeySymsMask;
+	lorieAddKeyChange(&changes->map.first_key_sym, &changes->map.num_key_syms, key);
+}
+
+static KeyCode lorieAddKeysym(KeySym keysym, unused unsigned state) {
+	DeviceIntPtr master;
+	XkbDescPtr xkb;
+	unsigned int key;
+
+	XkbEventCauseRec cause;
+	XkbChangesRec changes;
+
+	master = GetMaster(lorieKeyboard, KEYBOARD_OR_FLOAT);
+	xkb = master->key->xkbInfo->desc;
+
+	static int curFakeKeyIdx = 0;
+	key = fakeKeys[curFakeKeyIdx++];
+	if (curFakeKeyIdx >= ARRAY_SIZE(fakeKeys))
+		curFakeKeyIdx = 0;
+
+	memset(&changes, 0, sizeof(changes));
+	memset(&cause, 0, sizeof(cause));
+
+	XkbSetCauseUnknown(&cause)
+
+	lorieBindKeysym(xkb, key, keysym, &changes);
 
 	XkbSendNotification(master, &changes, &cause);
 
@@ -648,14 +667,15 @@ static KeyCode lorieAddKeysym(KeySym keysym, unused unsigned state) {
 }
 
 /*
- * lorieKeysymKeyboardEvent() - work out the best keycode corresponding
+ * lorieKeysymQueueEvents() - work out the best keycode corresponding
  * to the keysym sent by the viewer. This is basically impossible in
  * the general case, but we make a best effort by assuming that all
  * useful keysyms can be reached using just the Shift and
  * Level 3 (AltGr) modifiers. For core keyboards this is basically
  * always true, and should be true for most sane, western XKB layouts.
+ * Called with input lock held, the queue is processed by the caller.
  */
-void lorieKeysymKeyboardEvent(KeySym keysym, int down) {
+static void lorieKeysymQueueEvents(KeySym keysym, int down) {
     int i;
     unsigned state, new_state;
     KeyCode keycode;
@@ -674,7 +694,6 @@ void lorieKeysymKeyboardEvent(KeySym keysym, int down) {
             if (pressedKeys[i] == keysym) {
                 pressedKeys[i] = NoSymbol;
                 QueueKeyboardEvents(lorieKeyboard, KeyRelease, i); // "keycode"
-                mieqProcessInputEvents();
                 return;
             }
         }
@@ -687,14 +706,6 @@ void lorieKeysymKeyboardEvent(KeySym keysym, int down) {
         return;
     }
 
-    /*
-     * Since we are checking the current state to determine if we need
-     * to fake modifiers, we must make sure that everything put on the
-     * input queue is processed before we start. Otherwise, shift may be
-     * stuck down.
-     */
-    mieqProcessInputEvents();
-
     state = lorieGetKeyboardState();
 
     keycode = lorieKeysymToKeycode(keysym, state, &new_state);
@@ -886,6 +897,26 @@ void lorieKeysymKeyboardEvent(KeySym keysym, int down) {
         for (i = 0;i < shift_release_count;i++)
 			QueueKeyboardEvents(lorieKeyboard, KeyPress, shift_release[i]); // "temp shift"
     }
+}
+
+/*
+ * Queue is processed with input lock released, input lock is recursive and
+ * holding it would block input thread while events are delivered to clients.
+ * Called without input lock.
+ */
+void lorieKeysymKeyboardEvent(KeySym keysym, int down) {
+    /*
+     * Since we are checking the current state to determine if we need
+     * to fake modifiers, we must make sure that everything put on the
+     * input queue is processed before we start. Otherwise, shift may be
+     * stuck down.
+     */
+    if (down)
+        mieqProcessInputEvents();
+
+    input_lock();
+    lorieKeysymQueueEvents(keysym, down);
+    input_unlock();
 
     /*
      * When faking a modifier we are putting a keycode (which can
@@ -896,3 +927,105 @@ void lorieKeysymKeyboardEvent(KeySym keysym, int down) {
      */
     mieqProcessInputEvents();
 }
+
+/* Key which generates keysym or its alternative in given state or with fake modifiers, 0 if there is none */
+static KeyCode lorieTextKeycode(KeySym keysym, unsigned state) {
+    unsigned new_state;
+    KeyCode keycode;
+    int i;
+
+    keycode = lorieKeysymToKeycode(keysym, state, &new_state);
+    for (i = 0; keycode == 0 && i < ARRAY_SIZE(altKeysym); i++) {
+        if (altKeysym[i].a == keysym)
+            keycode = lorieKeysymToKeycode(altKeysym[i].b, state, &new_state);
+        else if (altKeysym[i].b == keysym)
+            keycode = lorieKeysymToKeycode(altKeysym[i].a, state, &new_state);
+    }
+
+    return keycode;
+}
+
+/*
+ * lorieTextInput() - types keysyms one after another. Adding keysyms one by one
+ * sends a keymap change to every client for every character, which is slow for
+ * pasted or swiped text. Instead keysyms missing in the keymap are collected
+ * for the longest part of the text which fits into the free keys, bound with
+ * one keymap change and only then the keys are pressed. Free keys are the fake
+ * keys and the keys without symbols, keys used by the part are left alone. So
+ * usually whole text costs at most one keymap change. Called without input lock.
+ */
+void lorieTextInput(const KeySym *keysyms, int count) {
+    DeviceIntPtr master;
+    XkbDescPtr xkb;
+    XkbEventCauseRec cause;
+    XkbChangesRec changes;
+    Bool used[256];
+    KeyCode freeKeys[256], keycode;
+    unsigned state;
+    unsigned int key;
+    int start, end, i, freeCount, next, boundCount;
+
+    master = GetMaster(lorieKeyboard, KEYBOARD_OR_FLOAT);
+
+    for (start = 0; start < count; start = end) {
+        /* Input lock is held only while the keymap is changed, see lorieKeysymKeyboardEvent */
+        mieqProcessInputEvents();
+        input_lock();
+        state = lorieGetKeyboardState();
+        xkb = master->key->xkbInfo->desc;
+
+        /* Pressed keys must keep their symbols until release */
+        freeCount = 0;
+        memset(used, 0, sizeof(used));
+        for (i = 0; i < ARRAY_SIZE(fakeKeys); i++) {
+            used[fakeKeys[i]] = TRUE;
+            if (pressedKeys[fakeKeys[i]] == NoSymbol)
+                freeKeys[freeCount++] = fakeKeys[i];
+        }
+        for (key = xkb->min_key_code; key <= xkb->max_key_code; key++)
+            if (!used[key] && XkbKeyNumSyms(xkb, key) == 0 && pressedKeys[key] == NoSymbol)
+                freeKeys[freeCount++] = key;
+
+        /* Keymap is changed in place, so keysyms bound earlier in this part are found as usual */
+        memset(used, 0, sizeof(used));
+        memset(&changes, 0, sizeof(changes));
+        next = boundCount = 0;
+        for (end = start; end < count; end++) {
+            keycode = lorieTextKeycode(keysyms[end], state);
+            if (keycode != 0) {
+                used[keycode] = TRUE;
+                continue;
+            }
+
+            while (next < freeCount && used[freeKeys[next]])
+                next++;
+            if (next == freeCount)
+                break;
+
+            keycode = freeKeys[next++];
+            used[keycode] = TRUE;
+            boundCount++;
+            lorieBindKeysym(xkb, keycode, keysyms[end], &changes);
+        }
+
+        if (boundCount) {
+            memset(&cause, 0, sizeof(cause));
+            XkbSetCauseUnknown(&cause)
+            XkbSendNotification(master, &changes, &cause);
+            LogMessageVerb(X_INFO, 0, "Added %d keysyms for %d characters of text\n", boundCount, end - start);
+        }
+        input_unlock();
+
+        /* Nothing is free to bind this keysym even with the whole keymap */
+        if (end == start) {
+            LogMessageVerb(X_ERROR, -1, "Failure adding new keysym 0x%x\n", keysyms[end]);
+            end++;
+            continue;
+        }
+
+        for (i = start; i < end; i++) {
+            lorieKeysymKeyboardEvent(keysyms[i], TRUE);
+            lorieKeysymKeyboardEvent(keysyms[i], FALSE);
+        }
+    }
+}
@@ -3,6 +3,8 @@
 #include <jni.h>
 #include <android/log.h>
 #include <android/native_window_jni.h>
+#include <android/sharedmem.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
@@ -15,6 +17,7 @@
 #include <string.h>
 #include <libgen.h>
 #include <globals.h>
+#include <os.h>
 #include <xkbsrv.h>
 #include <errno.h>
 #include "renderer.h"
@@ -22,6 +25,7 @@
 #include "android-to-linux-keycodes.h"
 #include "whereami.h"
 #include "tx11.h"
+#include "inputring.h"
 
 static int argc = 0;
 static char** argv = NULL;
@@ -133,8 +137,31 @@ Java_com_termux_x11_CmdEntryPoint_windowChanged(JNIEnv *env, unused jobject cls,
     QueueWorkProc(lorieChangeWindow, NULL, win);
 }
 
+JNIEXPORT void JNICALL
+Java_com_termux_x11_CmdEntryPoint_outputChanged(JNIEnv *env, unused jobject cls, jint output, jobject surface, jint width, jint height) {
+    lorieOutputChangePtr change = calloc(1, sizeof(lorieOutputChangeRec));
+    if (!change)
+        return;
+
+    change->output = output;
+    change->win = surface ? ANativeWindow_fromSurface(env, surface) : NULL;
+    change->width = width;
+    change->height = height;
+    if (change->win)
+        ANativeWindow_acquire(change->win);
+    __android_log_print(ANDROID_LOG_INFO, "XlorieNative", "output %d change: %p %dx%d", output, change->win, width, height);
+
+    QueueWorkProc(lorieOutputChanged, NULL, change);
+}
+
+JNIEXPORT void JNICALL
+Java_com_termux_x11_CmdEntryPoint_trimMemory(unused JNIEnv *env, unused jobject cls, jint level) {
+    __android_log_print(ANDROID_LOG_INFO, "XlorieNative", "trim memory: level %d", level);
+    QueueWorkProc(lorieTrimMemory, NULL, (void*) (int64_t) level);
+}
+
 static Bool addFd(unused ClientPtr pClient, void *closure) {
-    AddClientOnOpenFD((int) (int64_t) closure);
+    lorieAddControlClient((int) (int64_t) closure);
     return TRUE;
 }
 
@@ -175,6 +202,10 @@ Java_com_termux_x11_CmdEntryPoint_getLogcatOutput(JNIEnv *env, unused jobject cl
 }
 
 static xcb_connection_t* conn = NULL;
+static int batchCount;
+static lorieInputRing *ring = NULL;
+static int ringNotify = -1;
+static bool ringPending = false;
 static int xfixes_first_event = 0;
 static xcb_errors_context_t *err_ctx = NULL;
 static xcb_window_t win = 0;
@@ -232,6 +263,14 @@ Java_com_termux_x11_MainActivity_connect(unused JNIEnv* env, unused jobject cls,
     if (conn)
         xcb_disconnect(conn);
     conn = new_conn;
+    batchCount = 0; // Events queued for the old connection are dropped
+    if (ring) {
+        munmap(ring, sizeof(*ring));
+        close(ringNotify);
+        ring = NULL;
+        ringNotify = -1;
+        ringPending = false;
+    }
     xcb_errors_context_new(conn, &err_ctx);
 
     __android_log_print(ANDROID_LOG_ERROR, "Xlorie-client", "XCB connection is successfull");
@@ -284,6 +323,38 @@ Java_com_termux_x11_MainActivity_connect(unused JNIEnv* env, unused jobject cls,
         parse_error(xcb_request_check(conn, cookie));
     }
 
+    {
+        // Input is sent through shared memory ring if X server accepts it, otherwise EventBatch requests are used.
+        // XCB closes descriptors it sends, so the server gets its own copy of eventfd.
+        int fd = ASharedMemory_create("lorie-input", sizeof(lorieInputRing));
+        int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        void *map = fd >= 0 ? mmap(NULL, sizeof(lorieInputRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        int efd_dup = efd >= 0 ? dup(efd) : -1;
+
+        if (map != MAP_FAILED && efd_dup >= 0) {
+            xcb_generic_error_t *ring_err;
+            memset(map, 0, sizeof(lorieInputRing));
+            ring_err = xcb_request_check(conn, xcb_tx11_input_ring_checked(conn, fd, efd_dup));
+            fd = efd_dup = -1;
+            if (!ring_err) {
+                ring = map;
+                ringNotify = efd;
+                map = MAP_FAILED;
+                efd = -1;
+            }
+            parse_error(ring_err);
+        }
+
+        if (map != MAP_FAILED)
+            munmap(map, sizeof(lorieInputRing));
+        if (fd >= 0)
+            close(fd);
+        if (efd >= 0)
+            close(efd);
+        if (efd_dup >= 0)
+            close(efd_dup);
+    }
+
     xcb_flush(conn);
 }
 
@@ -386,49 +457,119 @@ JNIEXPORT void JNICALL
 Java_com_termux_x11_MainActivity_sendWindowChange(unused JNIEnv* env, unused jobject cls, jint width, jint height) {
     if (conn) {
 //        __android_log_print(ANDROID_LOG_ERROR, "Xlorie-client", "Sending window changed: %d %d %d", width, height, dpi);
-        xcb_tx11_screen_size_change(conn, width, height);
+        xcb_tx11_screen_size_change(conn, width, height, GetTimeInMillis());
         xcb_flush(conn);
     }
 }
 
-JNIEXPORT void JNICALL
-Java_com_termux_x11_MainActivity_sendMouseEvent(unused JNIEnv* env, unused jobject cls, jfloat x, jfloat y, jint which_button, jboolean button_down, jboolean relative) {
-    if (conn) {
-        __android_log_print(ANDROID_LOG_ERROR, "Xlorie-client", "Sending mouse event: %f %f %d %d %d", x, y, which_button, button_down, relative);
-        xcb_tx11_mouse_event(conn, x, y, which_button, button_down, relative); // NOLINT(cppcoreguidelines-narrowing-conversions)
+/*
+ * Input events are written to the shared ring (see inputring.h) or accumulated and sent as one EventBatch request.
+ * Motion is flushed once per input frame by MainActivity, discrete events (buttons, keys, text) are flushed
+ * immediately together with motion which preceded them. Text is sent with TextInput request since X server
+ * changes keymap for it on main thread, pending events are flushed first to keep the order.
+ */
+static xcb_tx11_event_t batch[64];
+
+static bool ringPush(xcb_tx11_event_t *event) {
+    uint32_t head, tail;
+    if (!ring || event->kind == XCB_TX11_EVENT_KIND_UNICODE || batchCount)
+        return false;
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LORIE_INPUT_RING_SIZE)
+        return false;
+
+    ring->events[head & (LORIE_INPUT_RING_SIZE - 1)] = *event;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    ringPending = true;
+    return true;
+}
+
+static void flushEvents(void) {
+    if (ringPending) {
+        uint64_t count = 1;
+        write(ringNotify, &count, sizeof(count));
+        ringPending = false;
+    }
+    if (conn && batchCount) {
+        xcb_tx11_event_batch(conn, batchCount, GetTimeInMillis(), batch);
         xcb_flush(conn);
     }
+    batchCount = 0;
 }
 
-JNIEXPORT void JNICALL
-Java_com_termux_x11_MainActivity_sendTouchEvent(unused JNIEnv* env, unused jobject cls, jint action, jint id, jint x, jint y) {
-    if (conn) {
-        if (action >= 0) {
-//            __android_log_print(ANDROID_LOG_ERROR, "Xlorie-client","Sending touch event: %d %d %d %d", action, id, x, y);
-            xcb_tx11_touch_event(conn, action, id, x, y); // NOLINT(cppcoreguidelines-narrowing-conversions)
-        } else xcb_flush(conn);
-    }
+static void queueEvent(xcb_tx11_event_t event) {
+    if (batchCount == (int) ARRAY_SIZE(batch))
+        flushEvents();
+
+    // Once ring is full events go to the batch until it is flushed, so they are not reordered.
+    if (!ringPush(&event))
+        batch[batchCount++] = event;
 }
 
-JNIEXPORT jboolean JNICALL
-Java_com_termux_x11_MainActivity_sendKeyEvent(unused JNIEnv* env, unused jobject cls, jint scan_code, jint key_code, jboolean key_down) {
-    if (conn) {
-        int code = (scan_code) ?: android_to_linux_keycode[key_code];
-//        __android_log_print(ANDROID_LOG_ERROR, "Xlorie-client","Sending key event: %d %d %d %s", scan_code, key_code, code, key_down ? "press" : "release");
-        xcb_tx11_key_event(conn, code + 8, key_down);
-        xcb_flush(conn);
+// Events encoded by InputEventBuffer.java, layout must match.
+typedef struct {
+    int32_t kind, time, detail, code, flags;
+    float x, y;
+} lorieJavaEvent;
+
+#define LORIE_JAVA_EVENT_DOWN 1
+#define LORIE_JAVA_EVENT_RELATIVE 2
+
+JNIEXPORT void JNICALL
+Java_com_termux_x11_MainActivity_commitEvents(JNIEnv* env, unused jobject cls, jobject buffer, jint count) {
+    lorieJavaEvent *events = (*env)->GetDirectBufferAddress(env, buffer);
+    int i;
+
+    if (!conn || !events || (jlong) count * (jlong) sizeof(*events) > (*env)->GetDirectBufferCapacity(env, buffer))
+        return;
+
+    for (i = 0; i < count; i++) {
+        lorieJavaEvent *e = &events[i];
+        xcb_tx11_event_t event = {
+            .kind = e->kind, .time = e->time, .detail = e->detail, .code = e->code, .x = e->x, .y = e->y,
+            .down = !!(e->flags & LORIE_JAVA_EVENT_DOWN), .relative = !!(e->flags & LORIE_JAVA_EVENT_RELATIVE),
+        };
+
+        // Android key code is sent in detail if there is no scan code.
+        if (e->kind == XCB_TX11_EVENT_KIND_KEY) {
+            int code = e->code;
+            if (!code && e->detail >= 0 && e->detail < (int) ARRAY_SIZE(android_to_linux_keycode))
+                code = android_to_linux_keycode[e->detail];
+            if (!code)
+                continue;
+            event.detail = 0;
+            event.code = code + 8;
+        }
+
+        queueEvent(event);
     }
 
-    return true;
+    flushEvents();
 }
 
+// Text is split at character boundaries only, length of one request is 16 bit.
+#define LORIE_TEXT_CHUNK 16384
+
 JNIEXPORT void JNICALL
-Java_com_termux_x11_MainActivity_sendUnicodeEvent(unused JNIEnv* env, unused jobject cls, jint unicode) {
-    if (conn) {
-//        __android_log_print(ANDROID_LOG_ERROR, "Xlorie-client","Sending unicode event: %d", unicode);
-        xcb_tx11_unicode_event(conn, unicode);
-        xcb_flush(conn);
+Java_com_termux_x11_MainActivity_sendText(JNIEnv* env, unused jobject cls, jbyteArray text) {
+    jsize length = (*env)->GetArrayLength(env, text), offset, size;
+    CARD32 time = GetTimeInMillis();
+    jbyte *bytes;
+
+    if (!conn || !length || !(bytes = (*env)->GetByteArrayElements(env, text, NULL)))
+        return;
+
+    flushEvents();
+    for (offset = 0; offset < length; offset += size) {
+        size = length - offset < LORIE_TEXT_CHUNK ? length - offset : LORIE_TEXT_CHUNK;
+        while (size > 1 && offset + size < length && (bytes[offset + size] & 0xC0) == 0x80)
+            size--;
+        xcb_tx11_text_input(conn, size, time, (const char*) bytes + offset);
     }
+    xcb_flush(conn);
+    (*env)->ReleaseByteArrayElements(env, text, bytes, JNI_ABORT);
 }
 
 static JavaVM *vm;
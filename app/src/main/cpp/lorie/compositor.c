@@ -0,0 +1,317 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <android/log.h>
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "pixmapstr.h"
+#include "privates.h"
+#include "damage.h"
+#include "extinit.h"
+#include "compint.h"
+#include "renderer.h"
+#include "lorie.h"
+
+/*
+ * Built-in compositing manager. Children of the root window are redirected manually, so X server
+ * does not paint them to the screen pixmap at all. Every frame window pixmaps are uploaded to textures
+ * (only areas damaged since the previous frame) and renderer draws them over the root buffer with
+ * alpha and shadows. Moving, restacking and mapping windows does not repaint anything on CPU.
+ * Only one client can redirect root's children manually, so external compositing managers will not start.
+ *
+ * In rootless mode windows are given to Android as separate surface layers (see layers.c) instead.
+ */
+
+#define log(...) __android_log_print(ANDROID_LOG_DEBUG, "LorieCompositor", __VA_ARGS__)
+
+// Presentation of windows, renderer's textures or Android layers.
+typedef struct {
+    void *(*create)(void);
+    void (*destroy)(void *window);
+    // Damage is in pixmap coordinates, NULL means the whole pixmap.
+    void (*upload)(void *window, PixmapPtr pPixmap, RegionPtr damage);
+    void (*place)(void *window, int x, int y, Bool argb, Bool shadow);
+    // Windows are listed from bottom to top.
+    void (*stack)(void **windows, int count);
+    void (*commit)(void);
+    // Windows are drawn to outputs by renderer, changed area must be redrawn.
+    Bool redraw;
+} lorieCompBackendRec, *lorieCompBackendPtr;
+
+typedef struct {
+    void *window;
+    DamagePtr pDamage;
+    PixmapPtr pPixmap; // Pixmap which was uploaded last time, new pixmap is uploaded as a whole
+} lorieCompWindowRec, *lorieCompWindowPtr;
+
+typedef struct {
+    void *window;
+    int x, y, width, height;
+} lorieCompPlacement;
+
+static void *lorieCompRendererCreate(void) {
+    return renderer_window_create();
+}
+
+static void lorieCompRendererDestroy(void *window) {
+    renderer_window_destroy(window);
+}
+
+static void lorieCompRendererUpload(void *window, PixmapPtr pPixmap, RegionPtr damage) {
+    renderer_window_upload(window, pPixmap->drawable.width, pPixmap->drawable.height, pPixmap->devKind,
+                           pPixmap->devPrivate.ptr, damage ? RegionRects(damage) : NULL, damage ? RegionNumRects(damage) : 0);
+}
+
+static void lorieCompRendererPlace(void *window, int x, int y, Bool argb, Bool shadow) {
+    renderer_window_place(window, x, y, argb, shadow);
+}
+
+static void lorieCompRendererStack(void **windows, int count) {
+    renderer_set_windows((renderer_window_ptr*) windows, count);
+}
+
+static lorieCompBackendRec lorieCompRenderer = {
+    .create = lorieCompRendererCreate,
+    .destroy = lorieCompRendererDestroy,
+    .upload = lorieCompRendererUpload,
+    .place = lorieCompRendererPlace,
+    .stack = lorieCompRendererStack,
+    .redraw = TRUE,
+};
+
+static void *lorieCompLayerCreate(void) {
+    return lorieLayerCreate();
+}
+
+static void lorieCompLayerDestroy(void *window) {
+    lorieLayerDestroy(window);
+}
+
+static void lorieCompLayerUpload(void *window, PixmapPtr pPixmap, RegionPtr damage) {
+    lorieLayerUpdate(window, pPixmap, damage);
+}
+
+// Shadows are drawn by Android only for its own windows.
+static void lorieCompLayerPlace(void *window, int x, int y, Bool argb, unused Bool shadow) {
+    lorieLayerPlace(window, x, y, argb);
+}
+
+static void lorieCompLayerStack(void **windows, int count) {
+    lorieLayersStack((lorieLayerPtr*) windows, count);
+}
+
+static lorieCompBackendRec lorieCompLayers = {
+    .create = lorieCompLayerCreate,
+    .destroy = lorieCompLayerDestroy,
+    .upload = lorieCompLayerUpload,
+    .place = lorieCompLayerPlace,
+    .stack = lorieCompLayerStack,
+    .commit = lorieLayersCommit,
+    .redraw = FALSE,
+};
+
+static DevPrivateKeyRec lorieCompWindowKey;
+static DestroyWindowProcPtr destroyWindow;
+static lorieCompBackendPtr backend;
+static Bool enabled;
+
+// Stack and placement of windows shown by the last frame, redraw is needed only if they change.
+static struct {
+    void **windows;
+    lorieCompPlacement *placement, *prevPlacement;
+    int prevCount, size;
+} stack;
+
+#define lorieCompWindowPriv(w) ((lorieCompWindowPtr) dixLookupPrivate(&(w)->devPrivates, &lorieCompWindowKey))
+
+static void lorieCompDamageDestroy(unused DamagePtr pDamage, void *closure) {
+    // Damage of the window can be destroyed by damage layer before our DestroyWindow is called.
+    lorieCompWindowPriv((WindowPtr) closure)->pDamage = NULL;
+}
+
+static void lorieCompWindowRelease(lorieCompWindowPtr priv) {
+    if (priv->pDamage) {
+        DamageUnregister(priv->pDamage);
+        DamageDestroy(priv->pDamage);
+    }
+    if (priv->window)
+        backend->destroy(priv->window);
+    *priv = (lorieCompWindowRec) {0};
+}
+
+static Bool lorieCompDestroyWindow(WindowPtr pWin) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    Bool ret;
+
+    lorieCompWindowRelease(lorieCompWindowPriv(pWin));
+
+    pScreen->DestroyWindow = destroyWindow;
+    ret = pScreen->DestroyWindow(pWin);
+    pScreen->DestroyWindow = lorieCompDestroyWindow;
+    return ret;
+}
+
+static Bool lorieCompWindowSetup(WindowPtr pWin, lorieCompWindowPtr priv) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+
+    priv->window = backend->create();
+    priv->pDamage = DamageCreate(NULL, lorieCompDamageDestroy, DamageReportNone, TRUE, pScreen, pWin);
+    if (!priv->window || !priv->pDamage) {
+        lorieCompWindowRelease(priv);
+        return FALSE;
+    }
+
+    DamageRegister(&pWin->drawable, priv->pDamage);
+    return TRUE;
+}
+
+static Bool lorieCompStackReserve(int count) {
+    void **windows;
+    lorieCompPlacement *placement, *prevPlacement;
+
+    if (count <= stack.size)
+        return TRUE;
+
+    // Arrays which were reallocated are kept even if others failed, only the size is not updated.
+    count = max(count, stack.size * 2);
+    if ((windows = xreallocarray(stack.windows, count, sizeof(*windows))))
+        stack.windows = windows;
+    if ((placement = xreallocarray(stack.placement, count, sizeof(*placement))))
+        stack.placement = placement;
+    if ((prevPlacement = xreallocarray(stack.prevPlacement, count, sizeof(*prevPlacement))))
+        stack.prevPlacement = prevPlacement;
+    if (!windows || !placement || !prevPlacement)
+        return FALSE;
+
+    stack.size = count;
+    return TRUE;
+}
+
+// Uploads damaged part of the window pixmap and redraws outputs showing it.
+static void lorieCompUpload(WindowPtr pWin, lorieCompWindowPtr priv, PixmapPtr pPixmap) {
+    RegionPtr damage = priv->pDamage ? DamageRegion(priv->pDamage) : NULL;
+    BoxRec box;
+
+    // Window got a new pixmap (i.e. it was resized or mapped again), it is uploaded as a whole.
+    if (priv->pPixmap != pPixmap || !damage) {
+        backend->upload(priv->window, pPixmap, NULL);
+        priv->pPixmap = pPixmap;
+        if (damage)
+            DamageEmpty(priv->pDamage);
+        return;
+    }
+
+    // Damage is relative to the window origin, pixmap also contains the border.
+    // Empty damage is passed too, texture or layer could be lost while Android surface was gone.
+    RegionTranslate(damage, pWin->drawable.x - pPixmap->screen_x, pWin->drawable.y - pPixmap->screen_y);
+    backend->upload(priv->window, pPixmap, damage);
+    if (RegionNotEmpty(damage)) {
+        box = *RegionExtents(damage);
+        box.x1 += pPixmap->screen_x;
+        box.x2 += pPixmap->screen_x;
+        box.y1 += pPixmap->screen_y;
+        box.y2 += pPixmap->screen_y;
+        if (backend->redraw)
+            lorieRedraw(&box);
+        DamageEmpty(priv->pDamage);
+    }
+}
+
+void lorieCompositorUpdate(ScreenPtr pScreen) {
+    WindowPtr pWin;
+    lorieCompPlacement *tmp;
+    int count = 0;
+
+    if (!enabled || !pScreen->root)
+        return;
+
+    // Children are listed from top to bottom, renderer draws from bottom to top.
+    for (pWin = pScreen->root->lastChild; pWin; pWin = pWin->prevSib) {
+        lorieCompWindowPtr priv = lorieCompWindowPriv(pWin);
+        PixmapPtr pPixmap;
+        Bool argb;
+
+        if (!pWin->viewable || !pWin->redirectDraw)
+            continue;
+
+        pPixmap = pScreen->GetWindowPixmap(pWin);
+        if (!pPixmap || pPixmap->drawable.bitsPerPixel != 32 || !pPixmap->devPrivate.ptr)
+            continue;
+
+        if (!priv->window && !lorieCompWindowSetup(pWin, priv))
+            continue;
+
+        if (!lorieCompStackReserve(count + 1))
+            break;
+
+        lorieCompUpload(pWin, priv, pPixmap);
+
+        argb = pWin->drawable.depth == 32;
+        backend->place(priv->window, pPixmap->screen_x, pPixmap->screen_y, argb, !argb && !pWin->overrideRedirect);
+        stack.windows[count] = priv->window;
+        stack.placement[count++] = (lorieCompPlacement) {
+            .window = priv->window, .x = pPixmap->screen_x, .y = pPixmap->screen_y,
+            .width = pPixmap->drawable.width, .height = pPixmap->drawable.height,
+        };
+    }
+
+    // Moving, restacking, mapping or unmapping a window exposes whatever was under it.
+    backend->stack(stack.windows, count);
+    if (backend->commit)
+        backend->commit();
+    if (backend->redraw && (count != stack.prevCount
+                            || memcmp(stack.placement, stack.prevPlacement, count * sizeof(*stack.placement)))) {
+        BoxRec box = { 0, 0, pScreen->width, pScreen->height };
+        lorieRedraw(&box);
+    }
+
+    tmp = stack.prevPlacement;
+    stack.prevPlacement = stack.placement;
+    stack.placement = tmp;
+    stack.prevCount = count;
+}
+
+void *lorieCompositorRendererWindow(WindowPtr pWin) {
+    if (!enabled || backend != &lorieCompRenderer)
+        return NULL;
+
+    while (pWin->parent && pWin->parent->parent)
+        pWin = pWin->parent;
+    if (!pWin->parent || !pWin->redirectDraw)
+        return NULL;
+
+    // Window gets its texture with the first frame it is shown in.
+    return lorieCompWindowPriv(pWin)->window;
+}
+
+static Bool lorieCompositorStart(unused ClientPtr pClient, void *closure) {
+    ScreenPtr pScreen = closure;
+
+    if (noCompositeExtension || compRedirectSubwindows(serverClient, pScreen->root, CompositeRedirectManual) != Success) {
+        log("Failed to redirect windows, compositing is disabled");
+        return TRUE;
+    }
+
+    enabled = TRUE;
+    return TRUE;
+}
+
+Bool lorieCompositorInit(ScreenPtr pScreen, Bool rootless) {
+    if (!dixRegisterPrivateKey(&lorieCompWindowKey, PRIVATE_WINDOW, sizeof(lorieCompWindowRec)))
+        return FALSE;
+
+    enabled = FALSE;
+    stack.prevCount = 0;
+    backend = rootless ? &lorieCompLayers : &lorieCompRenderer;
+    backend->stack(NULL, 0);
+
+    destroyWindow = pScreen->DestroyWindow;
+    pScreen->DestroyWindow = lorieCompDestroyWindow;
+
+    // Root window does not exist yet.
+    QueueWorkProc(lorieCompositorStart, NULL, pScreen);
+    return TRUE;
+}
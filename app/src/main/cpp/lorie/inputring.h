@@ -0,0 +1,19 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdint.h>
+#include "tx11.h"
+
+/*
+ * Input events are passed from activity to X server through single-producer/single-consumer ring in shared memory.
+ * Activity writes events and advances head, X server reads them on its input thread and advances tail.
+ * Activity signals the eventfd sent with the ring once per input frame. Events are the same as in EventBatch request.
+ */
+#define LORIE_INPUT_RING_SIZE 1024 // Must be a power of two
+
+typedef struct {
+    _Atomic uint32_t head;
+    uint8_t pad0[60]; // Indices are written by different processes, they should not share cache line
+    _Atomic uint32_t tail;
+    uint8_t pad1[60];
+    xcb_tx11_event_t events[LORIE_INPUT_RING_SIZE];
+} lorieInputRing;
@@ -0,0 +1,114 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <stdatomic.h>
+#include <string.h>
+#include "dix.h"
+#include "inputstr.h"
+#include "eventstr.h"
+#include "lorie.h"
+
+/*
+ * Input latency histograms. Events keep Android timestamps (CLOCK_MONOTONIC milliseconds, the same
+ * clock X server uses, so no offset is needed) and every stage records how much time passed since
+ * Android got the event. Stages are recorded on input thread and on main thread, counters are atomic.
+ */
+
+extern DeviceIntPtr lorieMouse, lorieMouseRelative, lorieKeyboard;
+
+static _Atomic CARD32 histograms[LORIE_LATENCY_STAGES][LORIE_LATENCY_BUCKETS];
+
+// Time of the oldest event which was delivered but is not yet on screen, 0 if there is none.
+static struct {
+    CARD32 eventTime, deliveredAt;
+} pending;
+
+// Touch events do not go through DeviceEventCallback, they are recorded when main thread processed the queue.
+// Protected by input lock.
+static struct {
+    CARD32 times[64];
+    int count;
+} touches;
+
+// Bucket 0 is below 1 ms, bucket i is [2^(i-1), 2^i) ms, the last one holds everything above.
+static int lorieLatencyBucket(CARD32 ms) {
+    int bucket = 0;
+    while (ms && bucket < LORIE_LATENCY_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void lorieLatencyRecord(int stage, CARD32 eventTime) {
+    // Monotonic clock of Android and X server is the same, but GetTimeInMillis may use the coarse one.
+    INT32 delay = (INT32) ((CARD32) (GetTimeInMicros() / 1000) - eventTime);
+
+    if (!eventTime)
+        return;
+
+    atomic_fetch_add_explicit(&histograms[stage][lorieLatencyBucket(max(delay, 0))], 1, memory_order_relaxed);
+}
+
+void lorieLatencyPresented(void) {
+    CARD32 now = GetTimeInMillis();
+
+    // Events which did not damage anything (i.e. modifiers) must not be counted by some unrelated frame later.
+    if (pending.eventTime && now - pending.deliveredAt < 1000)
+        lorieLatencyRecord(LORIE_LATENCY_PRESENTED, pending.eventTime);
+    pending.eventTime = 0;
+}
+
+void lorieLatencyQuery(CARD32 *counts, Bool reset) {
+    int stage, bucket;
+
+    for (stage = 0; stage < LORIE_LATENCY_STAGES; stage++)
+        for (bucket = 0; bucket < LORIE_LATENCY_BUCKETS; bucket++)
+            counts[stage * LORIE_LATENCY_BUCKETS + bucket] = reset
+                    ? atomic_exchange_explicit(&histograms[stage][bucket], 0, memory_order_relaxed)
+                    : atomic_load_explicit(&histograms[stage][bucket], memory_order_relaxed);
+}
+
+static void lorieLatencyDelivered(CARD32 eventTime) {
+    lorieLatencyRecord(LORIE_LATENCY_DELIVERED, eventTime);
+    if (!pending.eventTime) {
+        pending.eventTime = eventTime;
+        pending.deliveredAt = GetTimeInMillis();
+    }
+}
+
+// Called on main thread when dix processes the event and delivers it to clients. Touches are not reported here.
+static void lorieLatencyDeviceEvent(unused CallbackListPtr *list, unused void *closure, void *data) {
+    DeviceEventInfoRec *info = data;
+
+    if (info->device == lorieMouse || info->device == lorieMouseRelative || info->device == lorieKeyboard)
+        lorieLatencyDelivered(info->event->any.time);
+}
+
+void lorieLatencyTouchQueued(CARD32 eventTime) {
+    if (eventTime && touches.count < (int) ARRAY_SIZE(touches.times))
+        touches.times[touches.count++] = eventTime;
+}
+
+void lorieLatencyTouchesDelivered(void) {
+    CARD32 times[ARRAY_SIZE(touches.times)];
+    int count, i;
+
+    // Queue is processed until it is empty, so touches queued while it was processed are delivered too.
+    input_lock();
+    count = touches.count;
+    memcpy(times, touches.times, count * sizeof(*times));
+    touches.count = 0;
+    input_unlock();
+
+    for (i = 0; i < count; i++)
+        lorieLatencyDelivered(times[i]);
+}
+
+void lorieLatencyInit(void) {
+    memset(histograms, 0, sizeof(histograms));
+    pending.eventTime = 0;
+    touches.count = 0;
+    AddCallback(&DeviceEventCallback, lorieLatencyDeviceEvent, NULL);
+}
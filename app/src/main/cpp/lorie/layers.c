@@ -0,0 +1,505 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <android/log.h>
+#include "scrnintstr.h"
+#include "pixmapstr.h"
+#include "regionstr.h"
+#include "list.h"
+#include "lorie.h"
+#include "layers.h"
+
+/*
+ * Rootless presentation. Every top-level window is a child layer of the activity's surface with
+ * its own three buffers, Android's compositor stacks and blends them. Only damaged parts of
+ * damaged windows are copied and posted, moving and restacking windows is a transaction without
+ * buffers. Cursor is a layer on top of them.
+ *
+ * Compositor reads a posted buffer until the next one is latched, so a buffer is written again only
+ * after OnComplete of the transaction which replaced it reported it released, and after its release
+ * fence signals. If every buffer of a layer is still held, damage waits for the next frame.
+ */
+
+#define log(...) __android_log_print(ANDROID_LOG_DEBUG, "LorieLayers", __VA_ARGS__)
+
+#define LAYER_BUFFERS 3
+
+// Buffer is posted while it is on screen and until compositor reports its release with the next transaction.
+typedef struct {
+    AHardwareBuffer *buf;
+    RegionRec stale; // Damage which was written to other buffers only, it must be copied before posting this one
+    int fence; // Release fence which must signal before buffer is written again
+    Bool posted;
+} lorieLayerBufferRec;
+
+struct lorieLayer {
+    struct xorg_list entry;
+    ASurfaceControl *sc; // NULL until parent surface exists
+    lorieLayerBufferRec buffers[LAYER_BUFFERS];
+    int front, width, height;
+    unsigned serial; // Changes with buffers, releases of previous buffers are ignored
+    RegionRec pending; // Damage which was not posted yet because no buffer was released
+    Bool posted; // Front buffer was set to the current surface control
+    Bool configured; // Geometry, order and visibility were set to the current surface control
+    ARect dst;
+    int z;
+    Bool visible, argb, stacked;
+};
+
+// Buffers replaced by one transaction, they are released when it completes.
+typedef struct {
+    int count, size;
+    struct {
+        ASurfaceControl *sc;
+        unsigned serial;
+        int buffer, fence;
+    } buffers[];
+} lorieLayersReleaseRec, *lorieLayersReleasePtr;
+
+static struct {
+    Bool available;
+    ANativeWindow *parent;
+    ASurfaceTransaction *t;
+    lorieLayersReleasePtr replaced; // Buffers replaced by current transaction
+    struct xorg_list layers;
+    lorieLayerPtr cursor;
+    int cursorX, cursorY, xhot, yhot;
+    unsigned serial;
+
+    // Completed transactions are handed from binder thread to main thread.
+    pthread_mutex_t lock;
+    lorieLayersReleasePtr *completed;
+    int completedCount, completedSize;
+} layers = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static lorieSurfaceApi surface;
+
+Bool lorieLayersLoad(const lorieSurfaceApi *api) {
+    surface = *api;
+    xorg_list_init(&layers.layers);
+    layers.available = TRUE;
+    return TRUE;
+}
+
+Bool lorieLayersInit(void) {
+    lorieSurfaceApi api;
+    void *lib;
+
+    if (layers.available)
+        return TRUE;
+
+    if (!(lib = dlopen("libandroid.so", RTLD_NOW)))
+        return FALSE;
+#define loadFuncPointer(ret, name, args) if (!(api.name = dlsym(lib, #name))) return FALSE;
+    surfaceFunctions(loadFuncPointer)
+#undef loadFuncPointer
+
+    return lorieLayersLoad(&api);
+}
+
+static ASurfaceTransaction *lorieLayersTransaction(void) {
+    if (!layers.t)
+        layers.t = surface.ASurfaceTransaction_create();
+    return layers.t;
+}
+
+// Called on binder thread, only fences are taken here. Layers are updated by main thread.
+static void lorieLayersComplete(void *context, ASurfaceTransactionStats *stats) {
+    lorieLayersReleasePtr release = context;
+    ASurfaceControl **controls = NULL;
+    size_t count = 0, i;
+    int j;
+
+    surface.ASurfaceTransactionStats_getASurfaceControls(stats, &controls, &count);
+    for (j = 0; j < release->count; j++) {
+        // Asking for a surface which is not in stats aborts, detached layers are released without fence.
+        release->buffers[j].fence = -1;
+        for (i = 0; i < count; i++)
+            if (controls[i] == release->buffers[j].sc)
+                release->buffers[j].fence = surface.ASurfaceTransactionStats_getPreviousReleaseFenceFd(stats, controls[i]);
+    }
+    if (controls)
+        surface.ASurfaceTransactionStats_releaseASurfaceControls(controls);
+
+    pthread_mutex_lock(&layers.lock);
+    if (layers.completedCount == layers.completedSize) {
+        int size = max(layers.completedSize * 2, 16);
+        lorieLayersReleasePtr *completed = realloc(layers.completed, size * sizeof(*completed));
+        if (completed) {
+            layers.completed = completed;
+            layers.completedSize = size;
+        }
+    }
+    // Buffers stay held if there is no memory, they are reallocated with the next resize.
+    if (layers.completedCount < layers.completedSize)
+        layers.completed[layers.completedCount++] = release;
+    else {
+        for (j = 0; j < release->count; j++)
+            if (release->buffers[j].fence >= 0)
+                close(release->buffers[j].fence);
+        free(release);
+    }
+    pthread_mutex_unlock(&layers.lock);
+}
+
+static void lorieLayersReap(void) {
+    lorieLayersReleasePtr *completed;
+    lorieLayerPtr layer;
+    int count, i, j;
+
+    pthread_mutex_lock(&layers.lock);
+    completed = layers.completed;
+    count = layers.completedCount;
+    layers.completed = NULL;
+    layers.completedCount = layers.completedSize = 0;
+    pthread_mutex_unlock(&layers.lock);
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < completed[i]->count; j++) {
+            int fence = completed[i]->buffers[j].fence;
+            xorg_list_for_each_entry(layer, &layers.layers, entry) {
+                if (layer->serial == completed[i]->buffers[j].serial) {
+                    lorieLayerBufferRec *buffer = &layer->buffers[completed[i]->buffers[j].buffer];
+                    if (buffer->fence >= 0)
+                        close(buffer->fence);
+                    buffer->fence = fence;
+                    buffer->posted = FALSE;
+                    fence = -1;
+                    break;
+                }
+            }
+            if (fence >= 0)
+                close(fence);
+        }
+        free(completed[i]);
+    }
+    free(completed);
+}
+
+// Previous front buffer of the layer is released when transaction which replaced it completes.
+static void lorieLayersReplaced(lorieLayerPtr layer, int buffer) {
+    lorieLayersReleasePtr replaced = layers.replaced;
+
+    if (!replaced || replaced->count == replaced->size) {
+        int size = replaced ? replaced->size * 2 : 8;
+        if (!(replaced = realloc(replaced, sizeof(*replaced) + size * sizeof(replaced->buffers[0]))))
+            return; // Buffer stays held until the layer gets new buffers
+        if (!layers.replaced)
+            replaced->count = 0;
+        replaced->size = size;
+        layers.replaced = replaced;
+    }
+
+    replaced->buffers[replaced->count++] = (typeof(replaced->buffers[0])) { layer->sc, layer->serial, buffer, -1 };
+}
+
+void lorieLayersCommit(void) {
+    if (!layers.t)
+        return;
+
+    if (layers.replaced)
+        surface.ASurfaceTransaction_setOnComplete(layers.t, layers.replaced, lorieLayersComplete);
+    layers.replaced = NULL;
+    surface.ASurfaceTransaction_apply(layers.t);
+    surface.ASurfaceTransaction_delete(layers.t);
+    layers.t = NULL;
+}
+
+static void lorieLayerDetach(lorieLayerPtr layer) {
+    int i;
+
+    if (!layer->sc)
+        return;
+
+    surface.ASurfaceTransaction_reparent(lorieLayersTransaction(), layer->sc, NULL);
+    surface.ASurfaceControl_release(layer->sc);
+    layer->sc = NULL;
+
+    // Detached surface is not shown anymore, only the front buffer is kept posted to be reused by the next surface.
+    for (i = 0; i < LAYER_BUFFERS; i++)
+        layer->buffers[i].posted = i == layer->front && layer->posted;
+}
+
+static Bool lorieLayerAttach(lorieLayerPtr layer) {
+    if (layer->sc)
+        return TRUE;
+
+    if (!layers.parent || !(layer->sc = surface.ASurfaceControl_createFromWindow(layers.parent, "X11 window")))
+        return FALSE;
+
+    layer->posted = layer->configured = FALSE;
+    return TRUE;
+}
+
+// Layers are children of the previous surface which is gone, they are created again by the next update.
+void lorieLayersSetParent(struct ANativeWindow *win) {
+    lorieLayerPtr layer;
+
+    if (!layers.available || layers.parent == win)
+        return;
+
+    xorg_list_for_each_entry(layer, &layers.layers, entry)
+        lorieLayerDetach(layer);
+    lorieLayersCommit();
+    layers.parent = win;
+}
+
+lorieLayerPtr lorieLayerCreate(void) {
+    lorieLayerPtr layer = calloc(1, sizeof(*layer));
+    int i;
+
+    if (!layer)
+        return NULL;
+
+    for (i = 0; i < LAYER_BUFFERS; i++) {
+        RegionNull(&layer->buffers[i].stale);
+        layer->buffers[i].fence = -1;
+    }
+    RegionNull(&layer->pending);
+    layer->z = -1;
+    xorg_list_add(&layer->entry, &layers.layers);
+    return layer;
+}
+
+// Compositor keeps its own references of posted buffers, ours can be dropped any time.
+static void lorieLayerReleaseBuffers(lorieLayerPtr layer) {
+    int i;
+    for (i = 0; i < LAYER_BUFFERS; i++) {
+        lorieLayerBufferRec *buffer = &layer->buffers[i];
+        if (buffer->buf)
+            AHardwareBuffer_release(buffer->buf);
+        if (buffer->fence >= 0)
+            close(buffer->fence);
+        buffer->buf = NULL;
+        buffer->fence = -1;
+        buffer->posted = FALSE;
+        RegionEmpty(&buffer->stale);
+    }
+    layer->width = layer->height = 0;
+    layer->serial = 0;
+}
+
+void lorieLayerDestroy(lorieLayerPtr layer) {
+    int i;
+
+    if (!layer)
+        return;
+
+    // Window disappears immediately, not with the next frame.
+    lorieLayerDetach(layer);
+    lorieLayersCommit();
+    xorg_list_del(&layer->entry);
+    lorieLayerReleaseBuffers(layer);
+    for (i = 0; i < LAYER_BUFFERS; i++)
+        RegionUninit(&layer->buffers[i].stale);
+    RegionUninit(&layer->pending);
+    free(layer);
+}
+
+static Bool lorieLayerAllocate(lorieLayerPtr layer, int width, int height) {
+    AHardwareBuffer_Desc desc = {
+        .width = width,
+        .height = height,
+        .layers = 1,
+        .format = 5, // Corresponds to HAL_PIXEL_FORMAT_BGRA_8888
+        .usage = AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN | AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE
+                 | AHARDWAREBUFFER_USAGE_COMPOSER_OVERLAY,
+    };
+
+    BoxRec box = { 0, 0, width, height };
+    int i;
+
+    lorieLayerReleaseBuffers(layer);
+    for (i = 0; i < LAYER_BUFFERS; i++) {
+        if (AHardwareBuffer_allocate(&desc, &layer->buffers[i].buf) != 0) {
+            lorieLayerReleaseBuffers(layer);
+            return FALSE;
+        }
+        RegionReset(&layer->buffers[i].stale, &box);
+    }
+
+    layer->width = width;
+    layer->height = height;
+    layer->serial = ++layers.serial ?: ++layers.serial;
+    layer->posted = FALSE;
+    RegionReset(&layer->pending, &box);
+    return TRUE;
+}
+
+// Lock waits for the release fence and takes it.
+static void lorieLayerCopy(lorieLayerBufferRec *buffer, const void *data, int stride) {
+    int i, y, n = RegionNumRects(&buffer->stale), fence = buffer->fence;
+    BoxPtr boxes = RegionRects(&buffer->stale);
+    AHardwareBuffer *buf = buffer->buf;
+    AHardwareBuffer_Desc desc;
+    void *dst;
+
+    buffer->fence = -1;
+    AHardwareBuffer_describe(buf, &desc);
+    if (AHardwareBuffer_lock(buf, AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN, fence, NULL, &dst) != 0)
+        return;
+
+    for (i = 0; i < n; i++)
+        for (y = boxes[i].y1; y < boxes[i].y2; y++)
+            memcpy((char*) dst + ((size_t) y * desc.stride + boxes[i].x1) * 4,
+                   (const char*) data + (size_t) y * stride + boxes[i].x1 * 4, (boxes[i].x2 - boxes[i].x1) * 4);
+
+    AHardwareBuffer_unlock(buf, NULL);
+    RegionEmpty(&buffer->stale);
+}
+
+/*
+ * Damage is added to every buffer, buffer which is posted copies all damage it missed while other buffers were posted.
+ * If surface control was recreated and nothing changed, buffer which was posted last time is posted again.
+ */
+static void lorieLayerPost(lorieLayerPtr layer, const void *data, int width, int height, int stride, RegionPtr damage) {
+    BoxRec full = { 0, 0, width, height };
+    RegionRec whole;
+    ARect *rects;
+    int i, n, back;
+
+    if (!lorieLayerAttach(layer))
+        return;
+
+    if ((width != layer->width || height != layer->height) && !lorieLayerAllocate(layer, width, height))
+        return;
+
+    RegionInit(&whole, &full, 1);
+    if (!damage)
+        damage = &whole;
+    else
+        RegionIntersect(damage, damage, &whole);
+    RegionUnion(&layer->pending, &layer->pending, damage);
+    for (i = 0; i < LAYER_BUFFERS; i++)
+        RegionUnion(&layer->buffers[i].stale, &layer->buffers[i].stale, damage);
+    RegionUninit(&whole);
+
+    if (!RegionNotEmpty(&layer->pending)) {
+        if (!layer->posted)
+            surface.ASurfaceTransaction_setBuffer(lorieLayersTransaction(), layer->sc, layer->buffers[layer->front].buf, -1);
+        layer->buffers[layer->front].posted = layer->posted = TRUE;
+        return;
+    }
+
+    lorieLayersReap();
+    for (back = 0; back < LAYER_BUFFERS; back++)
+        if (back != layer->front && !layer->buffers[back].posted)
+            break;
+    if (back == LAYER_BUFFERS)
+        return; // Compositor still holds all other buffers, damage is posted with one of the next frames
+
+    lorieLayerCopy(&layer->buffers[back], data, stride);
+
+    n = RegionNumRects(&layer->pending);
+    if ((rects = xallocarray(n, sizeof(ARect)))) {
+        for (i = 0; i < n; i++)
+            rects[i] = (ARect) { RegionRects(&layer->pending)[i].x1, RegionRects(&layer->pending)[i].y1,
+                                 RegionRects(&layer->pending)[i].x2, RegionRects(&layer->pending)[i].y2 };
+        surface.ASurfaceTransaction_setDamageRegion(lorieLayersTransaction(), layer->sc, rects, n);
+        free(rects);
+    }
+    surface.ASurfaceTransaction_setBuffer(lorieLayersTransaction(), layer->sc, layer->buffers[back].buf, -1);
+    if (layer->posted)
+        lorieLayersReplaced(layer, layer->front);
+    else
+        layer->buffers[layer->front].posted = FALSE;
+
+    layer->front = back;
+    layer->buffers[back].posted = layer->posted = TRUE;
+    RegionEmpty(&layer->pending);
+}
+
+void lorieLayerUpdate(lorieLayerPtr layer, PixmapPtr pPixmap, RegionPtr damage) {
+    lorieLayerPost(layer, pPixmap->devPrivate.ptr, pPixmap->drawable.width, pPixmap->drawable.height,
+                   pPixmap->devKind, damage);
+}
+
+void lorieLayerPlace(lorieLayerPtr layer, int x, int y, Bool argb) {
+    ScreenPtr pScreen = screenInfo.screens[0];
+    float sx, sy;
+    ARect src, dst;
+
+    if (!layer->sc || !layers.parent)
+        return;
+
+    // Screen is stretched to the surface, layers are scaled the same way.
+    sx = (float) ANativeWindow_getWidth(layers.parent) / (float) pScreen->width;
+    sy = (float) ANativeWindow_getHeight(layers.parent) / (float) pScreen->height;
+    src = (ARect) { 0, 0, layer->width, layer->height };
+    dst = (ARect) { x * sx, y * sy, (x + layer->width) * sx, (y + layer->height) * sy };
+
+    if (!layer->configured || memcmp(&dst, &layer->dst, sizeof(dst)) != 0) {
+        surface.ASurfaceTransaction_setGeometry(lorieLayersTransaction(), layer->sc, &src, &dst, 0);
+        layer->dst = dst;
+    }
+
+    if (!layer->configured || argb != layer->argb) {
+        surface.ASurfaceTransaction_setBufferTransparency(lorieLayersTransaction(), layer->sc,
+                                                   argb ? TRANSPARENCY_TRANSLUCENT : TRANSPARENCY_OPAQUE);
+        layer->argb = argb;
+    }
+
+    if (!layer->configured) {
+        layer->z = -1;
+        layer->visible = FALSE;
+        layer->configured = TRUE;
+    }
+}
+
+static void lorieLayerStack(lorieLayerPtr layer, int z, Bool visible) {
+    if (!layer->sc || !layer->configured)
+        return;
+
+    if (visible && z != layer->z)
+        surface.ASurfaceTransaction_setZOrder(lorieLayersTransaction(), layer->sc, z);
+    if (visible != layer->visible)
+        surface.ASurfaceTransaction_setVisibility(lorieLayersTransaction(), layer->sc, visible ? VISIBILITY_SHOW : VISIBILITY_HIDE);
+    layer->z = visible ? z : layer->z;
+    layer->visible = visible;
+}
+
+// Layers are listed from bottom to top, layers which are not listed are hidden.
+void lorieLayersStack(lorieLayerPtr *list, int count) {
+    lorieLayerPtr layer;
+    int i;
+
+    xorg_list_for_each_entry(layer, &layers.layers, entry)
+        layer->stacked = FALSE;
+    for (i = 0; i < count; i++) {
+        lorieLayerStack(list[i], i + 1, TRUE);
+        list[i]->stacked = TRUE;
+    }
+    xorg_list_for_each_entry(layer, &layers.layers, entry)
+        if (!layer->stacked && layer != layers.cursor)
+            lorieLayerStack(layer, layer->z, FALSE);
+}
+
+void lorieLayersSetCursor(int width, int height, int xhot, int yhot, const CARD32 *data) {
+    if (!layers.available)
+        return;
+
+    if (!layers.cursor && !(layers.cursor = lorieLayerCreate()))
+        return;
+
+    layers.xhot = xhot;
+    layers.yhot = yhot;
+    if (width && height && data) {
+        lorieLayerPost(layers.cursor, data, width, height, width * 4, NULL);
+        lorieLayerPlace(layers.cursor, layers.cursorX - xhot, layers.cursorY - yhot, TRUE);
+    }
+    lorieLayerStack(layers.cursor, INT32_MAX, width && height && data);
+}
+
+void lorieLayersMoveCursor(int x, int y) {
+    layers.cursorX = x;
+    layers.cursorY = y;
+    if (layers.cursor)
+        lorieLayerPlace(layers.cursor, x - layers.xhot, y - layers.yhot, TRUE);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include <android/native_window.h>
+#include <android/hardware_buffer.h>
+
+/*
+ * Surface control API appeared in Android 10 while the app supports Android 8, so layers.c loads it at runtime.
+ * surface_control.h passes rectangles by C++ references, pointers are the same in ABI.
+ * Host tests pass their own table to lorieLayersLoad instead of libandroid.so.
+ */
+typedef struct ASurfaceControl ASurfaceControl;
+typedef struct ASurfaceTransaction ASurfaceTransaction;
+typedef struct ASurfaceTransactionStats ASurfaceTransactionStats;
+typedef void (*ASurfaceTransaction_OnComplete)(void *context, ASurfaceTransactionStats *stats);
+
+#define VISIBILITY_HIDE 0
+#define VISIBILITY_SHOW 1
+#define TRANSPARENCY_TRANSLUCENT 1
+#define TRANSPARENCY_OPAQUE 2
+
+#define surfaceFunctions(m)                                                                                      \
+m(ASurfaceControl*, ASurfaceControl_createFromWindow, (ANativeWindow *parent, const char *name))                 \
+m(void, ASurfaceControl_release, (ASurfaceControl *sc))                                                          \
+m(ASurfaceTransaction*, ASurfaceTransaction_create, (void))                                                      \
+m(void, ASurfaceTransaction_delete, (ASurfaceTransaction *t))                                                    \
+m(void, ASurfaceTransaction_apply, (ASurfaceTransaction *t))                                                     \
+m(void, ASurfaceTransaction_setOnComplete, (ASurfaceTransaction *t, void *context, ASurfaceTransaction_OnComplete func)) \
+m(void, ASurfaceTransaction_reparent, (ASurfaceTransaction *t, ASurfaceControl *sc, ASurfaceControl *parent))    \
+m(void, ASurfaceTransaction_setBuffer, (ASurfaceTransaction *t, ASurfaceControl *sc, AHardwareBuffer *buf, int fence)) \
+m(void, ASurfaceTransaction_setGeometry, (ASurfaceTransaction *t, ASurfaceControl *sc, const ARect *src, const ARect *dst, int32_t transform)) \
+m(void, ASurfaceTransaction_setZOrder, (ASurfaceTransaction *t, ASurfaceControl *sc, int32_t z))                 \
+m(void, ASurfaceTransaction_setVisibility, (ASurfaceTransaction *t, ASurfaceControl *sc, int8_t visibility))     \
+m(void, ASurfaceTransaction_setBufferTransparency, (ASurfaceTransaction *t, ASurfaceControl *sc, int8_t transparency)) \
+m(void, ASurfaceTransaction_setDamageRegion, (ASurfaceTransaction *t, ASurfaceControl *sc, const ARect *rects, uint32_t count)) \
+m(void, ASurfaceTransactionStats_getASurfaceControls, (ASurfaceTransactionStats *stats, ASurfaceControl ***controls, size_t *count)) \
+m(void, ASurfaceTransactionStats_releaseASurfaceControls, (ASurfaceControl **controls))                          \
+m(int, ASurfaceTransactionStats_getPreviousReleaseFenceFd, (ASurfaceTransactionStats *stats, ASurfaceControl *sc))
+
+typedef struct {
+#define declareFuncPointer(ret, name, args) ret (*name) args;
+    surfaceFunctions(declareFuncPointer)
+#undef declareFuncPointer
+} lorieSurfaceApi;
+
+// Makes layers use the given functions, all of them must be set.
+Bool lorieLayersLoad(const lorieSurfaceApi *api);
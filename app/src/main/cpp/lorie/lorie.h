@@ -6,12 +6,88 @@ extern "C" {
 #endif
 
 void tx11_protocol_init(void);
+// Connects activity, its requests are dispatched before requests of other clients.
+void lorieAddControlClient(int fd);
+// Motion is coalesced while more than `depth` events wait in the queue, 0 disables it. Raw motion is kept if `raw`.
+void lorieInputSetCoalescing(int depth, Bool raw);
+// Called by main thread before queued input events are processed.
+void lorieInputProcessed(void);
 
 Bool lorieChangeWindow(ClientPtr pClient, void *closure);
+
+// Surface and size of additional output (external display), size is in pixels.
+typedef struct {
+    int output;
+    struct ANativeWindow* win;
+    int width, height;
+} lorieOutputChangeRec, *lorieOutputChangePtr;
+Bool lorieOutputChanged(ClientPtr pClient, void *closure);
+Bool lorieTrimMemory(ClientPtr pClient, void *closure);
 void lorieConfigureNotify(int width, int height);
+// Redraws outputs showing `box` with the next frame even if screen pixmap was not damaged.
+void lorieRedraw(const BoxRec *box);
 
 void init_module(void);
 
+typedef struct lorieTileDamage *lorieTileDamagePtr;
+lorieTileDamagePtr lorieTileDamageCreate(int width, int height);
+void lorieTileDamageDestroy(lorieTileDamagePtr tiles);
+void lorieTileDamageAddBox(lorieTileDamagePtr tiles, const BoxRec *box);
+void lorieTileDamageAddRegion(lorieTileDamagePtr tiles, RegionPtr region);
+Bool lorieTileDamageNotEmpty(lorieTileDamagePtr tiles);
+void lorieTileDamageEmpty(lorieTileDamagePtr tiles);
+int lorieTileDamageSpans(lorieTileDamagePtr tiles, BoxPtr boxes, int max);
+
+void lorieCopyBoxes(void *dst, int dstStride, const BoxRec *clip, const void *src, int srcStride,
+                    int width, int height, const BoxRec *boxes, int n);
+
+Bool lorieSlabInit(ScreenPtr pScreen);
+void lorieSlabLogStats(void);
+size_t lorieSlabTrim(void);
+
+typedef struct lorieResidency *lorieResidencyPtr;
+Bool lorieResidencyInit(ScreenPtr pScreen, int idleSeconds);
+lorieResidencyPtr lorieResidencyTrack(PixmapPtr pPixmap, void *data, size_t size);
+void lorieResidencyUntrack(lorieResidencyPtr res);
+// Makes pixmap data valid before it is accessed outside of X drawing code (i.e. uploaded to GL).
+void lorieResidencyAccess(PixmapPtr pPixmap);
+void lorieResidencyLogStats(void);
+
+Bool lorieXvInit(ScreenPtr pScreen);
+
+// Stages of input latency, all are measured from the time Android got the event. Same as LatencyStage in tx11.xml.
+enum { LORIE_LATENCY_RECEIVED, LORIE_LATENCY_QUEUED, LORIE_LATENCY_DELIVERED, LORIE_LATENCY_PRESENTED, LORIE_LATENCY_STAGES };
+#define LORIE_LATENCY_BUCKETS 12
+void lorieLatencyInit(void);
+void lorieLatencyRecord(int stage, CARD32 eventTime);
+// Called when a frame with new contents is presented.
+void lorieLatencyPresented(void);
+// Touches skip DeviceEventCallback. Queued ones are kept with input lock held and are delivered after the queue is processed.
+void lorieLatencyTouchQueued(CARD32 eventTime);
+void lorieLatencyTouchesDelivered(void);
+// Counts are stored stage by stage, LORIE_LATENCY_BUCKETS for each.
+void lorieLatencyQuery(CARD32 *counts, Bool reset);
+
+// Threads drawing large operations in parallel, negative means one per CPU core, 1 disables workers.
+Bool lorieParallelInit(ScreenPtr pScreen, int threads);
+
+Bool lorieCompositorInit(ScreenPtr pScreen, Bool rootless);
+void lorieCompositorUpdate(ScreenPtr pScreen);
+// Renderer window of the top-level window containing `pWin`, NULL unless it is composited by renderer.
+void *lorieCompositorRendererWindow(WindowPtr pWin);
+
+typedef struct lorieLayer *lorieLayerPtr;
+Bool lorieLayersInit(void);
+void lorieLayersSetParent(struct ANativeWindow *win);
+lorieLayerPtr lorieLayerCreate(void);
+void lorieLayerDestroy(lorieLayerPtr layer);
+void lorieLayerUpdate(lorieLayerPtr layer, PixmapPtr pPixmap, RegionPtr damage);
+void lorieLayerPlace(lorieLayerPtr layer, int x, int y, Bool argb);
+void lorieLayersStack(lorieLayerPtr *layers, int count);
+void lorieLayersCommit(void);
+void lorieLayersSetCursor(int width, int height, int xhot, int yhot, const CARD32 *data);
+void lorieLayersMoveCursor(int x, int y);
+
 #ifdef __cplusplus
 }
 #endif
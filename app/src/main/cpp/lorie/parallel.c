@@ -0,0 +1,434 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <android/log.h>
+#include "scrnintstr.h"
+#include "gcstruct.h"
+#include "mi.h"
+#include "mipict.h"
+#include "fb.h"
+#include "fbpict.h"
+#include "lorie.h"
+
+/*
+ * fb draws everything on the dispatch thread. Large fills, copies, images and composites which
+ * draw to the screen pixmap are split into bands of rows (or columns, for vertical scrolls) and
+ * the bands are drawn by worker threads together with the dispatch thread, which returns only
+ * when all bands are done. Threads take the next free band until none are left, so bands of
+ * different cost are balanced between fast and slow cores. X structures are only read by workers
+ * while dispatch thread waits for them. Small operations are passed to fb as usual.
+ *
+ * Wrappers are installed right over fb, so damage and everything else see regular fb calls.
+ */
+
+#define PARALLEL_MAX_THREADS 8
+#define PARALLEL_MIN_PIXELS (128 * 1024)
+#define PARALLEL_MIN_BAND 16
+#define PARALLEL_BANDS_PER_THREAD 4
+
+#define log(...) __android_log_print(ANDROID_LOG_DEBUG, "LorieParallel", __VA_ARGS__)
+
+// Draws rows (or columns) from `from` to `to`.
+typedef void (*lorieParallelFunc)(void *data, int from, int to);
+
+typedef struct {
+    lorieParallelFunc func;
+    void *data;
+    int from, band, bands, to;
+    atomic_int next;
+    unsigned generation;
+} lorieParallelJob;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start, finish;
+    lorieParallelJob *job;
+    unsigned generation;
+    int active, threads;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static CreateGCProcPtr createGC;
+static CompositeProcPtr composite;
+static GCOps lorieParallelOps;
+
+static void lorieParallelBands(lorieParallelJob *job) {
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->bands)
+        job->func(job->data, job->from + i * job->band, min(job->from + (i + 1) * job->band, job->to));
+}
+
+static void *lorieParallelWorker(unused void *arg) {
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        lorieParallelJob *job;
+
+        while (!pool.job || pool.job->generation == seen)
+            pthread_cond_wait(&pool.start, &pool.lock);
+
+        job = pool.job;
+        seen = job->generation;
+        pool.active++;
+        pthread_mutex_unlock(&pool.lock);
+
+        lorieParallelBands(job);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.active == 0)
+            pthread_cond_signal(&pool.finish);
+    }
+
+    return NULL;
+}
+
+static void lorieParallelRun(lorieParallelFunc func, void *data, int from, int to) {
+    int bands = min((to - from) / PARALLEL_MIN_BAND, (pool.threads + 1) * PARALLEL_BANDS_PER_THREAD);
+    lorieParallelJob job = { .func = func, .data = data, .from = from, .to = to };
+
+    if (bands < 2) {
+        func(data, from, to);
+        return;
+    }
+
+    job.band = (to - from + bands - 1) / bands;
+    job.bands = (to - from + job.band - 1) / job.band;
+
+    pthread_mutex_lock(&pool.lock);
+    job.generation = ++pool.generation;
+    pool.job = &job;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    lorieParallelBands(&job);
+
+    // Job lives on this stack, workers which took it must leave it before returning.
+    pthread_mutex_lock(&pool.lock);
+    pool.job = NULL;
+    while (pool.active)
+        pthread_cond_wait(&pool.finish, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static PixmapPtr lorieParallelPixmap(DrawablePtr pDrawable) {
+    if (pDrawable->type == DRAWABLE_WINDOW)
+        return pDrawable->pScreen->GetWindowPixmap((WindowPtr) pDrawable);
+    return (PixmapPtr) pDrawable;
+}
+
+static Bool lorieParallelScreenPixmap(DrawablePtr pDrawable) {
+    return lorieParallelPixmap(pDrawable) == pDrawable->pScreen->GetScreenPixmap(pDrawable->pScreen);
+}
+
+typedef struct {
+    DrawablePtr pDrawable;
+    GCPtr pGC;
+    int nrect;
+    xRectangle *rects;
+} lorieParallelFill;
+
+static void lorieParallelFillBand(void *data, int y1, int y2) {
+    lorieParallelFill *fill = data;
+    DrawablePtr pDrawable = fill->pDrawable;
+    FbGCPrivPtr pPriv = fbGetGCPrivate(fill->pGC);
+    RegionPtr clip = fbGetCompositeClip(fill->pGC);
+    BoxPtr boxes = RegionRects(clip);
+    int nbox = RegionNumRects(clip), i, j;
+    FbBits *dst;
+    FbStride dstStride;
+    int dstBpp, dstXoff, dstYoff;
+
+    fbGetDrawable(pDrawable, dst, dstStride, dstBpp, dstXoff, dstYoff);
+    for (i = 0; i < fill->nrect; i++) {
+        int rx1 = fill->rects[i].x + pDrawable->x, rx2 = rx1 + fill->rects[i].width;
+        int ry1 = max(fill->rects[i].y + pDrawable->y, y1), ry2 = min(fill->rects[i].y + pDrawable->y + fill->rects[i].height, y2);
+
+        for (j = 0; j < nbox && ry1 < ry2; j++) {
+            int x1 = max(rx1, boxes[j].x1), x2 = min(rx2, boxes[j].x2);
+            int by1 = max(ry1, boxes[j].y1), by2 = min(ry2, boxes[j].y2);
+            // Same as fbFill, pixman fast path for GXcopy with all planes.
+            if (x1 < x2 && by1 < by2 && (pPriv->and || !pixman_fill((uint32_t*) dst, dstStride, dstBpp,
+                                                                    x1 + dstXoff, by1 + dstYoff, x2 - x1, by2 - by1, pPriv->xor)))
+                fbSolid(dst + (by1 + dstYoff) * dstStride, dstStride, (x1 + dstXoff) * dstBpp, dstBpp,
+                        (x2 - x1) * dstBpp, by2 - by1, pPriv->and, pPriv->xor);
+        }
+    }
+}
+
+static void lorieParallelPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect, xRectangle *rects) {
+    BoxPtr extents = RegionExtents(fbGetCompositeClip(pGC));
+    lorieParallelFill fill = { pDrawable, pGC, nrect, rects };
+    int64_t pixels = 0;
+    int i;
+
+    if (pGC->fillStyle != FillSolid || !lorieParallelScreenPixmap(pDrawable)) {
+        fbPolyFillRect(pDrawable, pGC, nrect, rects);
+        return;
+    }
+
+    for (i = 0; i < nrect; i++) {
+        int x1 = max(rects[i].x + pDrawable->x, extents->x1), x2 = min(rects[i].x + pDrawable->x + rects[i].width, extents->x2);
+        int y1 = max(rects[i].y + pDrawable->y, extents->y1), y2 = min(rects[i].y + pDrawable->y + rects[i].height, extents->y2);
+        if (x1 < x2 && y1 < y2)
+            pixels += (int64_t) (x2 - x1) * (y2 - y1);
+    }
+
+    if (pixels < PARALLEL_MIN_PIXELS)
+        fbPolyFillRect(pDrawable, pGC, nrect, rects);
+    else
+        lorieParallelRun(lorieParallelFillBand, &fill, extents->y1, extents->y2);
+}
+
+typedef struct {
+    DrawablePtr pSrcDrawable, pDstDrawable;
+    GCPtr pGC;
+    BoxPtr boxes;
+    int nbox, dx, dy;
+    Bool reverse, upsidedown, columns;
+} lorieParallelCopy;
+
+static void lorieParallelCopyBand(void *data, int from, int to) {
+    lorieParallelCopy *copy = data;
+    FbGCPrivPtr pPriv = fbGetGCPrivate(copy->pGC);
+    FbBits *src, *dst;
+    FbStride srcStride, dstStride;
+    int srcBpp, dstBpp, srcXoff, srcYoff, dstXoff, dstYoff, i;
+
+    fbGetDrawable(copy->pSrcDrawable, src, srcStride, srcBpp, srcXoff, srcYoff);
+    fbGetDrawable(copy->pDstDrawable, dst, dstStride, dstBpp, dstXoff, dstYoff);
+
+    // Boxes are already sorted by miDoCopy for overlapping copies, order inside of a band is kept.
+    for (i = 0; i < copy->nbox; i++) {
+        BoxRec box = copy->boxes[i];
+        if (copy->columns) {
+            box.x1 = max(box.x1, from);
+            box.x2 = min(box.x2, to);
+        } else {
+            box.y1 = max(box.y1, from);
+            box.y2 = min(box.y2, to);
+        }
+        if (box.x1 >= box.x2 || box.y1 >= box.y2)
+            continue;
+
+        // Same as fbCopyNtoN, pixman fast path for forward GXcopy with all planes.
+        if (pPriv->pm == FB_ALLONES && copy->pGC->alu == GXcopy && !copy->reverse && !copy->upsidedown
+                && pixman_blt((uint32_t*) src, (uint32_t*) dst, srcStride, dstStride, srcBpp, dstBpp,
+                              box.x1 + copy->dx + srcXoff, box.y1 + copy->dy + srcYoff,
+                              box.x1 + dstXoff, box.y1 + dstYoff, box.x2 - box.x1, box.y2 - box.y1))
+            continue;
+
+        fbBlt(src + (box.y1 + copy->dy + srcYoff) * srcStride, srcStride, (box.x1 + copy->dx + srcXoff) * srcBpp,
+              dst + (box.y1 + dstYoff) * dstStride, dstStride, (box.x1 + dstXoff) * dstBpp,
+              (box.x2 - box.x1) * dstBpp, box.y2 - box.y1, copy->pGC->alu, pPriv->pm, dstBpp,
+              copy->reverse, copy->upsidedown);
+    }
+}
+
+static void lorieParallelCopyNtoN(DrawablePtr pSrcDrawable, DrawablePtr pDstDrawable, GCPtr pGC, BoxPtr pbox, int nbox,
+                                  int dx, int dy, Bool reverse, Bool upsidedown, Pixel bitplane, void *closure) {
+    lorieParallelCopy copy = { pSrcDrawable, pDstDrawable, pGC, pbox, nbox, dx, dy, reverse, upsidedown, FALSE };
+    PixmapPtr pSrcPixmap = lorieParallelPixmap(pSrcDrawable), pDstPixmap = lorieParallelPixmap(pDstDrawable);
+    BoxRec extents = { MAXSHORT, MAXSHORT, MINSHORT, MINSHORT };
+    int64_t pixels = 0;
+    int i;
+
+    for (i = 0; i < nbox; i++) {
+        pixels += (int64_t) (pbox[i].x2 - pbox[i].x1) * (pbox[i].y2 - pbox[i].y1);
+        extents.x1 = min(extents.x1, pbox[i].x1);
+        extents.y1 = min(extents.y1, pbox[i].y1);
+        extents.x2 = max(extents.x2, pbox[i].x2);
+        extents.y2 = max(extents.y2, pbox[i].y2);
+    }
+
+    if (pixels < PARALLEL_MIN_PIXELS || pSrcDrawable->bitsPerPixel != pDstDrawable->bitsPerPixel
+            || !lorieParallelScreenPixmap(pDstDrawable)) {
+        fbCopyNtoN(pSrcDrawable, pDstDrawable, pGC, pbox, nbox, dx, dy, reverse, upsidedown, bitplane, closure);
+        return;
+    }
+
+    /*
+     * Bands must not read what other bands write. Rows are independent when scrolling horizontally,
+     * columns are independent when scrolling vertically. Diagonal scrolls are done by fb.
+     */
+    if (pSrcPixmap == pDstPixmap && dx && dy) {
+        fbCopyNtoN(pSrcDrawable, pDstDrawable, pGC, pbox, nbox, dx, dy, reverse, upsidedown, bitplane, closure);
+        return;
+    }
+
+    copy.columns = pSrcPixmap == pDstPixmap && dy;
+    if (copy.columns)
+        lorieParallelRun(lorieParallelCopyBand, &copy, extents.x1, extents.x2);
+    else
+        lorieParallelRun(lorieParallelCopyBand, &copy, extents.y1, extents.y2);
+}
+
+static RegionPtr lorieParallelCopyArea(DrawablePtr pSrcDrawable, DrawablePtr pDstDrawable, GCPtr pGC,
+                                       int xIn, int yIn, int widthSrc, int heightSrc, int xOut, int yOut) {
+    return miDoCopy(pSrcDrawable, pDstDrawable, pGC, xIn, yIn, widthSrc, heightSrc, xOut, yOut, lorieParallelCopyNtoN, 0, 0);
+}
+
+typedef struct {
+    DrawablePtr pDrawable;
+    GCPtr pGC;
+    int x, y, w, h;
+    FbStip *src;
+    FbStride srcStride;
+} lorieParallelImage;
+
+static void lorieParallelImageBand(void *data, int y1, int y2) {
+    lorieParallelImage *image = data;
+    FbGCPrivPtr pPriv = fbGetGCPrivate(image->pGC);
+    RegionPtr clip = fbGetCompositeClip(image->pGC);
+    BoxPtr boxes = RegionRects(clip);
+    int nbox = RegionNumRects(clip), i;
+    FbStip *dst;
+    FbStride dstStride;
+    int dstBpp, dstXoff, dstYoff;
+
+    fbGetStipDrawable(image->pDrawable, dst, dstStride, dstBpp, dstXoff, dstYoff);
+    y1 = max(y1, image->y);
+    y2 = min(y2, image->y + image->h);
+    for (i = 0; i < nbox; i++) {
+        int x1 = max(image->x, boxes[i].x1), x2 = min(image->x + image->w, boxes[i].x2);
+        int by1 = max(y1, boxes[i].y1), by2 = min(y2, boxes[i].y2);
+        if (x1 >= x2 || by1 >= by2)
+            continue;
+
+        fbBltStip(image->src + (by1 - image->y) * image->srcStride, image->srcStride, (x1 - image->x) * dstBpp,
+                  dst + (by1 + dstYoff) * dstStride, dstStride, (x1 + dstXoff) * dstBpp,
+                  (x2 - x1) * dstBpp, by2 - by1, image->pGC->alu, pPriv->pm, dstBpp);
+    }
+}
+
+static void lorieParallelPutImage(DrawablePtr pDrawable, GCPtr pGC, int depth, int x, int y, int w, int h,
+                                  int leftPad, int format, char *pImage) {
+    lorieParallelImage image = {
+        pDrawable, pGC, x + pDrawable->x, y + pDrawable->y, w, h,
+        (FbStip*) pImage, PixmapBytePad(w, pDrawable->depth) / sizeof(FbStip)
+    };
+
+    if (format != ZPixmap || (int64_t) w * h < PARALLEL_MIN_PIXELS || pDrawable->bitsPerPixel != BitsPerPixel(pDrawable->depth)
+            || !lorieParallelScreenPixmap(pDrawable)) {
+        fbPutImage(pDrawable, pGC, depth, x, y, w, h, leftPad, format, pImage);
+        return;
+    }
+
+    lorieParallelRun(lorieParallelImageBand, &image, image.y, image.y + h);
+}
+
+typedef struct {
+    CARD8 op;
+    PicturePtr pSrc, pMask, pDst;
+    INT16 xSrc, ySrc, xMask, yMask, xDst, yDst;
+    CARD16 width;
+} lorieParallelComposite;
+
+// Every band has its own pixman images, pixman validates images lazily and that is not thread-safe.
+static void lorieParallelCompositeBand(void *data, int y1, int y2) {
+    lorieParallelComposite *c = data;
+    pixman_image_t *src, *mask, *dest;
+    int srcXoff, srcYoff, mskXoff, mskYoff, dstXoff, dstYoff;
+
+    src = image_from_pict(c->pSrc, FALSE, &srcXoff, &srcYoff);
+    mask = image_from_pict(c->pMask, FALSE, &mskXoff, &mskYoff);
+    dest = image_from_pict(c->pDst, TRUE, &dstXoff, &dstYoff);
+
+    if (src && dest && !(c->pMask && !mask))
+        pixman_image_composite32(c->op, src, mask, dest,
+                                 c->xSrc + srcXoff, c->ySrc + y1 - c->yDst + srcYoff,
+                                 c->xMask + mskXoff, c->yMask + y1 - c->yDst + mskYoff,
+                                 c->xDst + dstXoff, y1 + dstYoff, c->width, y2 - y1);
+
+    free_pixman_pict(c->pSrc, src);
+    free_pixman_pict(c->pMask, mask);
+    free_pixman_pict(c->pDst, dest);
+}
+
+static Bool lorieParallelPictureSafe(PicturePtr pPicture) {
+    // Pictures which read the destination would read rows written by other bands.
+    return !pPicture || !pPicture->pDrawable || (!pPicture->alphaMap && !lorieParallelScreenPixmap(pPicture->pDrawable));
+}
+
+static void lorieParallelCompositeRects(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
+                                        INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+                                        INT16 xDst, INT16 yDst, CARD16 width, CARD16 height) {
+    lorieParallelComposite c = { op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask, xDst, yDst, width };
+
+    if ((int64_t) width * height < PARALLEL_MIN_PIXELS || !pDst->pDrawable || pDst->alphaMap
+            || !lorieParallelScreenPixmap(pDst->pDrawable) || !lorieParallelPictureSafe(pSrc) || !lorieParallelPictureSafe(pMask)) {
+        composite(op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask, xDst, yDst, width, height);
+        return;
+    }
+
+    // Source validation may call into other layers (i.e. software cursor), it is done only here.
+    miCompositeSourceValidate(pSrc);
+    if (pMask)
+        miCompositeSourceValidate(pMask);
+
+    lorieParallelRun(lorieParallelCompositeBand, &c, yDst, yDst + height);
+}
+
+static Bool lorieParallelCreateGC(GCPtr pGC) {
+    ScreenPtr pScreen = pGC->pScreen;
+    Bool ret;
+
+    pScreen->CreateGC = createGC;
+    ret = pScreen->CreateGC(pGC);
+    pScreen->CreateGC = lorieParallelCreateGC;
+
+    // fb never changes ops after creating GC.
+    if (ret && pGC->ops == &fbGCOps)
+        pGC->ops = &lorieParallelOps;
+    return ret;
+}
+
+Bool lorieParallelInit(ScreenPtr pScreen, int threads) {
+    PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+    sigset_t set, old;
+    pthread_t thread;
+
+    if (threads < 0)
+        threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    threads = min(threads, PARALLEL_MAX_THREADS);
+    if (threads <= 1)
+        return TRUE;
+
+    // Workers inherit the mask, signals used by X server must be handled by the main thread.
+    // Faults are delivered to the thread which caused them and must stay unblocked to crash with a report.
+    sigfillset(&set);
+    sigdelset(&set, SIGSEGV);
+    sigdelset(&set, SIGBUS);
+    sigdelset(&set, SIGILL);
+    sigdelset(&set, SIGFPE);
+    sigdelset(&set, SIGTRAP);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    for (; pool.threads < threads - 1; pool.threads++)
+        if (pthread_create(&thread, NULL, lorieParallelWorker, NULL) != 0)
+            break;
+        else
+            pthread_detach(thread);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (!pool.threads)
+        return TRUE;
+
+    log("drawing with %d worker threads", pool.threads);
+    lorieParallelOps = fbGCOps;
+    lorieParallelOps.PolyFillRect = lorieParallelPolyFillRect;
+    lorieParallelOps.CopyArea = lorieParallelCopyArea;
+    lorieParallelOps.PutImage = lorieParallelPutImage;
+
+    createGC = pScreen->CreateGC;
+    pScreen->CreateGC = lorieParallelCreateGC;
+    if (ps) {
+        composite = ps->Composite;
+        ps->Composite = lorieParallelCompositeRects;
+    }
+    return TRUE;
+}
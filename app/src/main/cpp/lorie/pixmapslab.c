@@ -0,0 +1,241 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <android/log.h>
+#include "scrnintstr.h"
+#include "pixmapstr.h"
+#include "privates.h"
+#include "servermd.h"
+#include "lorie.h"
+
+/*
+ * Toolkits create and destroy lots of small pixmaps (icons, glyph masks, temporary buffers).
+ * Pixel data of small and medium pixmaps is taken from per-size-class slabs, large pixmaps are
+ * mmapped directly. fb does not clear pixmaps it creates, so recycled blocks are not cleared too.
+ */
+#define SLAB_MIN_SHIFT 9 // 512 bytes
+#define SLAB_MAX_SHIFT 18 // 256 KiB
+#define SLAB_CLASSES (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_MIN_SIZE (256 << 10)
+#define SLAB_MIN_BLOCKS 16
+
+#define log(...) __android_log_print(ANDROID_LOG_DEBUG, "LorieSlab", __VA_ARGS__)
+
+typedef struct lorieSlab {
+    struct lorieSlab *next;
+    void *free;
+    char *data;
+    size_t size;
+    int used;
+} lorieSlab, *lorieSlabPtr;
+
+typedef struct {
+    lorieSlabPtr slab; // NULL if data was mmapped directly
+    lorieResidencyPtr residency; // Only mmapped pixmaps can be compressed while idle
+    void *data;
+    size_t size;
+    int cls;
+} lorieSlabPixmapRec, *lorieSlabPixmapPtr;
+
+static struct {
+    lorieSlabPtr slabs;
+    int slabCount, used, peak;
+} classes[SLAB_CLASSES];
+
+static struct {
+    size_t bytes;
+    int count;
+} mapped;
+
+static DevPrivateKeyRec lorieSlabPixmapKey;
+static CreatePixmapProcPtr createPixmap;
+static DestroyPixmapProcPtr destroyPixmap;
+
+#define lorieSlabPixmapPriv(p) ((lorieSlabPixmapPtr) dixLookupPrivate(&(p)->devPrivates, &lorieSlabPixmapKey))
+#define lorieSlabBlockSize(cls) ((size_t) 1 << ((cls) + SLAB_MIN_SHIFT))
+
+void lorieSlabLogStats(void) {
+    int cls;
+    for (cls = 0; cls < SLAB_CLASSES; cls++)
+        if (classes[cls].slabCount)
+            log("class %6zu: %d slabs, %d blocks in use (peak %d), %zu KiB reserved", lorieSlabBlockSize(cls),
+                classes[cls].slabCount, classes[cls].used, classes[cls].peak,
+                (size_t) classes[cls].slabCount * max(SLAB_MIN_SIZE, lorieSlabBlockSize(cls) * SLAB_MIN_BLOCKS) >> 10);
+    log("mmapped: %d pixmaps, %zu KiB", mapped.count, mapped.bytes >> 10);
+    lorieResidencyLogStats();
+}
+
+// Unmaps all empty slabs, including ones kept for reuse. Returns number of bytes released.
+size_t lorieSlabTrim(void) {
+    size_t released = 0;
+    int cls;
+
+    for (cls = 0; cls < SLAB_CLASSES; cls++) {
+        lorieSlabPtr *p = &classes[cls].slabs;
+        while (*p) {
+            lorieSlabPtr slab = *p;
+            if (slab->used) {
+                p = &slab->next;
+                continue;
+            }
+
+            *p = slab->next;
+            classes[cls].slabCount--;
+            released += slab->size;
+            munmap(slab->data, slab->size);
+            free(slab);
+        }
+    }
+
+    return released;
+}
+
+static lorieSlabPtr lorieSlabCreate(int cls) {
+    size_t i, blockSize = lorieSlabBlockSize(cls);
+    lorieSlabPtr slab = calloc(1, sizeof(lorieSlab));
+    if (!slab)
+        return NULL;
+
+    slab->size = max(SLAB_MIN_SIZE, blockSize * SLAB_MIN_BLOCKS);
+    slab->data = mmap(NULL, slab->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab->data == MAP_FAILED) {
+        free(slab);
+        return NULL;
+    }
+
+    for (i = slab->size / blockSize; i-- > 0;) {
+        *(void**) (slab->data + i * blockSize) = slab->free;
+        slab->free = slab->data + i * blockSize;
+    }
+
+    slab->next = classes[cls].slabs;
+    classes[cls].slabs = slab;
+    classes[cls].slabCount++;
+    return slab;
+}
+
+static void *lorieSlabAlloc(int cls, lorieSlabPtr *pSlab) {
+    lorieSlabPtr slab;
+    void *block;
+
+    for (slab = classes[cls].slabs; slab && !slab->free; slab = slab->next);
+    if (!slab && !(slab = lorieSlabCreate(cls)))
+        return NULL;
+
+    block = slab->free;
+    slab->free = *(void**) block;
+    slab->used++;
+    classes[cls].used++;
+    classes[cls].peak = max(classes[cls].peak, classes[cls].used);
+    *pSlab = slab;
+    return block;
+}
+
+static void lorieSlabRelease(int cls, lorieSlabPtr slab, void *block) {
+    lorieSlabPtr *p;
+
+    *(void**) block = slab->free;
+    slab->free = block;
+    slab->used--;
+    classes[cls].used--;
+
+    // One empty slab is kept to avoid mapping and unmapping it again and again.
+    if (slab->used || classes[cls].slabCount == 1)
+        return;
+
+    for (p = &classes[cls].slabs; *p != slab; p = &(*p)->next);
+    *p = slab->next;
+    classes[cls].slabCount--;
+    munmap(slab->data, slab->size);
+    free(slab);
+}
+
+static void lorieSlabPixmapFree(lorieSlabPixmapPtr rec) {
+    if (rec->data && rec->slab)
+        lorieSlabRelease(rec->cls, rec->slab, rec->data);
+    else if (rec->data) {
+        lorieResidencyUntrack(rec->residency);
+        munmap(rec->data, rec->size);
+        mapped.bytes -= rec->size;
+        mapped.count--;
+    }
+}
+
+static PixmapPtr lorieCreatePixmap(ScreenPtr pScreen, int width, int height, int depth, unsigned usage_hint) {
+    lorieSlabPixmapRec rec = {0};
+    PixmapPtr pPixmap;
+    int bpp, stride;
+
+    pScreen->CreatePixmap = createPixmap;
+    if (width <= 0 || height <= 0 || width > 32767 || height > 32767) {
+        pPixmap = pScreen->CreatePixmap(pScreen, width, height, depth, usage_hint);
+        pScreen->CreatePixmap = lorieCreatePixmap;
+        return pPixmap;
+    }
+
+    // Rows are aligned to 16 bytes, wide rows are aligned to cache line size.
+    bpp = BitsPerPixel(depth);
+    stride = (width * bpp + 7) / 8;
+    stride = stride < 256 ? (stride + 15) & ~15 : (stride + 63) & ~63;
+    rec.size = (size_t) stride * height;
+
+    for (rec.cls = 0; rec.cls < SLAB_CLASSES && lorieSlabBlockSize(rec.cls) < rec.size; rec.cls++);
+    if (rec.cls < SLAB_CLASSES)
+        rec.data = lorieSlabAlloc(rec.cls, &rec.slab);
+    else {
+        rec.size = (rec.size + getpagesize() - 1) & ~((size_t) getpagesize() - 1);
+        rec.data = mmap(NULL, rec.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (rec.data == MAP_FAILED)
+            rec.data = NULL;
+        else {
+            mapped.bytes += rec.size;
+            mapped.count++;
+        }
+    }
+
+    // Pixmap header is still created by fb, only pixel data is replaced.
+    pPixmap = rec.data ? pScreen->CreatePixmap(pScreen, 0, 0, depth, usage_hint)
+                       : pScreen->CreatePixmap(pScreen, width, height, depth, usage_hint);
+    pScreen->CreatePixmap = lorieCreatePixmap;
+
+    if (rec.data && pPixmap) {
+        pScreen->ModifyPixmapHeader(pPixmap, width, height, depth, bpp, stride, rec.data);
+        if (!rec.slab)
+            rec.residency = lorieResidencyTrack(pPixmap, rec.data, rec.size);
+        *lorieSlabPixmapPriv(pPixmap) = rec;
+    } else
+        lorieSlabPixmapFree(&rec);
+
+    return pPixmap;
+}
+
+static Bool lorieDestroyPixmap(PixmapPtr pPixmap) {
+    ScreenPtr pScreen = pPixmap->drawable.pScreen;
+    lorieSlabPixmapRec rec = {0};
+    Bool ret;
+
+    if (pPixmap->refcnt == 1)
+        rec = *lorieSlabPixmapPriv(pPixmap);
+
+    pScreen->DestroyPixmap = destroyPixmap;
+    ret = pScreen->DestroyPixmap(pPixmap);
+    pScreen->DestroyPixmap = lorieDestroyPixmap;
+
+    lorieSlabPixmapFree(&rec);
+    return ret;
+}
+
+Bool lorieSlabInit(ScreenPtr pScreen) {
+    if (!dixRegisterPrivateKey(&lorieSlabPixmapKey, PRIVATE_PIXMAP, sizeof(lorieSlabPixmapRec)))
+        return FALSE;
+
+    createPixmap = pScreen->CreatePixmap;
+    pScreen->CreatePixmap = lorieCreatePixmap;
+    destroyPixmap = pScreen->DestroyPixmap;
+    pScreen->DestroyPixmap = lorieDestroyPixmap;
+    return TRUE;
+}
@@ -14,6 +14,7 @@
 #include <android/native_window.h>
 #include <android/log.h>
 #include <dlfcn.h>
+#include <string.h>
 #include "renderer.h"
 #include "os.h"
 
@@ -27,6 +28,7 @@ m(a, eglInitialize)                    \
 m(a, eglChooseConfig)                  \
 m(a, eglBindAPI)                       \
 m(a, eglCreateContext)                 \
+m(a, eglDestroyContext)                \
 m(a, eglMakeCurrent)                   \
 m(a, eglSwapInterval)                  \
 m(a, eglDestroySurface)                \
@@ -60,7 +62,15 @@ m(a, glEnable)                         \
 m(a, glBlendFunc)                      \
 m(a, glDisable)                        \
 m(a, glGetAttribLocation)              \
+m(a, glGetUniformLocation)             \
+m(a, glUniform1i)                      \
+m(a, glUniform1f)                      \
+m(a, glUniform2f)                      \
+m(a, glUniform3f)                      \
+m(a, glDisableVertexAttribArray)       \
+m(a, glPixelStorei)                    \
 m(a, glGenTextures)                    \
+m(a, glDeleteTextures)                 \
 m(a, glViewport)                       \
 m(a, glClearColor)                     \
 m(a, glClear)                          \
@@ -152,33 +162,192 @@ static const char vertex_shader[] =
     "   outTexCoords = texCoords;\n"
     "   gl_Position = position;\n"
     "}\n";
+
+// CRTC gamma ramp and optional 3D LUT are applied while the buffer is drawn, so they cost no extra pass.
+// GLES2 has no 3D textures, LUT is stored as a row of N slices of NxN texels, blue selects the slice.
+#define COLOR_CORRECTION                                                                    \
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"                                                   \
+    "#define LUTP highp\n"                                                                  \
+    "#else\n"                                                                               \
+    "#define LUTP mediump\n"                                                                \
+    "#endif\n"                                                                              \
+    "uniform sampler2D gamma;\n"                                                            \
+    "uniform sampler2D lut;\n"                                                              \
+    "uniform float gammaEnabled;\n"                                                         \
+    "uniform LUTP float lutSize;\n"                                                         \
+    "vec3 correct(vec3 c) {\n"                                                              \
+    "   if (lutSize > 0.0) {\n"                                                             \
+    "       LUTP vec3 p = c * (lutSize - 1.0);\n"                                           \
+    "       LUTP float b = floor(p.b);\n"                                                   \
+    "       LUTP vec2 uv = vec2((p.r + 0.5 + b * lutSize) / (lutSize * lutSize), (p.g + 0.5) / lutSize);\n" \
+    "       vec3 c0 = texture2D(lut, uv).rgb;\n"                                            \
+    "       vec3 c1 = texture2D(lut, uv + vec2(min(1.0, lutSize - 1.0 - b) / lutSize, 0.0)).rgb;\n" \
+    "       c = mix(c0, c1, p.b - b);\n"                                                    \
+    "   }\n"                                                                                \
+    "   if (gammaEnabled > 0.0) {\n"                                                        \
+    "       c = c * (255.0 / 256.0) + 0.5 / 256.0;\n"                                       \
+    "       c = vec3(texture2D(gamma, vec2(c.r, 0.5)).r,\n"                                 \
+    "                texture2D(gamma, vec2(c.g, 0.5)).g,\n"                                 \
+    "                texture2D(gamma, vec2(c.b, 0.5)).b);\n"                                \
+    "   }\n"                                                                                \
+    "   return c;\n"                                                                        \
+    "}\n"
+
 static const char fragment_shader[] =
     "precision mediump float;\n"
     "varying vec2 outTexCoords;\n"
     "uniform sampler2D texture;\n"
+    "uniform float opaque;\n"
+    COLOR_CORRECTION
+    "void main(void) {\n"
+    "   vec4 c = texture2D(texture, outTexCoords);\n"
+    "   gl_FragColor = vec4(correct(c.rgb), max(c.a, opaque));\n"
+    "}\n";
+
+// Soft shadow of composited window, `local` is position relative to window's top left corner in pixels.
+static const char shadow_vertex_shader[] =
+    "attribute vec4 position;\n"
+    "attribute vec2 local;\n"
+    "varying vec2 outLocal;\n"
+    "void main(void) {\n"
+    "   outLocal = local;\n"
+    "   gl_Position = position;\n"
+    "}\n";
+static const char shadow_fragment_shader[] =
+    "precision mediump float;\n"
+    "varying vec2 outLocal;\n"
+    "uniform vec2 size;\n"
+    "uniform float radius;\n"
     "void main(void) {\n"
-    "   gl_FragColor = texture2D(texture, outTexCoords);\n"
+    "   vec2 d = max(max(-outLocal, outLocal - size), 0.0);\n"
+    "   gl_FragColor = vec4(0.0, 0.0, 0.0, 0.35 * (1.0 - smoothstep(0.0, radius, length(d))));\n"
+    "}\n";
+
+// Video is shown only where root buffer contains colorkey, so windows overlapping video window clip it.
+static const char video_vertex_shader[] =
+    "attribute vec4 position;\n"
+    "attribute vec2 rootCoords;\n"
+    "attribute vec2 videoCoords;\n"
+    "varying vec2 outRootCoords;\n"
+    "varying vec2 outVideoCoords;\n"
+    "void main(void) {\n"
+    "   outRootCoords = rootCoords;\n"
+    "   outVideoCoords = videoCoords;\n"
+    "   gl_Position = position;\n"
+    "}\n";
+static const char video_fragment_shader[] =
+    "precision mediump float;\n"
+    "varying vec2 outRootCoords;\n"
+    "varying vec2 outVideoCoords;\n"
+    "uniform sampler2D root;\n"
+    "uniform sampler2D planeY;\n"
+    "uniform sampler2D planeU;\n"
+    "uniform sampler2D planeV;\n"
+    "uniform int layout;\n"
+    "uniform float width;\n"
+    "uniform vec3 key;\n"
+    COLOR_CORRECTION
+    "void main(void) {\n"
+    "   float y, u, v;\n"
+    "   if (any(greaterThan(abs(texture2D(root, outRootCoords).rgb - key), vec3(1.0 / 512.0))))\n"
+    "       discard;\n"
+    "   if (layout == 3) {\n" // Packed: every texel is Y0 U Y1 V
+    "       vec4 t = texture2D(planeY, outVideoCoords);\n"
+    "       y = fract(outVideoCoords.x * width * 0.5) < 0.5 ? t.r : t.b;\n"
+    "       u = t.g;\n"
+    "       v = t.a;\n"
+    "   } else if (layout == 2) {\n" // Semi-planar: interleaved UV plane is uploaded as luminance-alpha
+    "       y = texture2D(planeY, outVideoCoords).r;\n"
+    "       u = texture2D(planeU, outVideoCoords).r;\n"
+    "       v = texture2D(planeU, outVideoCoords).a;\n"
+    "   } else {\n"
+    "       y = texture2D(planeY, outVideoCoords).r;\n"
+    "       u = texture2D(planeU, outVideoCoords).r;\n"
+    "       v = texture2D(planeV, outVideoCoords).r;\n"
+    "   }\n"
+    "   y = 1.1643 * (y - 0.0625);\n" // BT.601, limited range
+    "   u -= 0.5;\n"
+    "   v -= 0.5;\n"
+    "   gl_FragColor = vec4(correct(vec3(y + 1.5958 * v, y - 0.39173 * u - 0.8129 * v, y + 2.017 * u)), 1.0);\n"
     "}\n";
 
 static EGLDisplay egl_display = EGL_NO_DISPLAY;
 static EGLContext ctx = EGL_NO_CONTEXT;
-static EGLSurface sfc = EGL_NO_SURFACE;
 static EGLConfig cfg = 0;
-static EGLNativeWindowType win = 0;
-static EGLImageKHR image = NULL;
 
-static struct {
+static struct renderer_output {
+    EGLNativeWindowType win;
+    EGLSurface sfc;
+    EGLImageKHR image;
+    AHardwareBuffer* buffer;
     GLuint id;
-    float width, height;
-} display;
+    // Part of the screen shown by the output.
+    float x, y, width, height;
+    // Part of the texture occupied by the screen. Buffer may be larger than screen.
+    float s, t;
+    // Textures are updated only when ramp or LUT are changed, right before the next frame.
+    struct {
+        GLuint id;
+        uint8_t ramp[256 * 4];
+        int enabled, dirty;
+    } gamma;
+    struct {
+        GLuint id;
+        uint32_t *data;
+        int size, dirty;
+    } lut;
+} outputs[RENDERER_MAX_OUTPUTS];
 static struct {
     GLuint id;
     float x, y, width, height, xhot, yhot;
 } cursor;
 
+// Redirected top-level windows, drawn over the root buffer from bottom to top.
+struct renderer_window {
+    GLuint id;
+    int width, height;
+    float x, y;
+    int argb, shadow;
+    struct renderer_window *next;
+};
+static struct renderer_window *windows; // All windows, to release textures when renderer is trimmed
+static struct renderer_window *scanout; // Replaces root buffer while it is set
+static struct {
+    renderer_window_ptr *windows;
+    int count, size;
+} stack;
+static uint8_t *scratch;
+static size_t scratchSize;
+
+#define SHADOW_RADIUS 12.f
+
+static struct {
+    int format; // 0 if there is no video
+    int width, height;
+    GLuint planes[3];
+    int planeWidth[3], planeHeight[3];
+    int uploaded;
+    // Part of the image which is shown and position of the video on the screen.
+    float s0, t0, s1, t1;
+    float x, y, w, h;
+    float key[3];
+    struct renderer_window *window; // Window which contains colorkey, root buffer if NULL
+} video;
+
+// Texture units 1-3 are used by video planes.
+#define GAMMA_UNIT 4
+#define LUT_UNIT 5
+
 GLuint g_texture_program = 0, gv_pos = 0, gv_coords = 0;
+GLint gu_opaque = 0;
+GLuint g_shadow_program = 0, gv_shadow_pos = 0, gv_shadow_local = 0;
+GLint gu_shadow_size = 0, gu_shadow_radius = 0;
+GLint gu_gamma_enabled = 0, gu_lut_size = 0, gu_video_gamma_enabled = 0, gu_video_lut_size = 0;
+GLuint g_video_program = 0, gv_video_pos = 0, gv_root_coords = 0, gv_video_coords = 0;
+GLint gu_layout = 0, gu_width = 0, gu_key = 0;
 
 int renderer_init(void) {
+    int i;
     EGLint major, minor;
     EGLint numConfigs;
     const EGLint configAttribs[] = {
@@ -245,71 +414,136 @@ int renderer_init(void) {
 
     gv_pos = (GLuint) $glGetAttribLocation(g_texture_program, "position"); checkGlError();
     gv_coords = (GLuint) $glGetAttribLocation(g_texture_program, "texCoords"); checkGlError();
+    gu_gamma_enabled = $glGetUniformLocation(g_texture_program, "gammaEnabled"); checkGlError();
+    gu_lut_size = $glGetUniformLocation(g_texture_program, "lutSize"); checkGlError();
+    gu_opaque = $glGetUniformLocation(g_texture_program, "opaque"); checkGlError();
+    $glUseProgram(g_texture_program); checkGlError();
+    $glUniform1i($glGetUniformLocation(g_texture_program, "gamma"), GAMMA_UNIT); checkGlError();
+    $glUniform1i($glGetUniformLocation(g_texture_program, "lut"), LUT_UNIT); checkGlError();
+
+    g_video_program = create_program(video_vertex_shader, video_fragment_shader);
+    if (g_video_program) {
+        gv_video_pos = (GLuint) $glGetAttribLocation(g_video_program, "position"); checkGlError();
+        gv_root_coords = (GLuint) $glGetAttribLocation(g_video_program, "rootCoords"); checkGlError();
+        gv_video_coords = (GLuint) $glGetAttribLocation(g_video_program, "videoCoords"); checkGlError();
+        gu_layout = $glGetUniformLocation(g_video_program, "layout"); checkGlError();
+        gu_width = $glGetUniformLocation(g_video_program, "width"); checkGlError();
+        gu_key = $glGetUniformLocation(g_video_program, "key"); checkGlError();
+        gu_video_gamma_enabled = $glGetUniformLocation(g_video_program, "gammaEnabled"); checkGlError();
+        gu_video_lut_size = $glGetUniformLocation(g_video_program, "lutSize"); checkGlError();
+        $glUseProgram(g_video_program); checkGlError();
+        $glUniform1i($glGetUniformLocation(g_video_program, "root"), 0); checkGlError();
+        $glUniform1i($glGetUniformLocation(g_video_program, "planeY"), 1); checkGlError();
+        $glUniform1i($glGetUniformLocation(g_video_program, "planeU"), 2); checkGlError();
+        $glUniform1i($glGetUniformLocation(g_video_program, "planeV"), 3); checkGlError();
+        $glUniform1i($glGetUniformLocation(g_video_program, "gamma"), GAMMA_UNIT); checkGlError();
+        $glUniform1i($glGetUniformLocation(g_video_program, "lut"), LUT_UNIT); checkGlError();
+    } else
+        log("Xlorie: GLESv2: Unable to create video shader program, Xv will not be shown.\n");
+
+    g_shadow_program = create_program(shadow_vertex_shader, shadow_fragment_shader);
+    if (g_shadow_program) {
+        gv_shadow_pos = (GLuint) $glGetAttribLocation(g_shadow_program, "position"); checkGlError();
+        gv_shadow_local = (GLuint) $glGetAttribLocation(g_shadow_program, "local"); checkGlError();
+        gu_shadow_size = $glGetUniformLocation(g_shadow_program, "size"); checkGlError();
+        gu_shadow_radius = $glGetUniformLocation(g_shadow_program, "radius"); checkGlError();
+    }
 
     $glActiveTexture(GL_TEXTURE0); checkGlError();
-    $glGenTextures(1, &display.id); checkGlError();
+    for (i = 0; i < RENDERER_MAX_OUTPUTS; i++) {
+        $glGenTextures(1, &outputs[i].id); checkGlError();
+    }
     $glGenTextures(1, &cursor.id); checkGlError();
 
     return 1;
 }
 
-void renderer_set_buffer(AHardwareBuffer* buffer) {
+void renderer_set_buffer(int output, AHardwareBuffer* buffer, int x, int y, int width, int height) {
     const EGLint imageAttributes[] = {EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE};
+    struct renderer_output *o = &outputs[output];
     EGLClientBuffer clientBuffer;
     AHardwareBuffer_Desc desc;
     __android_log_print(ANDROID_LOG_DEBUG, "XlorieTest2", "renderer_set_buffer0");
-    if (image)
-        $eglDestroyImageKHR(egl_display, image);
 
-    AHardwareBuffer_describe(buffer, &desc);
+    o->x = (float) x;
+    o->y = (float) y;
+    o->width = (float) width;
+    o->height = (float) height;
 
-    display.width = (float) desc.width;
-    display.height = (float) desc.height;
+    if (buffer) {
+        AHardwareBuffer_describe(buffer, &desc);
+        o->s = (float) width / (float) desc.width;
+        o->t = (float) height / (float) desc.height;
+    }
+
+    // Renderer was trimmed, EGLImage will be created when context is recreated.
+    if (!ctx)
+        return;
+
+    // Screen was resized inside of the same buffer, EGLImage is still valid.
+    if (o->image && buffer == o->buffer) {
+        renderer_redraw(output);
+        return;
+    }
+
+    if (o->image)
+        $eglDestroyImageKHR(egl_display, o->image);
+    o->image = NULL;
+    o->buffer = buffer;
+    if (!buffer)
+        return;
 
     clientBuffer = $eglGetNativeClientBufferANDROID(buffer); eglCheckError(__LINE__);
-    image = $eglCreateImageKHR(egl_display, EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID, clientBuffer, imageAttributes); eglCheckError(__LINE__);
+    o->image = $eglCreateImageKHR(egl_display, EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID, clientBuffer, imageAttributes); eglCheckError(__LINE__);
 
-    $glBindTexture(GL_TEXTURE_2D, display.id); checkGlError();
+    $glBindTexture(GL_TEXTURE_2D, o->id); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); checkGlError();
-    $glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image); checkGlError();
-    renderer_redraw();
+    $glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, o->image); checkGlError();
+    renderer_redraw(output);
 
     __android_log_print(ANDROID_LOG_DEBUG, "XlorieTest2", "renderer_set_buffer %d %d", desc.width, desc.height);
 }
 
-void renderer_set_window(EGLNativeWindowType window) {
-    __android_log_print(ANDROID_LOG_DEBUG, "XlorieTest2", "renderer_set_window %p %d %d", window, win ? ANativeWindow_getWidth(win) : 0, win ? ANativeWindow_getHeight(win) : 0);
-    if (win == window)
+void renderer_set_window(int output, EGLNativeWindowType window) {
+    struct renderer_output *o = &outputs[output];
+    __android_log_print(ANDROID_LOG_DEBUG, "XlorieTest2", "renderer_set_window %d %p %d %d", output, window, window ? ANativeWindow_getWidth(window) : 0, window ? ANativeWindow_getHeight(window) : 0);
+    if (o->win == window)
+        return;
+
+    if (window && !ctx && !renderer_init())
         return;
 
-    if (sfc != EGL_NO_SURFACE) {
-        if ($eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT) != EGL_TRUE) {
+    if (o->sfc != EGL_NO_SURFACE) {
+        if ($eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx) != EGL_TRUE) {
             log("Xlorie: eglMakeCurrent (EGL_NO_SURFACE) failed.\n");
             eglCheckError(__LINE__);
             return;
         }
-        if ($eglDestroySurface(egl_display, sfc) != EGL_TRUE) {
+        if ($eglDestroySurface(egl_display, o->sfc) != EGL_TRUE) {
             log("Xlorie: eglDestoySurface failed.\n");
             eglCheckError(__LINE__);
             return;
         }
+        o->sfc = EGL_NO_SURFACE;
     }
 
-    if (win)
-        ANativeWindow_release(win);
-    win = window;
+    if (o->win)
+        ANativeWindow_release(o->win);
+    o->win = window;
+    if (!window)
+        return;
 
-    sfc = $eglCreateWindowSurface(egl_display, cfg, win, NULL);
-    if (sfc == EGL_NO_SURFACE) {
+    o->sfc = $eglCreateWindowSurface(egl_display, cfg, window, NULL);
+    if (o->sfc == EGL_NO_SURFACE) {
         log("Xlorie: eglCreateWindowSurface failed.\n");
         eglCheckError(__LINE__);
         return;
     }
 
-    if ($eglMakeCurrent(egl_display, sfc, sfc, ctx) != EGL_TRUE) {
+    if ($eglMakeCurrent(egl_display, o->sfc, o->sfc, ctx) != EGL_TRUE) {
         log("Xlorie: eglMakeCurrent failed.\n");
         eglCheckError(__LINE__);
         return;
@@ -317,23 +551,18 @@ void renderer_set_window(EGLNativeWindowType window) {
 
     $eglSwapInterval(egl_display, 0);
 
-    if (win && ctx && ANativeWindow_getWidth(win) && ANativeWindow_getHeight(win))
-        $glViewport(0, 0, ANativeWindow_getWidth(win), ANativeWindow_getHeight(win)); checkGlError();
-
-    log("Xlorie: new surface applied: %p\n", sfc);
-
-    if (!sfc)
-        return;
+    log("Xlorie: new surface applied: %p\n", o->sfc);
 
     $glClearColor(1.f, 0.f, 0.f, 0.0f); checkGlError();
     $glClear(GL_COLOR_BUFFER_BIT); checkGlError();
-    renderer_redraw();
+    renderer_redraw(output);
 }
 
 maybe_unused void renderer_upload(int w, int h, void* data) {
-    display.width = (float) w;
-    display.height = (float) h;
-    $glBindTexture(GL_TEXTURE_2D, display.id); checkGlError();
+    outputs[0].width = (float) w;
+    outputs[0].height = (float) h;
+    outputs[0].s = outputs[0].t = 1.f;
+    $glBindTexture(GL_TEXTURE_2D, outputs[0].id); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); checkGlError();
@@ -345,9 +574,10 @@ maybe_unused void renderer_upload(int w, int h, void* data) {
 maybe_unused void renderer_update_rects(int width, maybe_unused int height, pixman_box16_t *rects, int amount, void* data) {
     int i, w, j;
     uint32_t* d;
-    display.width = (float) width;
-    display.height = (float) height;
-    $glBindTexture(GL_TEXTURE_2D, display.id); checkGlError();
+    outputs[0].width = (float) width;
+    outputs[0].height = (float) height;
+    outputs[0].s = outputs[0].t = 1.f;
+    $glBindTexture(GL_TEXTURE_2D, outputs[0].id); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); checkGlError();
@@ -368,6 +598,9 @@ void renderer_update_cursor(int w, int h, int xhot, int yhot, void* data) {
     cursor.xhot = (float) xhot;
     cursor.yhot = (float) yhot;
 
+    if (!ctx)
+        return;
+
     $glBindTexture(GL_TEXTURE_2D, cursor.id); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); checkGlError();
     $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); checkGlError();
@@ -382,18 +615,395 @@ void renderer_set_cursor_coordinates(int x, int y) {
     cursor.y = (float) y;
 }
 
-static void draw(GLuint id, float x0, float y0, float x1, float y1);
-static void draw_cursor(void);
+static void upload_plane(int i, GLenum format, int width, int height, GLint filter, const void *data) {
+    $glBindTexture(GL_TEXTURE_2D, video.planes[i]); checkGlError();
+    if (video.planeWidth[i] == width && video.planeHeight[i] == height) {
+        $glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data); checkGlError();
+        return;
+    }
+
+    $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter); checkGlError();
+    $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter); checkGlError();
+    $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); checkGlError();
+    $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); checkGlError();
+    $glTexImage2D(GL_TEXTURE_2D, 0, (GLint) format, width, height, 0, format, GL_UNSIGNED_BYTE, data); checkGlError();
+    video.planeWidth[i] = width;
+    video.planeHeight[i] = height;
+}
+
+void renderer_set_video(int format, int width, int height, const uint8_t *data, int sx, int sy, int sw, int sh,
+                        int x, int y, int w, int h, uint32_t key, renderer_window_ptr window) {
+    const uint8_t *u = data + width * height, *v = u + (width / 2) * (height / 2);
+
+    video.format = format;
+    video.width = width;
+    video.height = height;
+    video.s0 = (float) sx / (float) width;
+    video.t0 = (float) sy / (float) height;
+    video.s1 = (float) (sx + sw) / (float) width;
+    video.t1 = (float) (sy + sh) / (float) height;
+    video.x = (float) x;
+    video.y = (float) y;
+    video.w = (float) w;
+    video.h = (float) h;
+    video.key[0] = (float) ((key >> 16) & 0xFF) / 255.f;
+    video.key[1] = (float) ((key >> 8) & 0xFF) / 255.f;
+    video.key[2] = (float) (key & 0xFF) / 255.f;
+    video.window = window;
+
+    if (!ctx || !g_video_program)
+        return;
+
+    if (!video.planes[0]) {
+        $glGenTextures(3, video.planes); checkGlError();
+    }
+
+    // Planes are tightly packed, see lorieXvQueryImageAttributes.
+    $glActiveTexture(GL_TEXTURE0); checkGlError();
+    $glPixelStorei(GL_UNPACK_ALIGNMENT, 1); checkGlError();
+    switch (format) {
+        case RENDERER_VIDEO_YV12:
+            v = u;
+            u = v + (width / 2) * (height / 2);
+            // fallthrough
+        case RENDERER_VIDEO_I420:
+            upload_plane(0, GL_LUMINANCE, width, height, GL_LINEAR, data);
+            upload_plane(1, GL_LUMINANCE, width / 2, height / 2, GL_LINEAR, u);
+            upload_plane(2, GL_LUMINANCE, width / 2, height / 2, GL_LINEAR, v);
+            break;
+        case RENDERER_VIDEO_NV12:
+            upload_plane(0, GL_LUMINANCE, width, height, GL_LINEAR, data);
+            upload_plane(1, GL_LUMINANCE_ALPHA, width / 2, height / 2, GL_LINEAR, u);
+            break;
+        case RENDERER_VIDEO_YUY2:
+            // Two pixels share one texel, interpolation would mix luma of neighbouring pixels with chroma.
+            upload_plane(0, GL_RGBA, width / 2, height, GL_NEAREST, data);
+            break;
+    }
+    $glPixelStorei(GL_UNPACK_ALIGNMENT, 4); checkGlError();
+    video.uploaded = 1;
+}
+
+void renderer_hide_video(void) {
+    video.format = 0;
+    video.window = NULL;
+}
+
+void renderer_set_gamma(int output, int size, const uint16_t *red, const uint16_t *green, const uint16_t *blue) {
+    struct renderer_output *o = &outputs[output];
+    uint8_t ramp[sizeof(o->gamma.ramp)];
+    int i, j, enabled = 0;
+
+    if (size <= 0)
+        return;
+
+    // Ramp is resampled to 256 entries, the same as number of values of 8-bit channel.
+    for (i = 0; i < 256; i++) {
+        j = i * size / 256;
+        ramp[i * 4 + 0] = red[j] >> 8;
+        ramp[i * 4 + 1] = green[j] >> 8;
+        ramp[i * 4 + 2] = blue[j] >> 8;
+        ramp[i * 4 + 3] = 0xFF;
+        enabled |= ramp[i * 4] != i || ramp[i * 4 + 1] != i || ramp[i * 4 + 2] != i;
+    }
+
+    // Identity ramp is not looked up at all.
+    o->gamma.enabled = enabled;
+    if (enabled && memcmp(ramp, o->gamma.ramp, sizeof(ramp)) != 0) {
+        memcpy(o->gamma.ramp, ramp, sizeof(ramp));
+        o->gamma.dirty = 1;
+    }
+}
+
+void renderer_set_lut(int output, int size, const uint32_t *lut) {
+    struct renderer_output *o = &outputs[output];
+    size_t r, g, b, n = (size_t) size * size * size;
+    uint32_t *data = NULL, c;
+
+    if (size && !(data = malloc(n * 4)))
+        return;
+
+    // Entries are 0xRRGGBB indexed by r + g * N + b * N^2, texture is uploaded as RGBA bytes.
+    // Texel of the shader is (r + b * N, g), so the rows of the texture hold green.
+    for (b = 0; b < size; b++)
+        for (g = 0; g < size; g++)
+            for (r = 0; r < size; r++) {
+                c = lut[r + g * size + b * size * size];
+                data[g * size * size + b * size + r] = 0xFF000000 | (c & 0xFF00) | ((c >> 16) & 0xFF) | ((c & 0xFF) << 16);
+            }
+
+    free(o->lut.data);
+    o->lut.data = data;
+    o->lut.size = size;
+    o->lut.dirty = 1;
+}
+
+renderer_window_ptr renderer_window_create(void) {
+    struct renderer_window *w = calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+
+    w->next = windows;
+    windows = w;
+    return w;
+}
+
+void renderer_window_destroy(renderer_window_ptr w) {
+    struct renderer_window **p;
+    int i, j;
+
+    if (!w)
+        return;
+
+    for (i = j = 0; i < stack.count; i++)
+        if (stack.windows[i] != w)
+            stack.windows[j++] = stack.windows[i];
+    stack.count = j;
+    if (scanout == w)
+        scanout = NULL;
+    if (video.window == w) {
+        video.window = NULL;
+        video.format = 0;
+    }
+
+    for (p = &windows; *p != w; p = &(*p)->next);
+    *p = w->next;
+
+    if (w->id && ctx) {
+        $glDeleteTextures(1, &w->id); checkGlError();
+    }
+    free(w);
+}
+
+void renderer_window_upload(renderer_window_ptr w, int width, int height, int stride, const void *data,
+                            const pixman_box16_t *boxes, int n) {
+    pixman_box16_t full = { 0, 0, width, height };
+    int i, y;
+
+    if (!ctx || !width || !height)
+        return;
+
+    $glActiveTexture(GL_TEXTURE0); checkGlError();
+    if (!w->id || w->width != width || w->height != height) {
+        if (!w->id) {
+            $glGenTextures(1, &w->id); checkGlError();
+        }
+        $glBindTexture(GL_TEXTURE_2D, w->id); checkGlError();
+        $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); checkGlError();
+        $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); checkGlError();
+        $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); checkGlError();
+        $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); checkGlError();
+        $glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT, width, height, 0, GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL); checkGlError();
+        w->width = width;
+        w->height = height;
+        boxes = NULL;
+    } else if (boxes && !n)
+        return;
+    else {
+        $glBindTexture(GL_TEXTURE_2D, w->id); checkGlError();
+    }
+
+    if (!boxes) {
+        boxes = &full;
+        n = 1;
+    }
+
+    // GLES2 can not upload a part of a row, partial boxes are packed to scratch buffer first.
+    for (i = 0; i < n; i++) {
+        int x1 = max(boxes[i].x1, 0), y1 = max(boxes[i].y1, 0);
+        int x2 = min(boxes[i].x2, width), y2 = min(boxes[i].y2, height);
+        const uint8_t *src = (const uint8_t*) data + (size_t) y1 * stride + x1 * 4;
+        size_t size = (size_t) (x2 - x1) * (y2 - y1) * 4;
+
+        if (x1 >= x2 || y1 >= y2)
+            continue;
+
+        if ((x2 - x1) * 4 != stride) {
+            if (size > scratchSize) {
+                uint8_t *buf = realloc(scratch, size);
+                if (!buf)
+                    continue;
+                scratch = buf;
+                scratchSize = size;
+            }
+            for (y = y1; y < y2; y++)
+                memcpy(scratch + (size_t) (y - y1) * (x2 - x1) * 4, src + (size_t) (y - y1) * stride, (x2 - x1) * 4);
+            src = scratch;
+        }
+
+        $glTexSubImage2D(GL_TEXTURE_2D, 0, x1, y1, x2 - x1, y2 - y1, GL_BGRA_EXT, GL_UNSIGNED_BYTE, src); checkGlError();
+    }
+}
+
+void renderer_window_place(renderer_window_ptr w, int x, int y, int argb, int shadow) {
+    w->x = (float) x;
+    w->y = (float) y;
+    w->argb = argb;
+    w->shadow = shadow;
+}
+
+void renderer_set_windows(renderer_window_ptr *list, int count) {
+    if (count > stack.size) {
+        renderer_window_ptr *p = realloc(stack.windows, count * sizeof(*p));
+        if (!p)
+            return;
+        stack.windows = p;
+        stack.size = count;
+    }
+
+    memcpy(stack.windows, list, count * sizeof(*list));
+    stack.count = count;
+}
+
+void renderer_set_scanout(renderer_window_ptr w) {
+    scanout = w;
+}
+
+static void upload_color_tables(struct renderer_output *o) {
+    if (o->gamma.enabled && (o->gamma.dirty || !o->gamma.id)) {
+        $glActiveTexture(GL_TEXTURE0 + GAMMA_UNIT); checkGlError();
+        if (!o->gamma.id) {
+            $glGenTextures(1, &o->gamma.id); checkGlError();
+            $glBindTexture(GL_TEXTURE_2D, o->gamma.id); checkGlError();
+            $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); checkGlError();
+            $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); checkGlError();
+            $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); checkGlError();
+            $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); checkGlError();
+            $glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, o->gamma.ramp); checkGlError();
+        } else {
+            // Animated gamma (i.e. redshift transitions) costs one 1 KiB update per frame.
+            $glBindTexture(GL_TEXTURE_2D, o->gamma.id); checkGlError();
+            $glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE, o->gamma.ramp); checkGlError();
+        }
+        o->gamma.dirty = 0;
+    }
+
+    if (o->lut.dirty) {
+        $glActiveTexture(GL_TEXTURE0 + LUT_UNIT); checkGlError();
+        if (o->lut.id) {
+            $glDeleteTextures(1, &o->lut.id); checkGlError();
+            o->lut.id = 0;
+        }
+        if (o->lut.size) {
+            $glGenTextures(1, &o->lut.id); checkGlError();
+            $glBindTexture(GL_TEXTURE_2D, o->lut.id); checkGlError();
+            $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); checkGlError();
+            $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); checkGlError();
+            $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); checkGlError();
+            $glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); checkGlError();
+            $glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, o->lut.size * o->lut.size, o->lut.size, 0,
+                          GL_RGBA, GL_UNSIGNED_BYTE, o->lut.data); checkGlError();
+        }
+        o->lut.dirty = 0;
+    }
+
+    $glActiveTexture(GL_TEXTURE0 + GAMMA_UNIT); checkGlError();
+    $glBindTexture(GL_TEXTURE_2D, o->gamma.enabled ? o->gamma.id : 0); checkGlError();
+    $glActiveTexture(GL_TEXTURE0 + LUT_UNIT); checkGlError();
+    $glBindTexture(GL_TEXTURE_2D, o->lut.id); checkGlError();
+    $glActiveTexture(GL_TEXTURE0); checkGlError();
+}
+
+/*
+ * Releases context, textures, shader program and EGLImage while there is no window.
+ * They are recreated by the next renderer_set_window call. Returns approximate
+ * amount of texture memory released, memory of driver's context is not accounted.
+ */
+size_t renderer_trim(void) {
+    struct renderer_window *w;
+    size_t released;
+    int i;
+
+    if (!ctx)
+        return 0;
+    for (i = 0; i < RENDERER_MAX_OUTPUTS; i++)
+        if (outputs[i].win)
+            return 0;
+
+    released = (size_t) cursor.width * (size_t) cursor.height * 4;
+    for (i = 0; i < RENDERER_MAX_OUTPUTS; i++) {
+        if (outputs[i].image)
+            $eglDestroyImageKHR(egl_display, outputs[i].image);
+        outputs[i].image = NULL;
+        outputs[i].buffer = NULL;
+        $glDeleteTextures(1, &outputs[i].id); checkGlError();
+        outputs[i].id = 0;
+
+        // Tables are kept, they are uploaded again when context is recreated.
+        if (outputs[i].gamma.id) {
+            $glDeleteTextures(1, &outputs[i].gamma.id); checkGlError();
+        }
+        if (outputs[i].lut.id) {
+            released += (size_t) outputs[i].lut.size * outputs[i].lut.size * outputs[i].lut.size * 4;
+            $glDeleteTextures(1, &outputs[i].lut.id); checkGlError();
+        }
+        outputs[i].gamma.id = outputs[i].lut.id = 0;
+        outputs[i].gamma.dirty = outputs[i].lut.dirty = 1;
+    }
+
+    if (video.planes[0]) {
+        released += (size_t) video.width * (size_t) video.height * 2;
+        $glDeleteTextures(3, video.planes); checkGlError();
+    }
+    memset(video.planes, 0, sizeof(video.planes));
+    memset(video.planeWidth, 0, sizeof(video.planeWidth));
+    memset(video.planeHeight, 0, sizeof(video.planeHeight));
+    video.uploaded = 0;
+
+    $glDeleteTextures(1, &cursor.id); checkGlError();
+    $glDeleteProgram(g_texture_program); checkGlError();
+    $glDeleteProgram(g_video_program); checkGlError();
+    $glDeleteProgram(g_shadow_program); checkGlError();
+    cursor.id = g_texture_program = g_video_program = g_shadow_program = 0;
+
+    // Window textures are uploaded again as a whole by the next renderer_window_upload.
+    for (w = windows; w; w = w->next) {
+        if (w->id) {
+            released += (size_t) w->width * (size_t) w->height * 4;
+            $glDeleteTextures(1, &w->id); checkGlError();
+        }
+        w->id = 0;
+    }
+    free(scratch);
+    scratch = NULL;
+    scratchSize = 0;
+
+    $eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    $eglDestroyContext(egl_display, ctx); eglCheckError(__LINE__);
+    ctx = EGL_NO_CONTEXT;
+
+    log("Xlorie: renderer trimmed\n");
+    return released;
+}
+
+static void draw(struct renderer_output *o, GLuint id, float x0, float y0, float x1, float y1, float s, float t, float opaque);
+static void draw_cursor(struct renderer_output *o);
+static void draw_video(struct renderer_output *o, struct renderer_window *w);
+static void draw_windows(struct renderer_output *o);
 
 float ia = 0;
 
-void renderer_redraw(void) {
-    if (!sfc)
+void renderer_redraw(int output) {
+    struct renderer_output *o = &outputs[output];
+    if (!o->sfc || !o->image)
         return;
 
-    draw(display.id,  -1.f, -1.f, 1.f, 1.f);
-    draw_cursor();
-    $eglSwapBuffers(egl_display, sfc); checkGlError();
+    // Every output has its own surface, they share context and cursor texture.
+    $eglMakeCurrent(egl_display, o->sfc, o->sfc, ctx);
+    $glViewport(0, 0, ANativeWindow_getWidth(o->win), ANativeWindow_getHeight(o->win)); checkGlError();
+    upload_color_tables(o);
+    // Scanout texture starts at the screen origin and has the size of the screen, not the size of root buffer.
+    if (scanout && scanout->id)
+        draw(o, scanout->id, -2.f * o->x / o->width - 1.f, -2.f * o->y / o->height - 1.f,
+             2.f * ((float) scanout->width - o->x) / o->width - 1.f,
+             2.f * ((float) scanout->height - o->y) / o->height - 1.f, 1.f, 1.f, 1.f);
+    else
+        draw(o, o->id,  -1.f, -1.f, 1.f, 1.f, o->s, o->t, 1.f);
+    draw_windows(o);
+    if (!video.window)
+        draw_video(o, NULL);
+    draw_cursor(o);
+    $eglSwapBuffers(egl_display, o->sfc); checkGlError();
 }
 
 static GLuint load_shader(GLenum shaderType, const char* pSource) {
@@ -454,16 +1064,19 @@ static GLuint create_program(const char* p_vertex_source, const char* p_fragment
     return program;
 }
 
-static void draw(GLuint id, float x0, float y0, float x1, float y1) {
+static void draw(struct renderer_output *o, GLuint id, float x0, float y0, float x1, float y1, float s, float t, float opaque) {
     float coords[20] = {
         x0, -y0, 0.f, 0.f, 0.f,
-        x1, -y0, 0.f, 1.f, 0.f,
-        x0, -y1, 0.f, 0.f, 1.f,
-        x1, -y1, 0.f, 1.f, 1.f,
+        x1, -y0, 0.f, s, 0.f,
+        x0, -y1, 0.f, 0.f, t,
+        x1, -y1, 0.f, s, t,
     };
 
     $glActiveTexture(GL_TEXTURE0); checkGlError();
     $glUseProgram(g_texture_program); checkGlError();
+    $glUniform1f(gu_gamma_enabled, o->gamma.enabled ? 1.f : 0.f); checkGlError();
+    $glUniform1f(gu_lut_size, o->lut.id ? (float) o->lut.size : 0.f); checkGlError();
+    $glUniform1f(gu_opaque, opaque); checkGlError();
     $glBindTexture(GL_TEXTURE_2D, id); checkGlError();
 
     $glVertexAttribPointer(gv_pos, 3, GL_FLOAT, GL_FALSE, 20, coords); checkGlError();
@@ -473,15 +1086,157 @@ static void draw(GLuint id, float x0, float y0, float x1, float y1) {
     $glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); checkGlError();
 }
 
-maybe_unused static void draw_cursor(void) {
+maybe_unused static void draw_cursor(struct renderer_output *o) {
     float x, y, w, h;
-    x = 2.f * (cursor.x - cursor.xhot) / display.width - 1.f;
-    y = 2.f * (cursor.y - cursor.yhot) / display.height - 1.f;
-    w = 2.f * cursor.width / display.width;
-    h = 2.f * cursor.height / display.height;
+    x = 2.f * (cursor.x - cursor.xhot - o->x) / o->width - 1.f;
+    y = 2.f * (cursor.y - cursor.yhot - o->y) / o->height - 1.f;
+    w = 2.f * cursor.width / o->width;
+    h = 2.f * cursor.height / o->height;
     $glEnable(GL_BLEND); checkGlError();
     $glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); checkGlError();
-    draw(cursor.id, x, y, x + w, y + h);
+    draw(o, cursor.id, x, y, x + w, y + h, 1.f, 1.f, 0.f);
     $glDisable(GL_BLEND); checkGlError();
 }
 
+/*
+ * Video is clipped to the texture which holds colorkey: composited window `w`, flipped pixmap or root buffer.
+ * Key texture covers kx, ky, kw, kh of the screen and ks, kt of the texture is used.
+ */
+static void draw_video(struct renderer_output *o, struct renderer_window *w) {
+    float kx, ky, kw, kh, ks = 1.f, kt = 1.f, x0, y0, x1, y1;
+    int layout = video.format == RENDERER_VIDEO_NV12 ? 2 : video.format == RENDERER_VIDEO_YUY2 ? 3 : 1;
+    GLuint key;
+    int i;
+
+    if (!video.format || !video.uploaded || !g_video_program)
+        return;
+
+    if (w) {
+        key = w->id;
+        kx = w->x;
+        ky = w->y;
+        kw = (float) w->width;
+        kh = (float) w->height;
+    } else if (scanout && scanout->id) {
+        // Colorkey is painted to the flipped pixmap in this case.
+        key = scanout->id;
+        kx = ky = 0.f;
+        kw = (float) scanout->width;
+        kh = (float) scanout->height;
+    } else {
+        key = o->id;
+        kx = o->x;
+        ky = o->y;
+        kw = o->width;
+        kh = o->height;
+        ks = o->s;
+        kt = o->t;
+    }
+
+    x0 = max(video.x, kx);
+    y0 = max(video.y, ky);
+    x1 = min(video.x + video.w, kx + kw);
+    y1 = min(video.y + video.h, ky + kh);
+    if (!key || x0 >= x1 || y0 >= y1 || x1 <= o->x || y1 <= o->y || x0 >= o->x + o->width || y0 >= o->y + o->height)
+        return;
+
+    {
+#define KEY_S(x) (((x) - kx) / kw * ks)
+#define KEY_T(y) (((y) - ky) / kh * kt)
+#define VIDEO_S(x) (video.s0 + ((x) - video.x) / video.w * (video.s1 - video.s0))
+#define VIDEO_T(y) (video.t0 + ((y) - video.y) / video.h * (video.t1 - video.t0))
+#define OUT_X(x) (2.f * ((x) - o->x) / o->width - 1.f)
+#define OUT_Y(y) (1.f - 2.f * ((y) - o->y) / o->height)
+        float coords[24] = {
+            OUT_X(x0), OUT_Y(y0), KEY_S(x0), KEY_T(y0), VIDEO_S(x0), VIDEO_T(y0),
+            OUT_X(x1), OUT_Y(y0), KEY_S(x1), KEY_T(y0), VIDEO_S(x1), VIDEO_T(y0),
+            OUT_X(x0), OUT_Y(y1), KEY_S(x0), KEY_T(y1), VIDEO_S(x0), VIDEO_T(y1),
+            OUT_X(x1), OUT_Y(y1), KEY_S(x1), KEY_T(y1), VIDEO_S(x1), VIDEO_T(y1),
+        };
+#undef KEY_S
+#undef KEY_T
+#undef VIDEO_S
+#undef VIDEO_T
+#undef OUT_X
+#undef OUT_Y
+
+        $glUseProgram(g_video_program); checkGlError();
+        $glUniform1i(gu_layout, layout); checkGlError();
+        $glUniform1f(gu_width, (float) video.width); checkGlError();
+        $glUniform3f(gu_key, video.key[0], video.key[1], video.key[2]); checkGlError();
+        $glUniform1f(gu_video_gamma_enabled, o->gamma.enabled ? 1.f : 0.f); checkGlError();
+        $glUniform1f(gu_video_lut_size, o->lut.id ? (float) o->lut.size : 0.f); checkGlError();
+
+        $glActiveTexture(GL_TEXTURE0); checkGlError();
+        $glBindTexture(GL_TEXTURE_2D, key); checkGlError();
+        for (i = 0; i < 3; i++) {
+            $glActiveTexture(GL_TEXTURE1 + i); checkGlError();
+            $glBindTexture(GL_TEXTURE_2D, video.planes[i]); checkGlError();
+        }
+        $glActiveTexture(GL_TEXTURE0); checkGlError();
+
+        $glVertexAttribPointer(gv_video_pos, 2, GL_FLOAT, GL_FALSE, 24, coords); checkGlError();
+        $glVertexAttribPointer(gv_root_coords, 2, GL_FLOAT, GL_FALSE, 24, &coords[2]); checkGlError();
+        $glVertexAttribPointer(gv_video_coords, 2, GL_FLOAT, GL_FALSE, 24, &coords[4]); checkGlError();
+        $glEnableVertexAttribArray(gv_video_pos); checkGlError();
+        $glEnableVertexAttribArray(gv_root_coords); checkGlError();
+        $glEnableVertexAttribArray(gv_video_coords); checkGlError();
+        $glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); checkGlError();
+
+        // Arrays of another program should not stay enabled with pointers to this stack frame.
+        $glDisableVertexAttribArray(gv_video_pos); checkGlError();
+        $glDisableVertexAttribArray(gv_root_coords); checkGlError();
+        $glDisableVertexAttribArray(gv_video_coords); checkGlError();
+    }
+}
+
+static void draw_shadow(struct renderer_output *o, struct renderer_window *w) {
+    float r = SHADOW_RADIUS, dy = SHADOW_RADIUS / 2.f;
+    float x0 = 2.f * (w->x - r - o->x) / o->width - 1.f;
+    float y0 = 2.f * (w->y - r + dy - o->y) / o->height - 1.f;
+    float x1 = 2.f * (w->x + (float) w->width + r - o->x) / o->width - 1.f;
+    float y1 = 2.f * (w->y + (float) w->height + r + dy - o->y) / o->height - 1.f;
+    float coords[16] = {
+        x0, -y0, -r, -r,
+        x1, -y0, (float) w->width + r, -r,
+        x0, -y1, -r, (float) w->height + r,
+        x1, -y1, (float) w->width + r, (float) w->height + r,
+    };
+
+    $glUseProgram(g_shadow_program); checkGlError();
+    $glUniform2f(gu_shadow_size, (float) w->width, (float) w->height); checkGlError();
+    $glUniform1f(gu_shadow_radius, r); checkGlError();
+    $glVertexAttribPointer(gv_shadow_pos, 2, GL_FLOAT, GL_FALSE, 16, coords); checkGlError();
+    $glVertexAttribPointer(gv_shadow_local, 2, GL_FLOAT, GL_FALSE, 16, &coords[2]); checkGlError();
+    $glEnableVertexAttribArray(gv_shadow_pos); checkGlError();
+    $glEnableVertexAttribArray(gv_shadow_local); checkGlError();
+    $glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); checkGlError();
+    $glDisableVertexAttribArray(gv_shadow_pos); checkGlError();
+    $glDisableVertexAttribArray(gv_shadow_local); checkGlError();
+}
+
+static void draw_windows(struct renderer_output *o) {
+    int i;
+
+    // Window pixmaps of ARGB visuals contain premultiplied alpha, other pixmaps have undefined alpha.
+    $glEnable(GL_BLEND); checkGlError();
+    $glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); checkGlError();
+    for (i = 0; i < stack.count; i++) {
+        struct renderer_window *w = stack.windows[i];
+        float x0 = 2.f * (w->x - o->x) / o->width - 1.f;
+        float y0 = 2.f * (w->y - o->y) / o->height - 1.f;
+        float x1 = 2.f * (w->x + (float) w->width - o->x) / o->width - 1.f;
+        float y1 = 2.f * (w->y + (float) w->height - o->y) / o->height - 1.f;
+
+        if (!w->id || x1 <= -1.f || y1 <= -1.f || x0 >= 1.f || y0 >= 1.f)
+            continue;
+
+        if (w->shadow && g_shadow_program)
+            draw_shadow(o, w);
+        draw(o, w->id, x0, y0, x1, y1, 1.f, 1.f, w->argb ? 0.f : 1.f);
+        // Windows above the video window cover the video.
+        if (w == video.window)
+            draw_video(o, w);
+    }
+    $glDisable(GL_BLEND); checkGlError();
+}
@@ -19,16 +19,52 @@ typedef void (*renderer_message_func_type) (int type, int verb, const char *form
 
 maybe_unused void renderer_message_func(renderer_message_func_type function);
 
+// Output 0 is the activity's surface, others are external displays.
+#define RENDERER_MAX_OUTPUTS 4
+
 maybe_unused int renderer_init(void);
-maybe_unused void renderer_set_buffer(AHardwareBuffer* buffer);
-maybe_unused void renderer_set_window(EGLNativeWindowType native_window);
+// Buffer contains the part of the screen starting at x, y which is shown by the output.
+maybe_unused void renderer_set_buffer(int output, AHardwareBuffer* buffer, int x, int y, int width, int height);
+maybe_unused void renderer_set_window(int output, EGLNativeWindowType native_window);
 maybe_unused void renderer_upload(int w, int h, void* data);
 maybe_unused void renderer_update_rects(int width, int height, pixman_box16_t *rects, int amount, void* data);
-maybe_unused void renderer_redraw(void);
+maybe_unused void renderer_redraw(int output);
+maybe_unused size_t renderer_trim(void);
 
 maybe_unused void renderer_update_cursor(int w, int h, int xhot, int yhot, void* data);
 maybe_unused void renderer_set_cursor_coordinates(int x, int y);
 
+typedef struct renderer_window *renderer_window_ptr;
+
+// Planar YUV image is converted to RGB while drawing. It is shown at x, y of the screen wherever
+// the screen contains `key` color, clipping is done by painting colorkey to the visible part of the window.
+// If `window` is set, colorkey is looked up in that composited window and video is drawn right above it,
+// clipped to the window.
+#define RENDERER_VIDEO_I420 1
+#define RENDERER_VIDEO_YV12 2
+#define RENDERER_VIDEO_NV12 3
+#define RENDERER_VIDEO_YUY2 4
+maybe_unused void renderer_set_video(int format, int width, int height, const uint8_t *data, int sx, int sy, int sw, int sh,
+                                     int x, int y, int w, int h, uint32_t key, renderer_window_ptr window);
+maybe_unused void renderer_hide_video(void);
+
+// Color correction of the output. Ramps have `size` 16-bit entries per channel.
+// LUT is a cube of size^3 0xRRGGBB entries with red changing fastest, size 0 disables it.
+maybe_unused void renderer_set_gamma(int output, int size, const uint16_t *red, const uint16_t *green, const uint16_t *blue);
+maybe_unused void renderer_set_lut(int output, int size, const uint32_t *lut);
+
+// Textures of composited top-level windows. Upload copies damaged boxes of 32bpp pixmap, whole pixmap
+// is uploaded if `boxes` is NULL or if texture was resized or lost when renderer was trimmed.
+maybe_unused renderer_window_ptr renderer_window_create(void);
+maybe_unused void renderer_window_destroy(renderer_window_ptr window);
+maybe_unused void renderer_window_upload(renderer_window_ptr window, int width, int height, int stride, const void *data,
+                                         const pixman_box16_t *boxes, int n);
+maybe_unused void renderer_window_place(renderer_window_ptr window, int x, int y, int argb, int shadow);
+// Windows are drawn over the root buffer in the order of the list, bottom to top.
+maybe_unused void renderer_set_windows(renderer_window_ptr *windows, int count);
+// Full-screen window which is shown instead of the root buffer (i.e. flipped Present pixmap), NULL shows root again.
+maybe_unused void renderer_set_scanout(renderer_window_ptr window);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,401 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <android/log.h>
+#include "scrnintstr.h"
+#include "pixmapstr.h"
+#include "gcstruct.h"
+#include "privates.h"
+#include "picturestr.h"
+#include "damage.h"
+#include "list.h"
+#include "lorie.h"
+
+/*
+ * Large pixmaps which were not accessed for some time are compressed and their pages are given back to
+ * the system. fb accesses pixmap memory directly (prepare/finish access hooks exist only in wfb, which
+ * makes every pixel access an indirect call), so pixmaps are decompressed by the layers above it:
+ * damage reports drawing before it is done, SourceValidate, GetImage and GetSpans report reading and
+ * validation of GCs and pictures reports tiles, stipples and picture sources. Code which hands pixmap
+ * memory to something else (GL, Present flips) calls lorieResidencyAccess first.
+ *
+ * Only pixmaps which are referenced by their resource alone are compressed, pixmaps used by GCs, pictures,
+ * windows or Present are never taken away from the code holding them. Everything is done on main thread,
+ * drawing threads only run while main thread waits for them, after the pixmaps were made resident.
+ */
+
+#define log(...) __android_log_print(ANDROID_LOG_DEBUG, "LorieResidency", __VA_ARGS__)
+
+// Runs of equal pixels are stored as a header with high bit set followed by the pixel,
+// other pixels are stored as a header with number of literals followed by literals themselves.
+#define RLE_RUN 0x80000000U
+
+// Pixmap must stay untouched for idle time and for at least that many scans in a row.
+#define COLD_SCANS 2
+
+enum { RESIDENT, COMPRESSED };
+
+struct lorieResidency {
+    struct xorg_list entry;
+    PixmapPtr pPixmap;
+    DamagePtr pDamage;
+    uint32_t *data;
+    size_t size;
+    uint32_t *compressed;
+    size_t compressedSize; // in 32-bit words
+    CARD32 idleSince;
+    int coldScans;
+    Bool accessed;
+    int state;
+};
+
+static struct xorg_list tracked;
+static OsTimerPtr scanTimer;
+static CARD32 idleTime;
+static DevPrivateKeyRec lorieResidencyPixmapKey, lorieResidencyGCKey;
+
+static struct {
+    SourceValidateProcPtr sourceValidate;
+    GetImageProcPtr getImage;
+    GetSpansProcPtr getSpans;
+    CreateGCProcPtr createGC;
+    PictureScreenPtr ps;
+    ValidatePictureProcPtr validatePicture;
+} wrapped;
+
+static struct {
+    unsigned long misses, compressions, rejected;
+    size_t saved;
+} stats;
+
+#define lorieResidencyPixmapPriv(p) ((lorieResidencyPtr*) dixLookupPrivate(&(p)->devPrivates, &lorieResidencyPixmapKey))
+#define lorieResidencyGCPriv(g) ((const GCFuncs**) dixLookupPrivate(&(g)->devPrivates, &lorieResidencyGCKey))
+
+void lorieResidencyLogStats(void) {
+    if (idleTime)
+        log("misses %lu, compressions %lu, incompressible %lu, %zu KiB saved",
+            stats.misses, stats.compressions, stats.rejected, stats.saved >> 10);
+}
+
+// Returns number of words written or 0 if the result does not fit to `max` words.
+static size_t lorieRleCompress(const uint32_t *src, size_t n, uint32_t *dst, size_t max) {
+    size_t i = 0, o = 0, start, run;
+
+    while (i < n) {
+        for (run = 1; i + run < n && src[i + run] == src[i]; run++);
+        if (run >= 3) {
+            if (o + 2 > max)
+                return 0;
+            dst[o++] = RLE_RUN | run;
+            dst[o++] = src[i];
+            i += run;
+            continue;
+        }
+
+        // Literals last until the next run of at least 3 pixels.
+        start = i;
+        do
+            i++;
+        while (i < n && !(i + 2 < n && src[i] == src[i + 1] && src[i] == src[i + 2]));
+
+        if (o + 1 + (i - start) > max)
+            return 0;
+        dst[o++] = i - start;
+        memcpy(&dst[o], &src[start], (i - start) * 4);
+        o += i - start;
+    }
+
+    return o;
+}
+
+static void lorieRleDecompress(const uint32_t *src, uint32_t *dst, size_t n) {
+    size_t o = 0;
+
+    while (o < n) {
+        uint32_t header = *src++, count = header & ~RLE_RUN;
+        if (header & RLE_RUN) {
+            uint32_t pixel = *src++;
+            while (count--)
+                dst[o++] = pixel;
+        } else {
+            memcpy(&dst[o], src, count * 4);
+            src += count;
+            o += count;
+        }
+    }
+}
+
+static void lorieResidencyUse(lorieResidencyPtr res) {
+    res->accessed = TRUE;
+    if (res->state != COMPRESSED)
+        return;
+
+    // Pages were dropped with MADV_DONTNEED, they come back zeroed.
+    lorieRleDecompress(res->compressed, res->data, res->size / 4);
+    stats.saved -= res->size - res->compressedSize * 4;
+    stats.misses++;
+    free(res->compressed);
+    res->compressed = NULL;
+    res->state = RESIDENT;
+}
+
+void lorieResidencyAccess(PixmapPtr pPixmap) {
+    lorieResidencyPtr res;
+    if (idleTime && pPixmap && (res = *lorieResidencyPixmapPriv(pPixmap)))
+        lorieResidencyUse(res);
+}
+
+// Windows are drawn to the screen pixmap or to backing pixmaps, neither of them is tracked.
+static void lorieResidencyAccessDrawable(DrawablePtr pDrawable) {
+    if (pDrawable && pDrawable->type == DRAWABLE_PIXMAP)
+        lorieResidencyAccess((PixmapPtr) pDrawable);
+}
+
+// Reported by damage before the drawing is done.
+static void lorieResidencyDamage(unused DamagePtr pDamage, unused RegionPtr pRegion, void *closure) {
+    lorieResidencyUse(closure);
+}
+
+static void lorieResidencyDamageDestroy(unused DamagePtr pDamage, void *closure) {
+    ((lorieResidencyPtr) closure)->pDamage = NULL;
+}
+
+static void lorieResidencyCompress(lorieResidencyPtr res, CARD32 now) {
+    // Compression which does not save at least half of memory is not worth decompressing later.
+    size_t n = res->size / 4, max = n / 2;
+    uint32_t *buf = malloc(max * 4);
+
+    if (!buf)
+        return;
+
+    res->compressedSize = lorieRleCompress(res->data, n, buf, max);
+    if (!res->compressedSize) {
+        // Contents can not change without access, so do not try again until the next idle period.
+        res->idleSince = now;
+        res->coldScans = 0;
+        stats.rejected++;
+        free(buf);
+        return;
+    }
+
+    res->compressed = realloc(buf, res->compressedSize * 4) ?: buf;
+    madvise(res->data, res->size, MADV_DONTNEED);
+    res->state = COMPRESSED;
+    stats.saved += res->size - res->compressedSize * 4;
+    stats.compressions++;
+}
+
+static CARD32 lorieResidencyScan(unused OsTimerPtr timer, CARD32 now, unused void *arg) {
+    lorieResidencyPtr res;
+    unsigned long compressions = stats.compressions;
+
+    xorg_list_for_each_entry(res, &tracked, entry) {
+        // Short-living pixmaps are gone before the first scan, only the rest are watched by damage.
+        if (!res->pDamage && (res->pDamage = DamageCreate(lorieResidencyDamage, lorieResidencyDamageDestroy,
+                                                          DamageReportRawRegion, TRUE, res->pPixmap->drawable.pScreen, res)))
+            DamageRegister(&res->pPixmap->drawable, res->pDamage);
+
+        if (res->accessed || !res->pDamage) {
+            res->accessed = FALSE;
+            res->idleSince = now;
+            res->coldScans = 0;
+        } else if (res->state == RESIDENT && ++res->coldScans >= COLD_SCANS && now - res->idleSince >= idleTime
+                   && res->pPixmap->refcnt == 1)
+            lorieResidencyCompress(res, now);
+    }
+
+    if (compressions != stats.compressions)
+        lorieResidencyLogStats();
+
+    return max(idleTime / 4, 1000);
+}
+
+// Backing pixmaps of windows are uploaded by compositor, they are never compressed.
+lorieResidencyPtr lorieResidencyTrack(PixmapPtr pPixmap, void *data, size_t size) {
+    lorieResidencyPtr res;
+
+    if (!idleTime || pPixmap->usage_hint == CREATE_PIXMAP_USAGE_BACKING_PIXMAP || !(res = calloc(1, sizeof(*res))))
+        return NULL;
+
+    res->pPixmap = pPixmap;
+    res->data = data;
+    res->size = size;
+    res->idleSince = GetTimeInMillis();
+    res->accessed = TRUE;
+    res->state = RESIDENT;
+    xorg_list_append(&res->entry, &tracked);
+    *lorieResidencyPixmapPriv(pPixmap) = res;
+    return res;
+}
+
+// Damage layer may have destroyed the damage together with the pixmap already.
+void lorieResidencyUntrack(lorieResidencyPtr res) {
+    if (!res)
+        return;
+
+    xorg_list_del(&res->entry);
+    if (res->pDamage)
+        DamageDestroy(res->pDamage);
+    if (res->state == COMPRESSED)
+        stats.saved -= res->size - res->compressedSize * 4;
+    free(res->compressed);
+    free(res);
+}
+
+static void lorieResidencySourceValidate(DrawablePtr pDrawable, int x, int y, int width, int height,
+                                         unsigned int subWindowMode) {
+    ScreenPtr pScreen = pDrawable->pScreen;
+
+    lorieResidencyAccessDrawable(pDrawable);
+    if (wrapped.sourceValidate) {
+        pScreen->SourceValidate = wrapped.sourceValidate;
+        pScreen->SourceValidate(pDrawable, x, y, width, height, subWindowMode);
+        pScreen->SourceValidate = lorieResidencySourceValidate;
+    }
+}
+
+static void lorieResidencyGetImage(DrawablePtr pDrawable, int x, int y, int w, int h, unsigned int format,
+                                   unsigned long planeMask, char *pImage) {
+    ScreenPtr pScreen = pDrawable->pScreen;
+
+    lorieResidencyAccessDrawable(pDrawable);
+    pScreen->GetImage = wrapped.getImage;
+    pScreen->GetImage(pDrawable, x, y, w, h, format, planeMask, pImage);
+    pScreen->GetImage = lorieResidencyGetImage;
+}
+
+static void lorieResidencyGetSpans(DrawablePtr pDrawable, int wMax, DDXPointPtr ppt, int *pwidth, int nspans,
+                                   char *pdstStart) {
+    ScreenPtr pScreen = pDrawable->pScreen;
+
+    lorieResidencyAccessDrawable(pDrawable);
+    pScreen->GetSpans = wrapped.getSpans;
+    pScreen->GetSpans(pDrawable, wMax, ppt, pwidth, nspans, pdstStart);
+    pScreen->GetSpans = lorieResidencyGetSpans;
+}
+
+/*
+ * GC is validated before it is used with changed tile or stipple, fb reads them while validating.
+ * They stay referenced by GC afterwards, so they are not compressed until GC releases them.
+ */
+static void lorieResidencyValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable);
+static void lorieResidencyChangeGC(GCPtr pGC, unsigned long mask);
+static void lorieResidencyCopyGC(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst);
+static void lorieResidencyDestroyGC(GCPtr pGC);
+static void lorieResidencyChangeClip(GCPtr pGC, int type, void *pvalue, int nrects);
+static void lorieResidencyDestroyClip(GCPtr pGC);
+static void lorieResidencyCopyClip(GCPtr pgcDst, GCPtr pgcSrc);
+
+static const GCFuncs lorieResidencyGCFuncs = {
+    lorieResidencyValidateGC, lorieResidencyChangeGC, lorieResidencyCopyGC, lorieResidencyDestroyGC,
+    lorieResidencyChangeClip, lorieResidencyDestroyClip, lorieResidencyCopyClip,
+};
+
+#define GC_UNWRAP(pGC) (pGC)->funcs = *lorieResidencyGCPriv(pGC)
+#define GC_WRAP(pGC) do { *lorieResidencyGCPriv(pGC) = (pGC)->funcs; (pGC)->funcs = &lorieResidencyGCFuncs; } while (0)
+
+static void lorieResidencyValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable) {
+    if (!pGC->tileIsPixel)
+        lorieResidencyAccess(pGC->tile.pixmap);
+    lorieResidencyAccess(pGC->stipple);
+
+    GC_UNWRAP(pGC);
+    pGC->funcs->ValidateGC(pGC, changes, pDrawable);
+    GC_WRAP(pGC);
+}
+
+static void lorieResidencyChangeGC(GCPtr pGC, unsigned long mask) {
+    GC_UNWRAP(pGC);
+    pGC->funcs->ChangeGC(pGC, mask);
+    GC_WRAP(pGC);
+}
+
+static void lorieResidencyCopyGC(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst) {
+    GC_UNWRAP(pGCDst);
+    pGCDst->funcs->CopyGC(pGCSrc, mask, pGCDst);
+    GC_WRAP(pGCDst);
+}
+
+static void lorieResidencyDestroyGC(GCPtr pGC) {
+    GC_UNWRAP(pGC);
+    pGC->funcs->DestroyGC(pGC);
+    GC_WRAP(pGC);
+}
+
+static void lorieResidencyChangeClip(GCPtr pGC, int type, void *pvalue, int nrects) {
+    GC_UNWRAP(pGC);
+    pGC->funcs->ChangeClip(pGC, type, pvalue, nrects);
+    GC_WRAP(pGC);
+}
+
+static void lorieResidencyDestroyClip(GCPtr pGC) {
+    GC_UNWRAP(pGC);
+    pGC->funcs->DestroyClip(pGC);
+    GC_WRAP(pGC);
+}
+
+static void lorieResidencyCopyClip(GCPtr pgcDst, GCPtr pgcSrc) {
+    GC_UNWRAP(pgcDst);
+    pgcDst->funcs->CopyClip(pgcDst, pgcSrc);
+    GC_WRAP(pgcDst);
+}
+
+static Bool lorieResidencyCreateGC(GCPtr pGC) {
+    ScreenPtr pScreen = pGC->pScreen;
+    Bool ret;
+
+    pScreen->CreateGC = wrapped.createGC;
+    ret = pScreen->CreateGC(pGC);
+    pScreen->CreateGC = lorieResidencyCreateGC;
+
+    if (ret)
+        GC_WRAP(pGC);
+    return ret;
+}
+
+// Every Render operation validates its pictures first, new pictures are always validated at the first use.
+static void lorieResidencyValidatePicture(PicturePtr pPicture, Mask mask) {
+    PictureScreenPtr ps = wrapped.ps;
+
+    lorieResidencyAccessDrawable(pPicture->pDrawable);
+    if (pPicture->alphaMap)
+        lorieResidencyAccessDrawable(pPicture->alphaMap->pDrawable);
+
+    ps->ValidatePicture = wrapped.validatePicture;
+    ps->ValidatePicture(pPicture, mask);
+    ps->ValidatePicture = lorieResidencyValidatePicture;
+}
+
+Bool lorieResidencyInit(ScreenPtr pScreen, int idleSeconds) {
+    PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
+
+    if (idleSeconds <= 0)
+        return TRUE;
+
+    if (!dixRegisterPrivateKey(&lorieResidencyPixmapKey, PRIVATE_PIXMAP, sizeof(lorieResidencyPtr))
+            || !dixRegisterPrivateKey(&lorieResidencyGCKey, PRIVATE_GC, sizeof(GCFuncs*)))
+        return FALSE;
+
+    xorg_list_init(&tracked);
+    wrapped.sourceValidate = pScreen->SourceValidate;
+    pScreen->SourceValidate = lorieResidencySourceValidate;
+    wrapped.getImage = pScreen->GetImage;
+    pScreen->GetImage = lorieResidencyGetImage;
+    wrapped.getSpans = pScreen->GetSpans;
+    pScreen->GetSpans = lorieResidencyGetSpans;
+    wrapped.createGC = pScreen->CreateGC;
+    pScreen->CreateGC = lorieResidencyCreateGC;
+    if ((wrapped.ps = ps)) {
+        wrapped.validatePicture = ps->ValidatePicture;
+        ps->ValidatePicture = lorieResidencyValidatePicture;
+    }
+
+    idleTime = idleSeconds * 1000;
+    scanTimer = TimerSet(scanTimer, 0, max(idleTime / 4, 1000), lorieResidencyScan, NULL);
+    return TRUE;
+}
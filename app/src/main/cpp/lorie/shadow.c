@@ -0,0 +1,29 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <string.h>
+#include "scrnintstr.h"
+#include "lorie.h"
+
+/*
+ * Copies damaged boxes of a 32bpp image of given size to a buffer which shows `clip` part of it,
+ * i.e. shadow writeback to the screen buffer or a part of screen shown by additional output.
+ * Boxes are clipped to `clip` and to the image, strides are in bytes.
+ */
+void lorieCopyBoxes(void *dst, int dstStride, const BoxRec *clip, const void *src, int srcStride,
+                    int width, int height, const BoxRec *boxes, int n) {
+    int i, y;
+
+    for (i = 0; i < n; i++) {
+        int x1 = max(boxes[i].x1, max(clip->x1, 0)), x2 = min(boxes[i].x2, min(clip->x2, width));
+        int y1 = max(boxes[i].y1, max(clip->y1, 0)), y2 = min(boxes[i].y2, min(clip->y2, height));
+        if (x1 >= x2)
+            continue;
+
+        // Whole rows are written sequentially, bionic's memcpy uses widest available vector stores.
+        for (y = y1; y < y2; y++)
+            memcpy((char*) dst + (size_t) (y - clip->y1) * dstStride + (x1 - clip->x1) * 4,
+                   (const char*) src + (size_t) y * srcStride + x1 * 4, (x2 - x1) * 4);
+    }
+}
@@ -0,0 +1,140 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scrnintstr.h"
+#include "regionstr.h"
+#include "lorie.h"
+
+// Screen is split to 64x64 tiles, every tile is represented by one bit.
+// Marking tiles dirty is a few bit operations per damage box,
+// unlike region union which is O(n) of number of boxes already accumulated.
+#define TILE_SHIFT 6
+#define TILE_SIZE (1 << TILE_SHIFT)
+
+struct lorieTileDamage {
+    int width, height;
+    int columns, rows;
+    int words; // 64-bit words per tile row
+    Bool dirty;
+    uint64_t bits[];
+};
+
+lorieTileDamagePtr lorieTileDamageCreate(int width, int height) {
+    int columns = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+    int rows = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+    int words = (columns + 63) >> 6;
+    lorieTileDamagePtr tiles = calloc(1, sizeof(*tiles) + sizeof(uint64_t) * words * rows);
+    if (!tiles)
+        return NULL;
+
+    tiles->width = width;
+    tiles->height = height;
+    tiles->columns = columns;
+    tiles->rows = rows;
+    tiles->words = words;
+    return tiles;
+}
+
+void lorieTileDamageDestroy(lorieTileDamagePtr tiles) {
+    free(tiles);
+}
+
+static inline void lorieTileRowSet(uint64_t *row, int from, int to) {
+    int w, w0 = from >> 6, w1 = to >> 6;
+    uint64_t m0 = ~0ULL << (from & 63), m1 = ~0ULL >> (63 - (to & 63));
+
+    if (w0 == w1) {
+        row[w0] |= m0 & m1;
+        return;
+    }
+
+    row[w0] |= m0;
+    for (w = w0 + 1; w < w1; w++)
+        row[w] = ~0ULL;
+    row[w1] |= m1;
+}
+
+void lorieTileDamageAddBox(lorieTileDamagePtr tiles, const BoxRec *box) {
+    int x1 = max(box->x1, 0), y1 = max(box->y1, 0);
+    int x2 = min(box->x2, tiles->width), y2 = min(box->y2, tiles->height);
+    int ty, ty1;
+
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
+    ty1 = (y2 - 1) >> TILE_SHIFT;
+    for (ty = y1 >> TILE_SHIFT; ty <= ty1; ty++)
+        lorieTileRowSet(&tiles->bits[ty * tiles->words], x1 >> TILE_SHIFT, (x2 - 1) >> TILE_SHIFT);
+    tiles->dirty = TRUE;
+}
+
+void lorieTileDamageAddRegion(lorieTileDamagePtr tiles, RegionPtr region) {
+    int i, n = RegionNumRects(region);
+    BoxPtr boxes = RegionRects(region);
+
+    for (i = 0; i < n; i++)
+        lorieTileDamageAddBox(tiles, &boxes[i]);
+}
+
+Bool lorieTileDamageNotEmpty(lorieTileDamagePtr tiles) {
+    return tiles->dirty;
+}
+
+void lorieTileDamageEmpty(lorieTileDamagePtr tiles) {
+    if (tiles->dirty)
+        memset(tiles->bits, 0, sizeof(uint64_t) * tiles->words * tiles->rows);
+    tiles->dirty = FALSE;
+}
+
+/*
+ * Converts dirty tiles to boxes. Consecutive dirty tiles of a row are merged to one span,
+ * rows with the same set of dirty tiles as the previous row extend its spans downwards.
+ * Returns number of boxes or -1 if they do not fit to `max` boxes.
+ */
+int lorieTileDamageSpans(lorieTileDamagePtr tiles, BoxPtr boxes, int max) {
+    int n = 0, rowStart = 0, ty, i;
+
+    for (ty = 0; ty < tiles->rows; ty++) {
+        uint64_t *row = &tiles->bits[ty * tiles->words];
+        int tx = 0, y1 = ty << TILE_SHIFT, y2 = min((ty + 1) << TILE_SHIFT, tiles->height);
+
+        if (ty > 0 && n > rowStart && !memcmp(row, row - tiles->words, sizeof(uint64_t) * tiles->words)) {
+            for (i = rowStart; i < n; i++)
+                boxes[i].y2 = y2;
+            continue;
+        }
+
+        rowStart = n;
+        while (tx < tiles->columns) {
+            uint64_t word = row[tx >> 6] >> (tx & 63);
+            int start, end;
+            if (!word) {
+                tx = (tx | 63) + 1;
+                continue;
+            }
+
+            start = end = tx + __builtin_ctzll(word);
+            // Find the end of the run of set bits, it can cross word boundary.
+            while (end < tiles->columns) {
+                uint64_t rest = ~row[end >> 6] >> (end & 63);
+                end += rest ? __builtin_ctzll(rest) : 64 - (end & 63);
+                if (rest)
+                    break;
+            }
+            tx = end = min(end, tiles->columns);
+
+            if (n == max)
+                return -1;
+            boxes[n++] = (BoxRec) {
+                .x1 = start << TILE_SHIFT, .y1 = y1,
+                .x2 = min(end << TILE_SHIFT, tiles->width), .y2 = y2
+            };
+        }
+    }
+
+    return n;
+}
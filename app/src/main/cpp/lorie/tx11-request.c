@@ -5,12 +5,20 @@
 #include <dix-config.h>
 #endif
 
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <globals.h>
 #include <inpututils.h>
 #include <randrstr.h>
+#include <eventstr.h>
+#include <mi.h>
 #include <android/log.h>
 #include "lorie.h"
 #include "tx11.h"
+#include "inputring.h"
 #include "xkbcommon/xkbcommon.h"
 
 __attribute__((__unused__))
@@ -18,16 +26,427 @@ extern DeviceIntPtr lorieMouse, lorieMouseRelative, lorieTouch, lorieKeyboard;
 extern ScreenPtr pScreenPtr;
 
 void lorieKeysymKeyboardEvent(KeySym keysym, int down);
+void lorieTextInput(const KeySym *keysyms, int count);
+
+/*
+ * Events queued to mieq but not processed yet. When main thread is busy, motion piles up and clients would
+ * get stale positions one by one, so motion which is followed by newer motion of the same pointer or touch
+ * is dropped while the queue is deeper than coalesceDepth. Raw motion keeps full resolution if requested.
+ *
+ * mieq grows by itself, but only up to its compile-time maximum and it drops everything (buttons and keys too)
+ * once it is full. lorie stays below LORIE_QUEUE_LIMIT: motion is always coalesced there and the input ring
+ * is not read until main thread catches up, so unread events wait in shared memory and the socket instead.
+ */
+#define LORIE_QUEUE_LIMIT 2048
+
+static _Atomic int queueDepth;
+static int coalesceDepth;
+static Bool rawMotion;
+
+// Statistics, protected by input lock.
+static struct {
+    int highWater;
+    CARD32 coalesced, throttled;
+    Bool ringThrottled; // Ring was left unread because the queue was full
+} queue;
+
+void lorieInputSetCoalescing(int depth, Bool raw) {
+    coalesceDepth = depth;
+    rawMotion = raw;
+}
+
+// Android timestamps are kept, both X server and Android use CLOCK_MONOTONIC milliseconds. 0 means now.
+static void lorieEnqueueEvents(DeviceIntPtr dev, int nevents, CARD32 time) {
+    int i;
+    for (i = 0; i < nevents; i++) {
+        if (time)
+            InputEventList[i].any.time = time;
+        mieqEnqueue(dev, &InputEventList[i]);
+    }
+    if (nevents) {
+        int depth = atomic_fetch_add_explicit(&queueDepth, nevents, memory_order_relaxed) + nevents;
+        queue.highWater = max(queue.highWater, depth);
+        lorieLatencyRecord(LORIE_LATENCY_QUEUED, time);
+        if (dev == lorieTouch)
+            lorieLatencyTouchQueued(time);
+    }
+}
+
+static void lorieTouchEvent(int type, int id, int ex, int ey, CARD32 time) {
+    ValuatorMask mask;
+    double x, y;
+    DDXTouchPointInfoPtr touch = TouchFindByDDXID(lorieTouch, id, FALSE);
+
+    // Screen pixmap can be replaced by main thread while we are on input thread, screen size is always safe to read.
+    x = (float) max(ex, 0) * 0xFFFF / pScreenPtr->width;
+    y = (float) max(ey, 0) * 0xFFFF / pScreenPtr->height;
+
+    // Avoid duplicating events
+    if (touch && touch->active) {
+        double oldx, oldy;
+        if (type == XI_TouchUpdate &&
+            valuator_mask_fetch_double(touch->valuators, 0, &oldx) &&
+            valuator_mask_fetch_double(touch->valuators, 1, &oldy) &&
+            oldx == x && oldy == y)
+            return;
+    }
+
+    valuator_mask_zero(&mask);
+    valuator_mask_set_double(&mask, 0, x);
+    valuator_mask_set_double(&mask, 1, y);
+    lorieEnqueueEvents(lorieTouch, GetTouchEvents(InputEventList, lorieTouch, id, type, 0, &mask), time);
+}
+
+static void lorieMouseEvent(float x, float y, int detail, int down, int relative, CARD32 time) {
+    ValuatorMask mask;
+    int flags;
+
+    valuator_mask_zero(&mask);
+    switch(detail) {
+        case 0: // BUTTON_UNDEFINED
+            if (relative) {
+                // Captured pointer. Cursor moves with acceleration, XI2 raw events carry exact deltas for games.
+                flags = POINTER_RELATIVE | POINTER_ACCELERATE;
+                valuator_mask_set_unaccelerated(&mask, 0, (double) x, (double) x);
+                valuator_mask_set_unaccelerated(&mask, 1, (double) y, (double) y);
+                lorieEnqueueEvents(lorieMouseRelative, GetPointerEvents(InputEventList, lorieMouseRelative, MotionNotify, 0, flags, &mask), time);
+            } else {
+                flags = POINTER_ABSOLUTE | POINTER_SCREEN | (rawMotion ? 0 : POINTER_NORAW);
+                valuator_mask_set_double(&mask, 0, (double) x);
+                valuator_mask_set_double(&mask, 1, (double) y);
+                lorieEnqueueEvents(lorieMouse, GetPointerEvents(InputEventList, lorieMouse, MotionNotify, 0, flags, &mask), time);
+            }
+            break;
+        case 1: // BUTTON_LEFT
+        case 2: // BUTTON_MIDDLE
+        case 3: // BUTTON_RIGHT
+            lorieEnqueueEvents(lorieMouse, GetPointerEvents(InputEventList, lorieMouse, down ? ButtonPress : ButtonRelease,
+                                                            detail, 0, &mask), time);
+            break;
+        case 4: // BUTTON_SCROLL
+            if (x) {
+                valuator_mask_zero(&mask);
+                valuator_mask_set_double(&mask, 2, (double) x / 120);
+                lorieEnqueueEvents(lorieMouse, GetPointerEvents(InputEventList, lorieMouse, MotionNotify, 0, POINTER_RELATIVE, &mask), time);
+            }
+            if (y) {
+                valuator_mask_zero(&mask);
+                valuator_mask_set_double(&mask, 3, (double) y / 120);
+                lorieEnqueueEvents(lorieMouse, GetPointerEvents(InputEventList, lorieMouse, MotionNotify, 0, POINTER_RELATIVE, &mask), time);
+            }
+            break;
+    }
+}
+
+static void lorieKeyEvent(int keycode, int down, CARD32 time) {
+    lorieEnqueueEvents(lorieKeyboard, GetKeyboardEvents(InputEventList, lorieKeyboard, down ? KeyPress : KeyRelease, keycode), time);
+}
+
+// Changes keymap and processes input queue, called without input lock.
+static void lorieUnicodeEvent(CARD32 unicode) {
+    char name[128];
+    xkb_keysym_get_name(xkb_utf32_to_keysym(unicode), name, 128);
+    __android_log_print(ANDROID_LOG_DEBUG, "LorieNative", "Trying to input keysym %d %s\n", xkb_utf32_to_keysym(unicode), name);
+    lorieKeysymKeyboardEvent(xkb_utf32_to_keysym(unicode), TRUE);
+    lorieKeysymKeyboardEvent(xkb_utf32_to_keysym(unicode), FALSE);
+}
+
+// Malformed sequences, overlong forms and surrogates are skipped, codepoint is 0 for them.
+static int lorieUtf8Next(const unsigned char *s, int length, CARD32 *codepoint) {
+    static const CARD32 least[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    int count, i;
+
+    if (s[0] < 0x80)
+        count = 1, *codepoint = s[0];
+    else if ((s[0] & 0xE0) == 0xC0)
+        count = 2, *codepoint = s[0] & 0x1F;
+    else if ((s[0] & 0xF0) == 0xE0)
+        count = 3, *codepoint = s[0] & 0x0F;
+    else if ((s[0] & 0xF8) == 0xF0)
+        count = 4, *codepoint = s[0] & 0x07;
+    else
+        count = 1, *codepoint = 0;
+
+    for (i = 1; i < count; i++) {
+        if (i >= length || (s[i] & 0xC0) != 0x80) {
+            *codepoint = 0;
+            return i;
+        }
+        *codepoint = (*codepoint << 6) | (s[i] & 0x3F);
+    }
+
+    if (*codepoint < least[count] || (*codepoint >= 0xD800 && *codepoint <= 0xDFFF) || *codepoint > 0x10FFFF)
+        *codepoint = 0;
+    return count;
+}
+
+// Whole text is typed with one call, so keysyms missing in keymap are added together.
+static int lorieText(const char *text, int length) {
+    KeySym *keysyms;
+    CARD32 codepoint;
+    int count = 0, i = 0;
+
+    if (!length)
+        return Success;
+    if (!(keysyms = calloc(length, sizeof(*keysyms))))
+        return BadAlloc;
+
+    while (i < length) {
+        i += lorieUtf8Next((const unsigned char*) text + i, length - i, &codepoint);
+        if (codepoint && (keysyms[count] = xkb_utf32_to_keysym(codepoint)) != NoSymbol)
+            count++;
+    }
+
+    lorieTextInput(keysyms, count);
+    free(keysyms);
+    return Success;
+}
+
+// Raw event of motion which was coalesced.
+static void lorieMouseRawMotion(float x, float y, CARD32 time) {
+    ValuatorMask mask;
+
+    valuator_mask_zero(&mask);
+    valuator_mask_set_double(&mask, 0, (double) x);
+    valuator_mask_set_double(&mask, 1, (double) y);
+    lorieEnqueueEvents(lorieMouse, GetPointerEvents(InputEventList, lorieMouse, MotionNotify, 0,
+                                                    POINTER_ABSOLUTE | POINTER_SCREEN | POINTER_RAWONLY, &mask), time);
+}
+
+// Relative motion is accumulated by clients, so it is never dropped.
+static Bool lorieEventIsMotion(const xcb_tx11_event_t *ev) {
+    return (ev->kind == XCB_TX11_EVENT_KIND_MOUSE && ev->detail == 0 && !ev->relative)
+           || (ev->kind == XCB_TX11_EVENT_KIND_TOUCH && ev->detail == XI_TouchUpdate);
+}
+
+// Motion is superseded by a later motion of the same pointer or touch if there is only other motion in between,
+// so buttons, keys and touch begin and end keep their order.
+static Bool lorieEventSuperseded(const xcb_tx11_event_t *ev, const xcb_tx11_event_t *end) {
+    const xcb_tx11_event_t *next;
+
+    if (!lorieEventIsMotion(ev))
+        return FALSE;
+
+    for (next = ev + 1; next < end && lorieEventIsMotion(next); next++)
+        if (next->kind == ev->kind && (ev->kind == XCB_TX11_EVENT_KIND_MOUSE || next->code == ev->code))
+            return TRUE;
+
+    return FALSE;
+}
+
+static int lorieEvent(const xcb_tx11_event_t *ev) {
+    lorieLatencyRecord(LORIE_LATENCY_RECEIVED, ev->time);
+    switch (ev->kind) {
+        case XCB_TX11_EVENT_KIND_TOUCH:
+            lorieTouchEvent(ev->detail, (int) ev->code, (int) ev->x, (int) ev->y, ev->time);
+            return Success;
+        case XCB_TX11_EVENT_KIND_MOUSE:
+            lorieMouseEvent(ev->x, ev->y, ev->detail, ev->down, ev->relative, ev->time);
+            return Success;
+        case XCB_TX11_EVENT_KIND_KEY:
+            lorieKeyEvent((int) ev->code, ev->down, ev->time);
+            return Success;
+        case XCB_TX11_EVENT_KIND_UNICODE:
+            // Only on main thread, which holds input lock once here. Queue must be processed without it.
+            input_unlock();
+            lorieUnicodeEvent(ev->code);
+            input_lock();
+            return Success;
+        default:
+            return BadValue;
+    }
+}
+
+// Unicode input changes keymap, it is only handled on main thread.
+static int lorieEvents(const xcb_tx11_event_t *ev, int count, Bool mainThread) {
+    int depth = atomic_load_explicit(&queueDepth, memory_order_relaxed), i, ret;
+    Bool coalesce = (coalesceDepth > 0 && depth > coalesceDepth) || depth >= LORIE_QUEUE_LIMIT;
+
+    for (i = 0; i < count; i++) {
+        if (!mainThread && ev[i].kind == XCB_TX11_EVENT_KIND_UNICODE)
+            continue;
+
+        if (coalesce && lorieEventSuperseded(&ev[i], ev + count)) {
+            if (rawMotion && ev[i].kind == XCB_TX11_EVENT_KIND_MOUSE)
+                lorieMouseRawMotion(ev[i].x, ev[i].y, ev[i].time);
+            queue.coalesced++;
+            continue;
+        }
+
+        if ((ret = lorieEvent(&ev[i])) != Success)
+            return ret;
+    }
+
+    return Success;
+}
+
+/*
+ * Ring shared with activity (see inputring.h) is drained on input thread, so input is queued even while
+ * main thread is busy with a slow request of some other client. Main thread takes input lock for the same
+ * work when input comes with requests, event generation and keymap are shared with input thread.
+ */
+static struct {
+    lorieInputRing *ring;
+    ClientPtr client;
+    int notify;
+} inputRing = { .notify = -1 };
+
+// Events which do not fit to the queue are left in the ring unless `all` is set. Called with input lock held.
+static void lorieInputRingDrain(Bool all) {
+    lorieInputRing *ring = inputRing.ring;
+    uint32_t head, tail;
+
+    if (!ring)
+        return;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    // Activity is not trusted to keep head sane, broken ring is dropped instead of reading garbage.
+    if (head - tail > LORIE_INPUT_RING_SIZE)
+        tail = head;
+
+    // Events are copied out in chunks, so activity can not change them while they are coalesced.
+    while (tail != head) {
+        xcb_tx11_event_t events[64];
+        int n = 0;
+
+        if (!all && atomic_load_explicit(&queueDepth, memory_order_relaxed) >= LORIE_QUEUE_LIMIT) {
+            queue.throttled += !queue.ringThrottled;
+            queue.ringThrottled = TRUE;
+            break;
+        }
+
+        for (; tail != head && n < (int) ARRAY_SIZE(events); tail++)
+            events[n++] = ring->events[tail & (LORIE_INPUT_RING_SIZE - 1)];
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        lorieEvents(events, n, FALSE);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+}
+
+static void lorieInputRingRead(int fd, unused int ready, unused void *data) {
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        return;
+
+    lorieInputRingDrain(FALSE);
+}
+
+void lorieInputProcessed(void) {
+    uint64_t count = 1;
+
+    input_lock();
+    atomic_store_explicit(&queueDepth, 0, memory_order_relaxed);
+    // Eventfd was already read, input thread is woken up to continue reading the ring.
+    if (queue.ringThrottled && inputRing.ring)
+        write(inputRing.notify, &count, sizeof(count));
+    queue.ringThrottled = FALSE;
+    input_unlock();
+}
+
+static void lorieInputRingDetach(void) {
+    if (!inputRing.ring)
+        return;
+
+    input_lock();
+    InputThreadUnregisterDev(inputRing.notify);
+    munmap(inputRing.ring, sizeof(lorieInputRing));
+    inputRing.ring = NULL;
+    input_unlock();
+
+    close(inputRing.notify);
+    inputRing.notify = -1;
+    inputRing.client = NULL;
+}
+
+// Takes ownership of both descriptors.
+static int lorieInputRingAttach(ClientPtr client, int ring, int notify) {
+    struct stat st;
+    void *map = MAP_FAILED;
+    int ret = BadValue;
+
+    // Memfd has the real size and can not be accessed past its end without SIGBUS,
+    // ashmem reports zero size but refuses to map more than it has.
+    if (ring >= 0 && notify >= 0 && !fstat(ring, &st)
+        && (!S_ISREG(st.st_mode) || st.st_size >= (off_t) sizeof(lorieInputRing))) {
+        map = mmap(NULL, sizeof(lorieInputRing), PROT_READ | PROT_WRITE, MAP_SHARED, ring, 0);
+        ret = map == MAP_FAILED ? BadAlloc : Success;
+    }
+
+    if (ring >= 0)
+        close(ring);
+    if (ret != Success) {
+        if (notify >= 0)
+            close(notify);
+        return ret;
+    }
+
+    lorieInputRingDetach();
+    input_lock();
+    if (!InputThreadRegisterDev(notify, lorieInputRingRead, NULL)) {
+        input_unlock();
+        munmap(map, sizeof(lorieInputRing));
+        close(notify);
+        return BadAlloc;
+    }
+    inputRing.ring = map;
+    inputRing.client = client;
+    inputRing.notify = notify;
+    input_unlock();
+    return Success;
+}
+
+/*
+ * Activity is a client like any other, but touch, keys and resizes must not wait behind bulk drawing of
+ * container apps. Smart scheduler always picks the ready client with the highest priority, so control
+ * requests wait at most for the time slice of a client which is being dispatched already.
+ */
+#define LORIE_CONTROL_PRIORITY INT32_MAX
+
+static struct {
+    Bool pending; // Client being created by AddClientOnOpenFD is the control client
+    unsigned long count;
+    CARD32 sum, max;
+} control;
+
+void lorieAddControlClient(int fd) {
+    control.pending = TRUE;
+    AddClientOnOpenFD(fd);
+    control.pending = FALSE;
+}
+
+// Activity stamps every control request with the time it was sent, age of the stamp is the upper bound
+// of the time request spent in socket and scheduler queues.
+static void lorieControlDelay(CARD32 time) {
+    INT32 delay = (INT32) (GetTimeInMillis() - time);
+    if (!time || delay < 0)
+        return;
+
+    control.count++;
+    control.sum += delay;
+    control.max = max(control.max, (CARD32) delay);
+    if (control.count % 1024 == 0) {
+        __android_log_print(ANDROID_LOG_INFO, "tx11-request", "control request queueing delay: average %u ms, max %u ms",
+                            control.sum / 1024, control.max);
+        control.sum = control.max = 0;
+    }
+}
+
+static void lorieClientState(unused CallbackListPtr *list, unused void *closure, void *data) {
+    ClientPtr client = ((NewClientInfoRec*) data)->client;
+    if (control.pending && client->clientState == ClientStateInitial)
+        client->priority = LORIE_CONTROL_PRIORITY;
+    if (client == inputRing.client && client->clientState == ClientStateGone)
+        lorieInputRingDetach();
+}
 
 static int dispatch(ClientPtr client) {
     xReq* req = (xReq*) client->requestBuffer;
-    ValuatorMask mask;
 
     if (!client->local)
         return BadMatch;
 
-    valuator_mask_zero(&mask);
-    __android_log_print(ANDROID_LOG_INFO, "XLorieTrace", "HERE %s %d", __PRETTY_FUNCTION__, __LINE__);
     switch (req->data) {
         case XCB_TX11_QUERY_VERSION: {
             xcb_tx11_query_version_reply_t rep = {
@@ -35,7 +454,7 @@ static int dispatch(ClientPtr client) {
                     .sequence = client->sequence,
                     .length = 0,
                     .major_version = 0,
-                    .minor_version = 1
+                    .minor_version = 8
             };
 
             if (client->swapped) {
@@ -49,93 +468,111 @@ static int dispatch(ClientPtr client) {
         case XCB_TX11_SCREEN_SIZE_CHANGE: {
             REQUEST(xcb_tx11_screen_size_change_request_t)
 
+            REQUEST_SIZE_MATCH(xcb_tx11_screen_size_change_request_t);
+            lorieControlDelay(stuff->time);
             __android_log_print(ANDROID_LOG_ERROR, "tx11-request", "window changed: %d %d", stuff->width, stuff->height);
             lorieConfigureNotify(stuff->width, stuff->height);
             return Success;
         }
         case XCB_TX11_TOUCH_EVENT: {
             REQUEST(xcb_tx11_touch_event_request_t)
-            double x, y;
-            DDXTouchPointInfoPtr touch = TouchFindByDDXID(lorieTouch, stuff->id, FALSE);
-
-            if (stuff->x < 0)
-                stuff->x = 0;
-            if (stuff->y < 0)
-                stuff->y = 0;
-
-            x = (float) stuff->x * 0xFFFF / pScreenPtr->GetScreenPixmap(pScreenPtr)->drawable.width;
-            y = (float) stuff->y * 0xFFFF / pScreenPtr->GetScreenPixmap(pScreenPtr)->drawable.height;
-
-            // Avoid duplicating events
-            if (touch && touch->active) {
-                double oldx, oldy;
-                if (stuff->type == XI_TouchUpdate &&
-                    valuator_mask_fetch_double(touch->valuators, 0, &oldx) &&
-                    valuator_mask_fetch_double(touch->valuators, 1, &oldy) &&
-                    oldx == x && oldy == y)
-                    return Success;
-            }
-
-            __android_log_print(ANDROID_LOG_ERROR, "tx11-request", "touch event: %d %d %d %d", stuff->type, stuff->id, stuff->x, stuff->y);
-            valuator_mask_set_double(&mask, 0, x);
-            valuator_mask_set_double(&mask, 1, y);
-            QueueTouchEvents(lorieTouch, stuff->type, stuff->id, 0, &mask);
+            input_lock();
+            lorieTouchEvent(stuff->type, stuff->id, (INT16) stuff->x, (INT16) stuff->y, 0);
+            input_unlock();
             return Success;
         }
         case XCB_TX11_MOUSE_EVENT: {
             REQUEST(xcb_tx11_mouse_event_request_t)
-
-            int flags;
-            switch(stuff->detail) {
-                case 0: // BUTTON_UNDEFINED
-                    if (stuff->relative) {
-//                        flags = POINTER_RELATIVE | POINTER_NORAW;
-//                        valuator_mask_set_unaccelerated(&mask, 0, stuff->x, stuff->x);
-//                        valuator_mask_set_unaccelerated(&mask, 1, stuff->y, stuff->y);
-//                        QueuePointerEvents(lorieMouseRelative, MotionNotify, 0, flags, &mask);
-                    } else {
-//                        dprintf(2, "Got mouse motion %f %f (%d) (%d) \n", stuff->x, stuff->y, (int) stuff->x, (int) stuff->y);
-                        flags = POINTER_ABSOLUTE | POINTER_SCREEN | POINTER_NORAW;
-                        valuator_mask_set_double(&mask, 0, (double) stuff->x);
-                        valuator_mask_set_double(&mask, 1, (double) stuff->y);
-                        QueuePointerEvents(lorieMouse, MotionNotify, 0, flags, &mask);
-                    }
-                    break;
-                case 1: // BUTTON_LEFT
-                case 2: // BUTTON_MIDDLE
-                case 3: // BUTTON_RIGHT
-                    QueuePointerEvents(lorieMouse, stuff->down ? ButtonPress : ButtonRelease, stuff->detail, 0, &mask);
-                    break;
-                case 4: // BUTTON_SCROLL
-//                    dprintf(2, "Got mouse scroll %f %f (%d) (%d) \n", stuff->x, stuff->y, (int) stuff->x, (int) stuff->y);
-                    if (stuff->x) {
-                        valuator_mask_zero(&mask);
-                        valuator_mask_set_double(&mask, 2, (double) stuff->x / 120);
-                        QueuePointerEvents(lorieMouse, MotionNotify, 0, POINTER_RELATIVE, &mask);
-                    }
-                    if (stuff->y) {
-                        valuator_mask_zero(&mask);
-                        valuator_mask_set_double(&mask, 3, (double) stuff->y / 120);
-                        QueuePointerEvents(lorieMouse, MotionNotify, 0, POINTER_RELATIVE, &mask);
-                    }
-                    break;
-            }
+            input_lock();
+            lorieMouseEvent(stuff->x, stuff->y, stuff->detail, stuff->down, stuff->relative, 0);
+            input_unlock();
             return Success;
         }
         case XCB_TX11_KEY_EVENT: {
             REQUEST(xcb_tx11_key_event_request_t)
-            QueueKeyboardEvents(lorieKeyboard, stuff->state ? KeyPress : KeyRelease, stuff->keycode);
+            input_lock();
+            lorieKeyEvent(stuff->keycode, stuff->state, 0);
+            input_unlock();
             return Success;
         }
         case XCB_TX11_UNICODE_EVENT: {
             REQUEST(xcb_tx11_unicode_event_request_t)
-            char name[128];
-            xkb_keysym_get_name(xkb_utf32_to_keysym(stuff->unicode), name, 128);
-            __android_log_print(ANDROID_LOG_DEBUG, "LorieNative", "Trying to input keysym %d %s\n", xkb_utf32_to_keysym(stuff->unicode), name);
-            lorieKeysymKeyboardEvent(xkb_utf32_to_keysym(stuff->unicode), TRUE);
-            lorieKeysymKeyboardEvent(xkb_utf32_to_keysym(stuff->unicode), FALSE);
+            lorieUnicodeEvent(stuff->unicode);
             return Success;
         }
+        case XCB_TX11_EVENT_BATCH: {
+            REQUEST(xcb_tx11_event_batch_request_t)
+            xcb_tx11_event_t *ev = (xcb_tx11_event_t*) &stuff[1];
+            int ret;
+
+            if (((size_t) client->req_len << 2) < sizeof(*stuff) + stuff->count * sizeof(*ev))
+                return BadLength;
+            lorieControlDelay(stuff->time);
+
+            // Events of one input frame are decoded in one pass and are processed by the next dispatch cycle together.
+            // Activity falls back to EventBatch when the ring is full, older events from the ring go first.
+            input_lock();
+            lorieInputRingDrain(TRUE);
+            ret = lorieEvents(ev, stuff->count, TRUE);
+            input_unlock();
+            return ret;
+        }
+        case XCB_TX11_INPUT_RING: {
+            int ring = ReadFdFromClient(client), notify = ReadFdFromClient(client);
+            return lorieInputRingAttach(client, ring, notify);
+        }
+        case XCB_TX11_QUERY_LATENCY: {
+            REQUEST(xcb_tx11_query_latency_request_t)
+            struct {
+                xcb_tx11_query_latency_reply_t rep;
+                CARD32 counts[LORIE_LATENCY_STAGES * LORIE_LATENCY_BUCKETS];
+            } rep = {
+                .rep = {
+                    .response_type = X_Reply,
+                    .sequence = client->sequence,
+                    .length = LORIE_LATENCY_STAGES * LORIE_LATENCY_BUCKETS,
+                    .stages = LORIE_LATENCY_STAGES,
+                    .buckets = LORIE_LATENCY_BUCKETS,
+                }
+            };
+
+            REQUEST_SIZE_MATCH(xcb_tx11_query_latency_request_t);
+            lorieLatencyQuery(rep.counts, stuff->reset);
+            WriteToClient(client, sizeof(rep), &rep);
+            return Success;
+        }
+        case XCB_TX11_QUERY_INPUT_QUEUE: {
+            REQUEST(xcb_tx11_query_input_queue_request_t)
+            xcb_tx11_query_input_queue_reply_t rep = {
+                .response_type = X_Reply,
+                .sequence = client->sequence,
+                .length = 0,
+            };
+
+            REQUEST_SIZE_MATCH(xcb_tx11_query_input_queue_request_t);
+            input_lock();
+            rep.depth = atomic_load_explicit(&queueDepth, memory_order_relaxed);
+            rep.high_water = queue.highWater;
+            rep.coalesced = queue.coalesced;
+            rep.throttled = queue.throttled;
+            if (stuff->reset) {
+                queue.highWater = 0;
+                queue.coalesced = queue.throttled = 0;
+            }
+            input_unlock();
+            WriteToClient(client, sizeof(rep), &rep);
+            return Success;
+        }
+        case XCB_TX11_TEXT_INPUT: {
+            REQUEST(xcb_tx11_text_input_request_t)
+
+            REQUEST_FIXED_SIZE(xcb_tx11_text_input_request_t, stuff->length);
+            lorieControlDelay(stuff->time);
+            input_lock();
+            lorieInputRingDrain(TRUE);
+            input_unlock();
+            return lorieText((const char*) &stuff[1], stuff->length);
+        }
         default:
             return BadRequest;
     }
@@ -147,5 +584,7 @@ static int sdispatch(__attribute__((__unused__)) ClientPtr client) {
 }
 
 void tx11_protocol_init(void) {
+    lorieInputRingDetach();
+    AddCallback(&ClientStateCallback, lorieClientState, NULL);
     AddExtension("TX11", 11, 0, dispatch, sdispatch, NULL, StandardMinorOpcode);
 }
@@ -0,0 +1,384 @@
+#ifdef HAVE_DIX_CONFIG_H
+#include <dix-config.h>
+#endif
+
+#include <string.h>
+#include <X11/extensions/Xv.h>
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "pixmapstr.h"
+#include "gcstruct.h"
+#include "regionstr.h"
+#include "resource.h"
+#include "dix.h"
+#include "xvdix.h"
+#include "renderer.h"
+#include "lorie.h"
+
+/*
+ * Xv adaptor which works like a hardware overlay. YUV planes are uploaded to textures and converted
+ * to RGB by renderer while it draws the root buffer. Visible part of the video window is filled with
+ * colorkey and the renderer shows video only where colorkey is, so overlapping windows clip the video
+ * and nothing is converted or copied by CPU. Images sent with XvShmPutImage are read directly from
+ * the shared segment by Xv dispatch code.
+ *
+ * With the built-in compositor colorkey is painted to the pixmap of the redirected window the same way and
+ * renderer looks for it in the texture of its top-level window, drawing video right above that window.
+ * Only windows which renderer does not composite (external compositing manager, rootless mode) get
+ * video converted and scaled by CPU and drawn like a regular image.
+ */
+
+#define FOURCC_I420 0x30323449
+#define FOURCC_YV12 0x32315659
+#define FOURCC_NV12 0x3231564e
+#define FOURCC_YUY2 0x32595559
+
+#define MAX_IMAGE_SIZE 8192
+
+#define GUID(a, b, c, d) { a, b, c, d, 0x00, 0x00, 0x00, 0x10, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 }
+#define PLANAR_YUV(fourcc, a, b, c, d, planes, order)                                                \
+    { .id = (fourcc), .type = XvYUV, .byte_order = LSBFirst, .guid = GUID(a, b, c, d),               \
+      .bits_per_pixel = 12, .format = XvPlanar, .num_planes = (planes),                              \
+      .y_sample_bits = 8, .u_sample_bits = 8, .v_sample_bits = 8,                                    \
+      .horz_y_period = 1, .horz_u_period = 2, .horz_v_period = 2,                                    \
+      .vert_y_period = 1, .vert_u_period = 2, .vert_v_period = 2,                                    \
+      .component_order = order, .scanline_order = XvTopToBottom }
+
+static XvImageRec lorieXvImages[] = {
+    PLANAR_YUV(FOURCC_I420, 'I', '4', '2', '0', 3, "YUV"),
+    PLANAR_YUV(FOURCC_YV12, 'Y', 'V', '1', '2', 3, "YVU"),
+    PLANAR_YUV(FOURCC_NV12, 'N', 'V', '1', '2', 2, "YUV"),
+    { .id = FOURCC_YUY2, .type = XvYUV, .byte_order = LSBFirst, .guid = GUID('Y', 'U', 'Y', '2'),
+      .bits_per_pixel = 16, .format = XvPacked, .num_planes = 1,
+      .y_sample_bits = 8, .u_sample_bits = 8, .v_sample_bits = 8,
+      .horz_y_period = 1, .horz_u_period = 2, .horz_v_period = 2,
+      .vert_y_period = 1, .vert_u_period = 1, .vert_v_period = 1,
+      .component_order = "YUYV", .scanline_order = XvTopToBottom },
+};
+
+static XvEncodingRec lorieXvEncoding = {
+    .id = 0, .name = (char*) "XV_IMAGE", .width = MAX_IMAGE_SIZE, .height = MAX_IMAGE_SIZE, .rate = { 1, 1 },
+};
+
+static XvAttributeRec lorieXvAttributes[] = {
+    { .flags = XvSettable | XvGettable, .min_value = 0, .max_value = 0xFFFFFF, .name = (char*) "XV_COLORKEY" },
+};
+
+static XvFormatRec lorieXvFormat;
+static XvAdaptorRec lorieXvAdaptor;
+static XvPortRec lorieXvPort;
+
+static struct {
+    Atom colorKeyAtom;
+    CARD32 colorKey;
+    RegionRec clip; // Area filled with colorkey by the last frame
+    BoxRec box; // Video position on the screen
+    Bool overlay; // Video is shown by renderer
+    void *window; // Composited window which contains colorkey, NULL for the root buffer
+} xv;
+
+static void lorieXvFillColorKey(DrawablePtr pDraw, CARD32 key, RegionPtr region) {
+    int i, nbox = RegionNumRects(region);
+    BoxPtr pbox = RegionRects(region);
+    ChangeGCVal pval[2];
+    xRectangle *rects;
+    GCPtr pGC;
+
+    if (!nbox || !(pGC = GetScratchGC(pDraw->depth, pDraw->pScreen)))
+        return;
+
+    pval[0].val = key;
+    pval[1].val = IncludeInferiors;
+    ChangeGC(NullClient, pGC, GCForeground | GCSubwindowMode, pval);
+    ValidateGC(pDraw, pGC);
+
+    if ((rects = xallocarray(nbox, sizeof(xRectangle)))) {
+        for (i = 0; i < nbox; i++, pbox++)
+            rects[i] = (xRectangle) {
+                .x = pbox->x1 - pDraw->x, .y = pbox->y1 - pDraw->y,
+                .width = pbox->x2 - pbox->x1, .height = pbox->y2 - pbox->y1,
+            };
+        pGC->ops->PolyFillRect(pDraw, pGC, nbox, rects);
+        free(rects);
+    }
+
+    FreeScratchGC(pGC);
+}
+
+/*
+ * Clients can draw over colorkey (i.e. on expose) without changing window clip. Checking one pixel
+ * of every box is enough to notice it and is much cheaper than filling and damaging the whole video
+ * area with every frame. Pixmap of redirected window is offset by its position on the screen.
+ */
+static Bool lorieXvColorKeyIntact(DrawablePtr pDraw, RegionPtr region) {
+    PixmapPtr pPixmap = pDraw->pScreen->GetWindowPixmap((WindowPtr) pDraw);
+    int i, nbox = RegionNumRects(region);
+    BoxPtr pbox = RegionRects(region);
+
+    if (!pPixmap->devPrivate.ptr)
+        return FALSE;
+
+    for (i = 0; i < nbox; i++, pbox++) {
+        CARD32 *pixel = (CARD32*) ((char*) pPixmap->devPrivate.ptr + (pbox->y1 - pPixmap->screen_y) * pPixmap->devKind)
+                        + pbox->x1 - pPixmap->screen_x;
+        if ((*pixel & 0xFFFFFF) != xv.colorKey)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static int lorieXvStopVideo(unused XvPortPtr pPort, unused DrawablePtr pDraw) {
+    renderer_hide_video();
+    lorieRedraw(&xv.box);
+    RegionEmpty(&xv.clip);
+    xv.overlay = FALSE;
+    xv.window = NULL;
+    return Success;
+}
+
+// BT.601, limited range, the same as the overlay shader. Coefficients are 16.16 fixed point.
+static CARD32 lorieXvPixel(int y, int u, int v) {
+    int c = 76303 * (y - 16), d = u - 128, e = v - 128;
+    int r = (c + 104582 * e) >> 16, g = (c - 25672 * d - 53274 * e) >> 16, b = (c + 132186 * d) >> 16;
+
+    r = min(max(r, 0), 255);
+    g = min(max(g, 0), 255);
+    b = min(max(b, 0), 255);
+    return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+/*
+ * Converts part of the video which lands in `box` (screen coordinates) to `dst`. Video occupies `dx`, `dy`,
+ * `dw`, `dh` on the screen, image is scaled by nearest neighbour. Plane layout is the one reported by
+ * lorieXvQueryImageAttributes.
+ */
+static void lorieXvConvert(int id, const unsigned char *data, int width, int height, int sx, int sy, int sw, int sh,
+                           int dx, int dy, int dw, int dh, const BoxRec *box, CARD32 *dst) {
+    const unsigned char *planeU = data + width * height, *planeV = planeU + (width / 2) * (height / 2);
+    int i, j, x, y;
+
+    if (id == FOURCC_YV12) {
+        planeV = planeU;
+        planeU = planeV + (width / 2) * (height / 2);
+    }
+
+    for (j = box->y1; j < box->y2; j++) {
+        y = min(max(sy + (int) ((int64_t) (j - dy) * sh / dh), 0), height - 1);
+        for (i = box->x1; i < box->x2; i++) {
+            const unsigned char *p;
+            x = min(max(sx + (int) ((int64_t) (i - dx) * sw / dw), 0), width - 1);
+            switch (id) {
+                case FOURCC_YUY2:
+                    p = data + y * width * 2 + (x & ~1) * 2;
+                    *dst++ = lorieXvPixel(p[(x & 1) * 2], p[1], p[3]);
+                    break;
+                case FOURCC_NV12:
+                    p = planeU + (y / 2) * width + (x & ~1);
+                    *dst++ = lorieXvPixel(data[y * width + x], p[0], p[1]);
+                    break;
+                default:
+                    *dst++ = lorieXvPixel(data[y * width + x], planeU[(y / 2) * (width / 2) + x / 2],
+                                          planeV[(y / 2) * (width / 2) + x / 2]);
+            }
+        }
+    }
+}
+
+// Only the visible part of the video is converted, the rest would be clipped by PutImage anyway.
+static int lorieXvPutImageRedirected(DrawablePtr pDraw, GCPtr pGC, INT16 src_x, INT16 src_y, CARD16 src_w, CARD16 src_h,
+                                     INT16 drw_x, INT16 drw_y, CARD16 drw_w, CARD16 drw_h,
+                                     XvImagePtr format, unsigned char *data, CARD16 width, CARD16 height) {
+    BoxPtr extents = RegionExtents(pGC->pCompositeClip);
+    BoxRec box = {
+        .x1 = max(pDraw->x + drw_x, extents->x1), .y1 = max(pDraw->y + drw_y, extents->y1),
+        .x2 = min(pDraw->x + drw_x + drw_w, extents->x2), .y2 = min(pDraw->y + drw_y + drw_h, extents->y2),
+    };
+    CARD32 *pixels;
+
+    if (xv.overlay)
+        lorieXvStopVideo(NULL, pDraw);
+
+    if (box.x1 >= box.x2 || box.y1 >= box.y2 || !src_w || !src_h)
+        return Success;
+
+    if (!(pixels = xallocarray((size_t) (box.x2 - box.x1) * (box.y2 - box.y1), sizeof(CARD32))))
+        return BadAlloc;
+
+    lorieXvConvert(format->id, data, width, height, src_x, src_y, src_w, src_h,
+                   pDraw->x + drw_x, pDraw->y + drw_y, drw_w, drw_h, &box, pixels);
+    pGC->ops->PutImage(pDraw, pGC, pDraw->depth, box.x1 - pDraw->x, box.y1 - pDraw->y,
+                       box.x2 - box.x1, box.y2 - box.y1, 0, ZPixmap, (char*) pixels);
+    free(pixels);
+    return Success;
+}
+
+static int lorieXvRendererFormat(int id) {
+    switch (id) {
+        case FOURCC_YV12: return RENDERER_VIDEO_YV12;
+        case FOURCC_NV12: return RENDERER_VIDEO_NV12;
+        case FOURCC_YUY2: return RENDERER_VIDEO_YUY2;
+        default: return RENDERER_VIDEO_I420;
+    }
+}
+
+static int lorieXvQueryImageAttributes(unused XvPortPtr pPort, XvImagePtr format, CARD16 *width, CARD16 *height,
+                                       int *pitches, int *offsets) {
+    int w, h;
+
+    // Planes are tightly packed so renderer can upload every plane with one call.
+    *width = w = min((*width + 1) & ~1, MAX_IMAGE_SIZE);
+    *height = h = min((*height + 1) & ~1, MAX_IMAGE_SIZE);
+
+    switch (format->id) {
+        case FOURCC_YUY2:
+            if (pitches)
+                pitches[0] = w * 2;
+            if (offsets)
+                offsets[0] = 0;
+            return w * h * 2;
+        case FOURCC_NV12:
+            if (pitches)
+                pitches[0] = pitches[1] = w;
+            if (offsets) {
+                offsets[0] = 0;
+                offsets[1] = w * h;
+            }
+            return w * h * 3 / 2;
+        default:
+            if (pitches) {
+                pitches[0] = w;
+                pitches[1] = pitches[2] = w / 2;
+            }
+            if (offsets) {
+                offsets[0] = 0;
+                offsets[1] = w * h;
+                offsets[2] = w * h + (w / 2) * (h / 2);
+            }
+            return w * h * 3 / 2;
+    }
+}
+
+static int lorieXvPutImage(DrawablePtr pDraw, unused XvPortPtr pPort, GCPtr pGC,
+                           INT16 src_x, INT16 src_y, CARD16 src_w, CARD16 src_h,
+                           INT16 drw_x, INT16 drw_y, CARD16 drw_w, CARD16 drw_h,
+                           XvImagePtr format, unsigned char *data, unused Bool sync, CARD16 width, CARD16 height) {
+    ScreenPtr pScreen = pDraw->pScreen;
+    void *window = NULL;
+    RegionRec clip;
+
+    if (pDraw->type != DRAWABLE_WINDOW)
+        return BadMatch;
+
+    lorieXvQueryImageAttributes(pPort, format, &width, &height, NULL, NULL);
+
+    if (pScreen->GetWindowPixmap((WindowPtr) pDraw) != pScreen->GetScreenPixmap(pScreen)
+        && !(window = lorieCompositorRendererWindow((WindowPtr) pDraw)))
+        return lorieXvPutImageRedirected(pDraw, pGC, src_x, src_y, src_w, src_h, drw_x, drw_y, drw_w, drw_h,
+                                         format, data, width, height);
+
+    // Colorkey of the previous window is somewhere else, it is painted again.
+    if (window != xv.window) {
+        RegionEmpty(&xv.clip);
+        xv.window = window;
+    }
+
+    // Previous position is redrawn too, video is not shown there anymore.
+    lorieRedraw(&xv.box);
+    xv.box = (BoxRec) {
+        .x1 = pDraw->x + drw_x, .y1 = pDraw->y + drw_y,
+        .x2 = pDraw->x + drw_x + drw_w, .y2 = pDraw->y + drw_y + drw_h,
+    };
+
+    RegionInit(&clip, &xv.box, 1);
+    RegionIntersect(&clip, &clip, pGC->pCompositeClip);
+    if (!RegionEqual(&clip, &xv.clip) || !lorieXvColorKeyIntact(pDraw, &clip)) {
+        lorieXvFillColorKey(pDraw, xv.colorKey, &clip);
+        RegionCopy(&xv.clip, &clip);
+    }
+    RegionUninit(&clip);
+
+    renderer_set_video(lorieXvRendererFormat(format->id), width, height, data, src_x, src_y, src_w, src_h,
+                       xv.box.x1, xv.box.y1, drw_w, drw_h, xv.colorKey, window);
+    xv.overlay = TRUE;
+    lorieRedraw(&xv.box);
+    return Success;
+}
+
+static int lorieXvSetPortAttribute(unused XvPortPtr pPort, Atom attribute, INT32 value) {
+    if (attribute != xv.colorKeyAtom)
+        return BadMatch;
+
+    // Colorkey will be painted again with the next frame.
+    xv.colorKey = value & 0xFFFFFF;
+    RegionEmpty(&xv.clip);
+    return Success;
+}
+
+static int lorieXvGetPortAttribute(unused XvPortPtr pPort, Atom attribute, INT32 *value) {
+    if (attribute != xv.colorKeyAtom)
+        return BadMatch;
+
+    *value = (INT32) xv.colorKey;
+    return Success;
+}
+
+static int lorieXvQueryBestSize(unused XvPortPtr pPort, unused CARD8 motion, unused CARD16 vid_w, unused CARD16 vid_h,
+                                CARD16 drw_w, CARD16 drw_h, unsigned int *p_w, unsigned int *p_h) {
+    // Scaling is done by the shader, any size is the best one.
+    *p_w = drw_w;
+    *p_h = drw_h;
+    return Success;
+}
+
+Bool lorieXvInit(ScreenPtr pScreen) {
+    XvScreenPtr pxvs;
+
+    if (XvScreenInit(pScreen) != Success)
+        return FALSE;
+
+    xv.colorKeyAtom = MakeAtom("XV_COLORKEY", strlen("XV_COLORKEY"), TRUE);
+    xv.colorKey = (1 << 16) | (1 << 8) | 8;
+    xv.box = (BoxRec) {0};
+    RegionNull(&xv.clip);
+
+    lorieXvFormat = (XvFormatRec) { .depth = pScreen->rootDepth, .visual = pScreen->rootVisual };
+
+    lorieXvPort = (XvPortRec) {
+        .id = FakeClientID(0),
+        .pAdaptor = &lorieXvAdaptor,
+        .time = currentTime,
+    };
+
+    lorieXvAdaptor = (XvAdaptorRec) {
+        .base_id = lorieXvPort.id,
+        .type = XvInputMask | XvImageMask,
+        .name = (char*) "Lorie GLES Video Overlay",
+        .nEncodings = 1,
+        .pEncodings = &lorieXvEncoding,
+        .nFormats = 1,
+        .pFormats = &lorieXvFormat,
+        .nAttributes = ARRAY_SIZE(lorieXvAttributes),
+        .pAttributes = lorieXvAttributes,
+        .nImages = ARRAY_SIZE(lorieXvImages),
+        .pImages = lorieXvImages,
+        .nPorts = 1,
+        .pPorts = &lorieXvPort,
+        .pScreen = pScreen,
+        .ddPutImage = lorieXvPutImage,
+        .ddStopVideo = lorieXvStopVideo,
+        .ddSetPortAttribute = lorieXvSetPortAttribute,
+        .ddGetPortAttribute = lorieXvGetPortAttribute,
+        .ddQueryBestSize = lorieXvQueryBestSize,
+        .ddQueryImageAttributes = lorieXvQueryImageAttributes,
+    };
+    lorieXvEncoding.pScreen = pScreen;
+
+    if (!AddResource(lorieXvPort.id, XvGetRTPort(), &lorieXvPort))
+        return FALSE;
+
+    pxvs = dixLookupPrivate(&pScreen->devPrivates, XvGetScreenKey());
+    pxvs->nAdaptors = 1;
+    pxvs->pAdaptors = &lorieXvAdaptor;
+    return TRUE;
+}
@@ -441,9 +441,18 @@ add_library(Xlorie SHARED
         "lorie/InitOutput.c"
         "lorie/InitInput.c"
         "lorie/InputXKB.c"
+        "lorie/compositor.c"
+        "lorie/latency.c"
+        "lorie/layers.c"
+        "lorie/parallel.c"
+        "lorie/pixmapslab.c"
         "lorie/lorieGlx.c"
         "lorie/renderer.c"
+        "lorie/residency.c"
+        "lorie/shadow.c"
+        "lorie/tiledamage.c"
         "lorie/tx11-request.c"
+        "lorie/xv.c"
         "${CMAKE_CURRENT_BINARY_DIR}/tx11.c"
         "${CMAKE_CURRENT_BINARY_DIR}/tx11.h")
 target_include_directories(Xlorie PRIVATE ${inc} "libxcvt/include" "libxkbcommon/include")
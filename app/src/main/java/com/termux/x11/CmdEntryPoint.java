@@ -115,8 +115,10 @@ public class CmdEntryPoint extends ICmdEntryInterface.Stub {
 
     public static native boolean start(String[] args);
     public native void windowChanged(Surface surface);
+    public native void outputChanged(int output, Surface surface, int width, int height);
     public native ParcelFileDescriptor getXConnection();
     public native ParcelFileDescriptor getLogcatOutput();
+    public native void trimMemory(int level);
 
     static {
         System.loadLibrary("Xlorie");
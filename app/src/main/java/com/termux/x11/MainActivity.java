@@ -36,7 +36,9 @@ import android.preference.PreferenceManager;
 import android.provider.Settings;
 import android.util.DisplayMetrics;
 import android.util.Log;
+import android.view.Choreographer;
 import android.view.InputDevice;
+import android.view.InputEvent;
 import android.view.KeyEvent;
 import android.view.PointerIcon;
 import android.view.SurfaceHolder;
@@ -56,10 +58,12 @@ import androidx.appcompat.app.AppCompatActivity;
 import androidx.core.app.NotificationCompat;
 import androidx.viewpager.widget.ViewPager;
 
+import com.termux.x11.input.InputEventBuffer;
 import com.termux.x11.input.InputEventSender;
 import com.termux.x11.input.InputStub;
 import com.termux.x11.input.RenderStub;
 import com.termux.x11.input.TouchInputHandler;
+import com.termux.x11.utils.ExternalOutputs;
 import com.termux.x11.utils.FullscreenWorkaround;
 import com.termux.x11.utils.KeyInterceptor;
 import com.termux.x11.utils.PermissionUtils;
@@ -67,6 +71,9 @@ import com.termux.x11.utils.SamsungDexUtils;
 import com.termux.x11.utils.TermuxX11ExtraKeys;
 import com.termux.x11.utils.X11ToolbarViewPager;
 
+import java.nio.ByteBuffer;
+import java.nio.charset.StandardCharsets;
+import java.util.function.BooleanSupplier;
 import java.util.regex.PatternSyntaxException;
 
 @SuppressLint("ApplySharedPref")
@@ -90,6 +97,13 @@ public class MainActivity extends AppCompatActivity implements View.OnApplyWindo
     private SurfaceHolder.Callback mLorieViewCallback;
     private View.OnKeyListener mLorieKeyListener;
     private boolean filterOutWinKey = false;
+    private ExternalOutputs mExternalOutputs;
+    private final InputEventBuffer mEvents = new InputEventBuffer(this::commitEvents);
+    private boolean mFlushScheduled = false;
+    private final Choreographer.FrameCallback mFlushEvents = (frameTimeNanos) -> {
+        mFlushScheduled = false;
+        mEvents.commit();
+    };
 
     @SuppressLint("StaticFieldLeak")
     private static MainActivity instance;
@@ -215,11 +229,11 @@ public class MainActivity extends AppCompatActivity implements View.OnApplyWindo
             }
         };
 
-        lorieView.setOnTouchListener((v, e) -> mInputHandler.handleTouchEvent(getLorieView(), e));
-        lorieView.setOnHoverListener((v, e) -> mInputHandler.handleTouchEvent(getLorieView(), e));
-        lorieView.setOnGenericMotionListener((v, e) -> mInputHandler.handleTouchEvent(getLorieView(), e));
-        lorieView.setOnCapturedPointerListener((v, e) -> mInputHandler.handleCapturedEvent(getLorieView(), e));
-        lorieView.setOnKeyListener(mLorieKeyListener);
+        lorieView.setOnTouchListener((v, e) -> stamped(e, () -> mInputHandler.handleTouchEvent(getLorieView(), e)));
+        lorieView.setOnHoverListener((v, e) -> stamped(e, () -> mInputHandler.handleTouchEvent(getLorieView(), e)));
+        lorieView.setOnGenericMotionListener((v, e) -> stamped(e, () -> mInputHandler.handleTouchEvent(getLorieView(), e)));
+        lorieView.setOnCapturedPointerListener((v, e) -> stamped(e, () -> mInputHandler.handleCapturedEvent(getLorieView(), e)));
+        lorieView.setOnKeyListener((v, k, e) -> stamped(e, () -> mLorieKeyListener.onKey(v, k, e)));
         lorieView.getHolder().addCallback(mLorieViewCallback);
 
         Rect r = lorieView.getHolder().getSurfaceFrame();
@@ -263,6 +277,9 @@ public class MainActivity extends AppCompatActivity implements View.OnApplyWindo
         mNotification = buildNotification();
         mNotificationManager.notify(mNotificationId, mNotification);
 
+        mExternalOutputs = new ExternalOutputs(this, () -> service);
+        mExternalOutputs.start();
+
         CmdEntryPoint.requestConnection();
         onPreferencesChanged();
 
@@ -279,6 +296,7 @@ public class MainActivity extends AppCompatActivity implements View.OnApplyWindo
                     startLogcat(logcatOutput.detachFd());
 
                 tryConnect();
+                mExternalOutputs.reattach();
             }
         } catch (Exception e) {
             Log.e("MainActivity", "Something went wrong while we were establishing connection", e);
@@ -375,6 +393,26 @@ public class MainActivity extends AppCompatActivity implements View.OnApplyWindo
         super.onPause();
     }
 
+    @Override
+    protected void onDestroy() {
+        mExternalOutputs.stop();
+        super.onDestroy();
+    }
+
+    @Override
+    public void onTrimMemory(int level) {
+        super.onTrimMemory(level);
+
+        // X server runs in another process and does not get memory pressure callbacks itself.
+        if (service != null) {
+            try {
+                service.trimMemory(level);
+            } catch (RemoteException e) {
+                e.printStackTrace();
+            }
+        }
+    }
+
     @Override
     public void setTheme(int resId) {
         boolean externalDisplayRequested = getIntent().getBooleanExtra(REQUEST_LAUNCH_EXTERNAL_DISPLAY, false);
@@ -455,7 +493,7 @@ public class MainActivity extends AppCompatActivity implements View.OnApplyWindo
     public boolean handleKey(KeyEvent e) {
         if (filterOutWinKey && (e.getKeyCode() == KEYCODE_META_LEFT || e.getKeyCode() == KEYCODE_META_RIGHT || e.isMetaPressed()))
             return false;
-        mLorieKeyListener.onKey(null, e.getKeyCode(), e);
+        stamped(e, () -> mLorieKeyListener.onKey(null, e.getKeyCode(), e));
         return true;
     }
 
@@ -647,15 +685,60 @@ public class MainActivity extends AppCompatActivity implements View.OnApplyWindo
         handler.postDelayed(this::checkXEvents, 300);
     }
 
+    /** Events sent while Android event is handled carry its time, so latency is measured from the moment Android got it. */
+    private boolean stamped(InputEvent e, BooleanSupplier handler) {
+        mEvents.setEventTime(e.getEventTime());
+        try {
+            return handler.getAsBoolean();
+        } finally {
+            mEvents.setEventTime(0);
+        }
+    }
+
+    /** Motion is sent to X server in batches, once per input frame. */
+    private void scheduleFlush() {
+        if (!mFlushScheduled) {
+            mFlushScheduled = true;
+            Choreographer.getInstance().postFrameCallback(mFlushEvents);
+        }
+    }
+
+    @Override
+    public void sendMouseEvent(float x, float y, int whichButton, boolean buttonDown, boolean relative) {
+        mEvents.mouse(x, y, whichButton, buttonDown, relative);
+        if (whichButton == BUTTON_UNDEFINED || whichButton == BUTTON_SCROLL)
+            scheduleFlush();
+        else
+            mEvents.commit();
+    }
+
+    @Override
+    public void sendTouchEvent(int action, int id, int x, int y) {
+        // Negative action marks the end of MotionEvent, all of its pointers are sent with the frame.
+        if (action >= 0)
+            mEvents.touch(action, id, x, y);
+        scheduleFlush();
+    }
+
     @Override
     public void sendMouseWheelEvent(float deltaX, float deltaY) {
         sendMouseEvent(deltaX, deltaY, BUTTON_SCROLL, false, true);
     }
 
+    @Override
+    public boolean sendKeyEvent(int scanCode, int keyCode, boolean keyDown) {
+        mEvents.key(scanCode, keyCode, keyDown);
+        mEvents.commit();
+        return true;
+    }
+
     @Override
     public void sendTextEvent(String text) {
-        if (text != null)
-            text.codePoints().forEach(MainActivity.this::sendUnicodeEvent);
+        // Whole text goes with one request, so X server changes keymap for it only once.
+        if (text != null) {
+            mEvents.commit();
+            sendText(text.getBytes(StandardCharsets.UTF_8));
+        }
     }
 
     private native void connect(int fd);
@@ -663,10 +746,8 @@ public class MainActivity extends AppCompatActivity implements View.OnApplyWindo
     private native void startLogcat(int fd);
     private native void setClipboardSyncEnabled(boolean enabled);
     private native void sendWindowChange(int width, int height);
-    public native void sendMouseEvent(float x, float y, int whichButton, boolean buttonDown, boolean relative);
-    public native void sendTouchEvent(int action, int id, int x, int y);
-    public native boolean sendKeyEvent(int scanCode, int keyCode, boolean keyDown);
-    public native void sendUnicodeEvent(int unicode);
+    private native void commitEvents(ByteBuffer buffer, int count);
+    private native void sendText(byte[] text);
 
     static {
         System.loadLibrary("Xlorie");
@@ -0,0 +1,113 @@
+package com.termux.x11.input;
+
+import android.os.SystemClock;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * Input events encoded for native code. Events are written to a direct buffer shared with native code
+ * and the whole batch is handed over with a single JNI call instead of one call per event.
+ * All functions should be called from Android UI thread.
+ */
+public class InputEventBuffer {
+    /** Hands {@code count} encoded events over to native code. */
+    public interface Committer {
+        void commit(ByteBuffer buffer, int count);
+    }
+
+    // These constants must match lorieJavaEvent in android.c.
+    public static final int KIND_TOUCH = 0;
+    public static final int KIND_MOUSE = 1;
+    public static final int KIND_KEY = 2;
+    private static final int FLAG_DOWN = 1;
+    private static final int FLAG_RELATIVE = 2;
+    // int kind, time, detail, code, flags; float x, y
+    private static final int EVENT_SIZE = 28;
+    private static final int CAPACITY = 256;
+
+    private final ByteBuffer mBuffer = ByteBuffer.allocateDirect(EVENT_SIZE * CAPACITY).order(ByteOrder.nativeOrder());
+    private final Committer mCommitter;
+    private int mCount = 0;
+    private long mEventTime = 0;
+    // Captured pointer motion of the current frame, it is sent as one event.
+    private float mRelativeX = 0, mRelativeY = 0;
+    private int mRelativeTime = 0;
+
+    public InputEventBuffer(Committer committer) {
+        mCommitter = committer;
+    }
+
+    public void mouse(float x, float y, int button, boolean down, boolean relative) {
+        // Deltas are summed exactly, so batching does not make the pointer drift. Time is the one of the first delta.
+        if (relative && button == InputStub.BUTTON_UNDEFINED) {
+            if (mRelativeX == 0 && mRelativeY == 0)
+                mRelativeTime = time();
+            mRelativeX += x;
+            mRelativeY += y;
+            return;
+        }
+
+        put(KIND_MOUSE, button, 0, (down ? FLAG_DOWN : 0) | (relative ? FLAG_RELATIVE : 0), x, y);
+    }
+
+    public void touch(int action, int id, int x, int y) {
+        put(KIND_TOUCH, action, id, 0, x, y);
+    }
+
+    /** Android key code is translated to X key code by native code if there is no scan code. */
+    public void key(int scanCode, int keyCode, boolean down) {
+        put(KIND_KEY, keyCode, scanCode, down ? FLAG_DOWN : 0, 0, 0);
+    }
+
+    /**
+     * Events encoded until the next call are stamped with the time of Android event which caused them
+     * (i.e. {@link android.view.InputEvent#getEventTime()}), 0 means time of encoding.
+     */
+    public void setEventTime(long uptimeMillis) {
+        mEventTime = uptimeMillis;
+    }
+
+    /** Sends all encoded events. */
+    public void commit() {
+        putRelative();
+        if (mCount > 0)
+            mCommitter.commit(mBuffer, mCount);
+        mCount = 0;
+    }
+
+    // Both Android and X server use CLOCK_MONOTONIC milliseconds.
+    private int time() {
+        return (int) (mEventTime != 0 ? mEventTime : SystemClock.uptimeMillis());
+    }
+
+    // Motion goes before the event which follows it.
+    private void putRelative() {
+        if (mRelativeX == 0 && mRelativeY == 0)
+            return;
+
+        write(KIND_MOUSE, mRelativeTime, InputStub.BUTTON_UNDEFINED, 0, FLAG_RELATIVE, mRelativeX, mRelativeY);
+        mRelativeX = mRelativeY = 0;
+    }
+
+    private void put(int kind, int detail, int code, int flags, float x, float y) {
+        putRelative();
+        write(kind, time(), detail, code, flags, x, y);
+    }
+
+    private void write(int kind, int time, int detail, int code, int flags, float x, float y) {
+        if (mCount == CAPACITY) {
+            mCommitter.commit(mBuffer, mCount);
+            mCount = 0;
+        }
+
+        int offset = mCount++ * EVENT_SIZE;
+        mBuffer.putInt(offset, kind)
+                .putInt(offset + 4, time)
+                .putInt(offset + 8, detail)
+                .putInt(offset + 12, code)
+                .putInt(offset + 16, flags)
+                .putFloat(offset + 20, x)
+                .putFloat(offset + 24, y);
+    }
+}
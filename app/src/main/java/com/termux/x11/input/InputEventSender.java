@@ -43,6 +43,11 @@ public final class InputEventSender {
         mInjector.sendMouseEvent((int) pos.x, (int) pos.y, button, down, relative);
     }
 
+    /** Sends movement of captured pointer, deltas are neither rounded nor accelerated. */
+    public void sendRelativeMotion(float deltaX, float deltaY) {
+        mInjector.sendMouseEvent(deltaX, deltaY, InputStub.BUTTON_UNDEFINED, false, true);
+    }
+
     public void sendMouseDown(PointF pos, int button) {
         sendMouseEvent(pos, button, true, false);
     }
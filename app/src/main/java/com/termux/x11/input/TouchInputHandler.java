@@ -210,12 +210,17 @@ public class TouchInputHandler {
 
         int button = mouseButtonFromMotionEvent(e);
         switch(e.getAction()) {
-            case MotionEvent.ACTION_MOVE:
-                if (e.getX() == 0 && e.getY() == 0)
-                    return true;
-//                mInjector.sendMouseEvent(new PointF(e.getX(), e.getY()), InputStub.BUTTON_UNDEFINED, false, true);
-                moveCursorByOffset(-e.getX()*2, -e.getY()*2);
+            case MotionEvent.ACTION_MOVE: {
+                // Android batches samples of high-rate mice, every one of them is a delta which must be counted.
+                float deltaX = e.getX(), deltaY = e.getY();
+                for (int i = 0; i < e.getHistorySize(); i++) {
+                    deltaX += e.getHistoricalX(i);
+                    deltaY += e.getHistoricalY(i);
+                }
+                if (deltaX != 0 || deltaY != 0)
+                    mInjector.sendRelativeMotion(deltaX, deltaY);
                 break;
+            }
             case MotionEvent.ACTION_BUTTON_PRESS:
                 mInjector.sendMouseDown(mRenderData.getCursorPosition(), button);
                 break;
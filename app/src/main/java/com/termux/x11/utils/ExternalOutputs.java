@@ -0,0 +1,133 @@
+package com.termux.x11.utils;
+
+import android.app.Activity;
+import android.app.Presentation;
+import android.content.Context;
+import android.graphics.PixelFormat;
+import android.hardware.display.DisplayManager;
+import android.os.RemoteException;
+import android.util.Log;
+import android.view.Display;
+import android.view.Surface;
+import android.view.SurfaceHolder;
+import android.view.SurfaceView;
+
+import androidx.annotation.NonNull;
+
+import com.termux.x11.ICmdEntryInterface;
+
+import java.util.function.Supplier;
+
+/**
+ * Shows a presentation with a surface on every external display (i.e. DeX or HDMI monitor).
+ * X server uses these surfaces as additional RandR outputs.
+ */
+public class ExternalOutputs implements DisplayManager.DisplayListener {
+    private static final String TAG = ExternalOutputs.class.getSimpleName();
+    private static final int MAX_OUTPUTS = 4; // Synchronized with RENDERER_MAX_OUTPUTS, output 0 is activity itself.
+
+    private final Activity activity;
+    private final DisplayManager displayManager;
+    private final Supplier<ICmdEntryInterface> service;
+    private final Presentation[] presentations = new Presentation[MAX_OUTPUTS];
+    private final SurfaceHolder[] holders = new SurfaceHolder[MAX_OUTPUTS];
+
+    public ExternalOutputs(Activity activity, Supplier<ICmdEntryInterface> service) {
+        this.activity = activity;
+        this.service = service;
+        displayManager = (DisplayManager) activity.getSystemService(Context.DISPLAY_SERVICE);
+    }
+
+    public void start() {
+        displayManager.registerDisplayListener(this, null);
+        for (Display display : displayManager.getDisplays(DisplayManager.DISPLAY_CATEGORY_PRESENTATION))
+            onDisplayAdded(display.getDisplayId());
+    }
+
+    public void stop() {
+        displayManager.unregisterDisplayListener(this);
+        for (int i = 1; i < MAX_OUTPUTS; i++)
+            if (presentations[i] != null) {
+                presentations[i].dismiss();
+                presentations[i] = null;
+            }
+    }
+
+    /** Sends surfaces again, X server could be restarted or connected after presentations were shown. */
+    public void reattach() {
+        for (int i = 1; i < MAX_OUTPUTS; i++) {
+            SurfaceHolder holder = holders[i];
+            if (holder != null && holder.getSurface().isValid())
+                outputChanged(i, holder.getSurface(), holder.getSurfaceFrame().width(), holder.getSurfaceFrame().height());
+        }
+    }
+
+    @Override
+    public void onDisplayAdded(int displayId) {
+        Display display = displayManager.getDisplay(displayId);
+        if (display == null || (display.getFlags() & Display.FLAG_PRESENTATION) == 0
+                || display.getDisplayId() == activity.getWindowManager().getDefaultDisplay().getDisplayId())
+            return;
+
+        for (int i = 1; i < MAX_OUTPUTS; i++)
+            if (presentations[i] != null && presentations[i].getDisplay().getDisplayId() == displayId)
+                return;
+
+        for (int i = 1; i < MAX_OUTPUTS; i++)
+            if (presentations[i] == null) {
+                show(i, display);
+                return;
+            }
+
+        Log.w(TAG, "No free output for display " + displayId);
+    }
+
+    @Override
+    public void onDisplayRemoved(int displayId) {
+        for (int i = 1; i < MAX_OUTPUTS; i++)
+            if (presentations[i] != null && presentations[i].getDisplay().getDisplayId() == displayId) {
+                presentations[i].dismiss();
+                presentations[i] = null;
+            }
+    }
+
+    @Override
+    public void onDisplayChanged(int displayId) {}
+
+    private void show(int output, Display display) {
+        Presentation presentation = new Presentation(activity, display);
+        SurfaceView view = new SurfaceView(presentation.getContext());
+        view.getHolder().addCallback(new SurfaceHolder.Callback() {
+            @Override public void surfaceCreated(@NonNull SurfaceHolder holder) {
+                holder.setFormat(PixelFormat.OPAQUE);
+                holders[output] = holder;
+            }
+
+            @Override public void surfaceChanged(@NonNull SurfaceHolder holder, int format, int width, int height) {
+                Log.d(TAG, "Output " + output + " surface was changed: " + width + "x" + height);
+                outputChanged(output, holder.getSurface(), width, height);
+            }
+
+            @Override public void surfaceDestroyed(@NonNull SurfaceHolder holder) {
+                holders[output] = null;
+                outputChanged(output, null, 0, 0);
+            }
+        });
+
+        presentation.setContentView(view);
+        presentation.show();
+        presentations[output] = presentation;
+    }
+
+    private void outputChanged(int output, Surface surface, int width, int height) {
+        ICmdEntryInterface s = service.get();
+        if (s == null)
+            return;
+
+        try {
+            s.outputChanged(output, surface, width, height);
+        } catch (RemoteException e) {
+            e.printStackTrace();
+        }
+    }
+}
@@ -0,0 +1,273 @@
+/*
+ * Cost of damage tracking per frame: tile bitmap (-tiledamage) against region union which damage layer
+ * does by default. Boxes are added one by one as damage reports them, then boxes to copy are taken and
+ * damage is emptied, like every frame of lorieTimerCallback. Damage layer unions raw reports to its region
+ * too, so tiles side also pays for clipping every box and copying it to the region lorieDamageReport empties.
+ *
+ *     bench-damage [-s WxH] [-n frames] [trace...]
+ *
+ * Without arguments synthetic workloads are used. A trace file has one damaged box per line as
+ * "x1 y1 x2 y2", an empty line ends a frame. Region side and the union paid by tiles side are measured
+ * only if pixman was found.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scrnintstr.h"
+#include "lorie.h"
+#ifdef HAVE_PIXMAN
+#include <pixman.h>
+#endif
+
+#define SPANS 256
+
+typedef struct {
+    BoxRec *boxes;
+    int *frameEnds; // Index after the last box of every frame
+    int count, frames, size, frameSize;
+} trace;
+
+static void traceBox(trace *t, int x1, int y1, int x2, int y2) {
+    if (t->count == t->size) {
+        t->size = t->size ? t->size * 2 : 1024;
+        t->boxes = realloc(t->boxes, t->size * sizeof(BoxRec));
+    }
+    t->boxes[t->count++] = (BoxRec) { x1, y1, x2, y2 };
+}
+
+static void traceFrame(trace *t) {
+    if (t->frames && t->frameEnds[t->frames - 1] == t->count)
+        return;
+    if (t->frames == t->frameSize) {
+        t->frameSize = t->frameSize ? t->frameSize * 2 : 256;
+        t->frameEnds = realloc(t->frameEnds, t->frameSize * sizeof(int));
+    }
+    t->frameEnds[t->frames++] = t->count;
+}
+
+static unsigned seed = 1;
+
+static int rnd(int n) {
+    seed = seed * 1103515245 + 12345;
+    return (int) ((seed >> 8) % (unsigned) n);
+}
+
+// Characters typed or printed to several lines of a terminal or editor.
+static void workloadTyping(trace *t, int w, int h, int frames) {
+    int f, i;
+    for (f = 0; f < frames; f++) {
+        int line = rnd(h / 16 - 4), column = rnd(w / 8 - 40);
+        for (i = 0; i < 40; i++)
+            traceBox(t, (column + i) * 8, (line + i / 20) * 16, (column + i + 1) * 8, (line + i / 20 + 1) * 16);
+        traceFrame(t);
+    }
+}
+
+// Terminal scrolling by a line: copy of most of the window and the new line.
+static void workloadScroll(trace *t, int w, int h, int frames) {
+    int f;
+    for (f = 0; f < frames; f++) {
+        traceBox(t, 0, 0, w, h - 16);
+        traceBox(t, 0, h - 16, w, h);
+        traceFrame(t);
+    }
+}
+
+// Web page or file manager redrawing many small scattered items.
+static void workloadScatter(trace *t, int w, int h, int frames) {
+    int f, i;
+    for (f = 0; f < frames; f++) {
+        for (i = 0; i < 500; i++) {
+            int x = rnd(w - 32), y = rnd(h - 32);
+            traceBox(t, x, y, x + 8 + rnd(24), y + 8 + rnd(24));
+        }
+        traceFrame(t);
+    }
+}
+
+// Video or game drawing the whole window every frame.
+static void workloadFull(trace *t, int w, int h, int frames) {
+    int f;
+    for (f = 0; f < frames; f++) {
+        traceBox(t, 0, 0, w, h);
+        traceFrame(t);
+    }
+}
+
+static int traceLoad(trace *t, const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[128];
+    int x1, y1, x2, y2;
+
+    if (!f)
+        return 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%d %d %d %d", &x1, &y1, &x2, &y2) == 4)
+            traceBox(t, x1, y1, x2, y2);
+        else
+            traceFrame(t);
+    }
+    traceFrame(t);
+    fclose(f);
+    return 1;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double area(const BoxRec *boxes, int n) {
+    double sum = 0;
+    int i;
+    for (i = 0; i < n; i++)
+        sum += (double) (boxes[i].x2 - boxes[i].x1) * (boxes[i].y2 - boxes[i].y1);
+    return sum;
+}
+
+static void benchTiles(trace *t, int w, int h) {
+    lorieTileDamagePtr tiles = lorieTileDamageCreate(w, h);
+    BoxRec spans[SPANS];
+    double start, elapsed, pixels = 0;
+    long boxes = 0;
+    int f, i = 0;
+#ifdef HAVE_PIXMAN
+    pixman_region16_t region, screen;
+
+    pixman_region_init(&region);
+    pixman_region_init_rect(&screen, 0, 0, w, h);
+#endif
+
+    start = now();
+    for (f = 0; f < t->frames; f++) {
+        int n;
+        for (; i < t->frameEnds[f]; i++) {
+#ifdef HAVE_PIXMAN
+            // Damage layer clips the report and unions it to the damage region, which is always empty here.
+            pixman_region16_t box;
+            pixman_box16_t *rects;
+            int count, k;
+            pixman_region_init_rect(&box, t->boxes[i].x1, t->boxes[i].y1,
+                                    t->boxes[i].x2 - t->boxes[i].x1, t->boxes[i].y2 - t->boxes[i].y1);
+            pixman_region_intersect(&box, &box, &screen);
+            pixman_region_union(&region, &region, &box);
+            rects = pixman_region_rectangles(&box, &count);
+            for (k = 0; k < count; k++)
+                lorieTileDamageAddBox(tiles, (const BoxRec*) &rects[k]);
+            pixman_region_clear(&region);
+            pixman_region_fini(&box);
+#else
+            lorieTileDamageAddBox(tiles, &t->boxes[i]);
+#endif
+        }
+        n = lorieTileDamageSpans(tiles, spans, SPANS);
+        if (n < 0) {
+            spans[0] = (BoxRec) { 0, 0, w, h };
+            n = 1;
+        }
+        boxes += n;
+        pixels += area(spans, n);
+        lorieTileDamageEmpty(tiles);
+    }
+    elapsed = now() - start;
+
+    printf("  tiles:  %8.2f us/frame %8.1f boxes/frame %8.3f Mpix/frame to copy\n",
+           elapsed * 1e6 / t->frames, (double) boxes / t->frames, pixels / t->frames / 1e6);
+    lorieTileDamageDestroy(tiles);
+#ifdef HAVE_PIXMAN
+    pixman_region_fini(&region);
+    pixman_region_fini(&screen);
+#endif
+}
+
+#ifdef HAVE_PIXMAN
+static void benchRegion(trace *t, int w, int h) {
+    pixman_region16_t region, screen;
+    double start = now(), elapsed, pixels = 0;
+    long boxes = 0;
+    int f, i = 0;
+
+    pixman_region_init(&region);
+    pixman_region_init_rect(&screen, 0, 0, w, h);
+    for (f = 0; f < t->frames; f++) {
+        pixman_box16_t *rects;
+        int n;
+
+        // Damage layer clips every report to the drawable and unions it to accumulated region.
+        for (; i < t->frameEnds[f]; i++) {
+            pixman_region16_t box;
+            pixman_region_init_rect(&box, t->boxes[i].x1, t->boxes[i].y1,
+                                    t->boxes[i].x2 - t->boxes[i].x1, t->boxes[i].y2 - t->boxes[i].y1);
+            pixman_region_intersect(&box, &box, &screen);
+            pixman_region_union(&region, &region, &box);
+            pixman_region_fini(&box);
+        }
+        rects = pixman_region_rectangles(&region, &n);
+        boxes += n;
+        pixels += area((const BoxRec*) rects, n);
+        pixman_region_clear(&region);
+    }
+    elapsed = now() - start;
+
+    printf("  region: %8.2f us/frame %8.1f boxes/frame %8.3f Mpix/frame to copy\n",
+           elapsed * 1e6 / t->frames, (double) boxes / t->frames, pixels / t->frames / 1e6);
+    pixman_region_fini(&region);
+    pixman_region_fini(&screen);
+}
+#endif
+
+static void bench(const char *name, trace *t, int w, int h) {
+    printf("%s, %dx%d, %d frames, %.1f damaged boxes/frame\n", name, w, h, t->frames, (double) t->count / t->frames);
+    benchTiles(t, w, h);
+#ifdef HAVE_PIXMAN
+    benchRegion(t, w, h);
+#endif
+    free(t->boxes);
+    free(t->frameEnds);
+    memset(t, 0, sizeof(*t));
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        void (*generate)(trace *t, int w, int h, int frames);
+    } workloads[] = {
+        { "typing", workloadTyping },
+        { "scroll", workloadScroll },
+        { "scatter", workloadScatter },
+        { "full", workloadFull },
+    };
+    int w = 1920, h = 1080, frames = 2000, i;
+    trace t = {0};
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &w, &h) == 2)
+            i++;
+        else {
+            fprintf(stderr, "usage: %s [-s WxH] [-n frames] [trace...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (i < argc) {
+        for (; i < argc; i++) {
+            if (!traceLoad(&t, argv[i]) || !t.frames) {
+                fprintf(stderr, "can not read trace %s\n", argv[i]);
+                return 1;
+            }
+            bench(argv[i], &t, w, h);
+        }
+        return 0;
+    }
+
+    for (i = 0; i < (int) (sizeof(workloads) / sizeof(workloads[0])); i++) {
+        workloads[i].generate(&t, w, h, frames);
+        bench(workloads[i].name, &t, w, h);
+    }
+    return 0;
+}
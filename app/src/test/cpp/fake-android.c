@@ -0,0 +1,200 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fake-android.h"
+
+#define FAKE_MAX 64
+
+struct ASurfaceTransaction {
+    void *context;
+    ASurfaceTransaction_OnComplete func;
+    ASurfaceControl *changed[FAKE_MAX];
+    int count;
+};
+
+struct ASurfaceTransactionStats {
+    ASurfaceControl **controls;
+    size_t count;
+};
+
+static ASurfaceControl *controls[FAKE_MAX];
+static int controlCount;
+static ASurfaceTransaction *applied[FAKE_MAX];
+static int appliedCount;
+int fakeBuffersAllocated;
+
+int32_t ANativeWindow_getWidth(ANativeWindow *window) {
+    return window->width;
+}
+
+int32_t ANativeWindow_getHeight(ANativeWindow *window) {
+    return window->height;
+}
+
+int AHardwareBuffer_allocate(const AHardwareBuffer_Desc *desc, AHardwareBuffer **outBuffer) {
+    AHardwareBuffer *buf = calloc(1, sizeof(*buf));
+    buf->desc = *desc;
+    buf->desc.stride = desc->width + 3; // Stride differs from width on real devices too
+    buf->data = calloc((size_t) buf->desc.stride * desc->height, 4);
+    buf->lastFence = -1;
+    fakeBuffersAllocated++;
+    *outBuffer = buf;
+    return 0;
+}
+
+void AHardwareBuffer_release(AHardwareBuffer *buffer) {
+    free(buffer->data);
+    free(buffer);
+    fakeBuffersAllocated--;
+}
+
+void AHardwareBuffer_describe(const AHardwareBuffer *buffer, AHardwareBuffer_Desc *outDesc) {
+    *outDesc = buffer->desc;
+}
+
+int AHardwareBuffer_lock(AHardwareBuffer *buffer, uint64_t usage, int32_t fence, const ARect *rect, void **outVirtualAddress) {
+    buffer->locks++;
+    buffer->lastFence = fence;
+    if (fence >= 0)
+        close(fence);
+    *outVirtualAddress = buffer->data;
+    return 0;
+}
+
+int AHardwareBuffer_unlock(AHardwareBuffer *buffer, int32_t *fence) {
+    return 0;
+}
+
+static ASurfaceControl *fakeCreateFromWindow(ANativeWindow *parent, const char *name) {
+    ASurfaceControl *sc = calloc(1, sizeof(*sc));
+    sc->parent = parent;
+    sc->z = -1;
+    controls[controlCount++] = sc;
+    return sc;
+}
+
+static void fakeRelease(ASurfaceControl *sc) {
+    sc->released = 1;
+}
+
+static ASurfaceTransaction *fakeCreate(void) {
+    return calloc(1, sizeof(ASurfaceTransaction));
+}
+
+static void fakeDelete(ASurfaceTransaction *t) {
+    int i;
+    for (i = 0; i < appliedCount; i++)
+        if (applied[i] == t)
+            return; // Kept until completion like in SurfaceFlinger
+    free(t);
+}
+
+static void fakeApply(ASurfaceTransaction *t) {
+    if (t->func)
+        applied[appliedCount++] = t;
+}
+
+static void fakeSetOnComplete(ASurfaceTransaction *t, void *context, ASurfaceTransaction_OnComplete func) {
+    t->context = context;
+    t->func = func;
+}
+
+static void fakeReparent(ASurfaceTransaction *t, ASurfaceControl *sc, ASurfaceControl *parent) {
+    sc->parent = NULL;
+}
+
+static void fakeSetBuffer(ASurfaceTransaction *t, ASurfaceControl *sc, AHardwareBuffer *buf, int fence) {
+    sc->buffer = buf;
+    sc->buffers++;
+    t->changed[t->count++] = sc;
+}
+
+static void fakeSetGeometry(ASurfaceTransaction *t, ASurfaceControl *sc, const ARect *src, const ARect *dst, int32_t transform) {
+    sc->dst = *dst;
+}
+
+static void fakeSetZOrder(ASurfaceTransaction *t, ASurfaceControl *sc, int32_t z) {
+    sc->z = z;
+    sc->zChanges++;
+}
+
+static void fakeSetVisibility(ASurfaceTransaction *t, ASurfaceControl *sc, int8_t visibility) {
+    sc->visible = visibility;
+    sc->visibilityChanges++;
+}
+
+static void fakeSetBufferTransparency(ASurfaceTransaction *t, ASurfaceControl *sc, int8_t transparency) {
+}
+
+static void fakeSetDamageRegion(ASurfaceTransaction *t, ASurfaceControl *sc, const ARect *rects, uint32_t count) {
+    uint32_t i;
+
+    sc->damage = rects[0];
+    for (i = 1; i < count; i++) {
+        sc->damage.left = min(sc->damage.left, rects[i].left);
+        sc->damage.top = min(sc->damage.top, rects[i].top);
+        sc->damage.right = max(sc->damage.right, rects[i].right);
+        sc->damage.bottom = max(sc->damage.bottom, rects[i].bottom);
+    }
+}
+
+static void fakeGetASurfaceControls(ASurfaceTransactionStats *stats, ASurfaceControl ***out, size_t *count) {
+    *out = malloc(stats->count * sizeof(ASurfaceControl*) + 1);
+    memcpy(*out, stats->controls, stats->count * sizeof(ASurfaceControl*));
+    *count = stats->count;
+}
+
+static void fakeReleaseASurfaceControls(ASurfaceControl **controls) {
+    free(controls);
+}
+
+static int fakeGetPreviousReleaseFenceFd(ASurfaceTransactionStats *stats, ASurfaceControl *sc) {
+    size_t i;
+    for (i = 0; i < stats->count; i++)
+        if (stats->controls[i] == sc)
+            return open("/dev/null", O_RDONLY);
+    fprintf(stderr, "surface control is not in transaction stats\n");
+    abort();
+}
+
+int fakeSurfaceComplete(void) {
+    int i, count = appliedCount;
+
+    appliedCount = 0;
+    for (i = 0; i < count; i++) {
+        ASurfaceTransaction *t = applied[i];
+        ASurfaceTransactionStats stats = { t->changed, t->count };
+        t->func(t->context, &stats);
+        free(t);
+    }
+    return count;
+}
+
+ASurfaceControl *fakeSurfaceControl(int index) {
+    return index < controlCount ? controls[index] : NULL;
+}
+
+int fakeSurfaceControls(void) {
+    return controlCount;
+}
+
+lorieSurfaceApi fakeSurfaceApi = {
+    .ASurfaceControl_createFromWindow = fakeCreateFromWindow,
+    .ASurfaceControl_release = fakeRelease,
+    .ASurfaceTransaction_create = fakeCreate,
+    .ASurfaceTransaction_delete = fakeDelete,
+    .ASurfaceTransaction_apply = fakeApply,
+    .ASurfaceTransaction_setOnComplete = fakeSetOnComplete,
+    .ASurfaceTransaction_reparent = fakeReparent,
+    .ASurfaceTransaction_setBuffer = fakeSetBuffer,
+    .ASurfaceTransaction_setGeometry = fakeSetGeometry,
+    .ASurfaceTransaction_setZOrder = fakeSetZOrder,
+    .ASurfaceTransaction_setVisibility = fakeSetVisibility,
+    .ASurfaceTransaction_setBufferTransparency = fakeSetBufferTransparency,
+    .ASurfaceTransaction_setDamageRegion = fakeSetDamageRegion,
+    .ASurfaceTransactionStats_getASurfaceControls = fakeGetASurfaceControls,
+    .ASurfaceTransactionStats_releaseASurfaceControls = fakeReleaseASurfaceControls,
+    .ASurfaceTransactionStats_getPreviousReleaseFenceFd = fakeGetPreviousReleaseFenceFd,
+};
@@ -0,0 +1,40 @@
+#pragma once
+/*
+ * Fake platform layer for host tests. Hardware buffers are plain memory, surface controls and
+ * transactions only record what was set. Completion callbacks are kept until the test lets
+ * the compositor release buffers with fakeSurfaceComplete.
+ */
+#include <android/native_window.h>
+#include <android/hardware_buffer.h>
+#include "scrnintstr.h"
+#include "lorie.h"
+#include "layers.h"
+
+struct ANativeWindow {
+    int width, height;
+};
+
+struct AHardwareBuffer {
+    AHardwareBuffer_Desc desc;
+    uint32_t *data;
+    int locks, lastFence;
+};
+
+struct ASurfaceControl {
+    ANativeWindow *parent; // NULL after it was reparented away
+    AHardwareBuffer *buffer; // Last buffer set
+    int buffers; // Number of setBuffer calls
+    ARect damage; // Extents of the last damage region
+    ARect dst;
+    int z, visible, zChanges, visibilityChanges;
+    int released;
+};
+
+extern lorieSurfaceApi fakeSurfaceApi;
+extern int fakeBuffersAllocated;
+
+// Runs callbacks of all applied transactions, every replaced buffer gets a release fence.
+int fakeSurfaceComplete(void);
+// Surface controls ever created, in order of creation.
+ASurfaceControl *fakeSurfaceControl(int index);
+int fakeSurfaceControls(void);
@@ -0,0 +1,246 @@
+/*
+ * Drawing throughput of a running X server, for comparing server options (-rasterthreads, -shadow)
+ * on the same device. Draws to an override-redirect window which covers up to 3840x2160 of the
+ * screen, so operations go straight to the screen pixmap.
+ *
+ *     lorie-bench [-n frames] [-s WxH] [test...]
+ *
+ * Tests are fill, vscroll, hscroll, putimage and blend (if built with xcb-render), all of them by default.
+ * Each one draws the given number of full-window frames and prints frames and megapixels per second.
+ * Scrolling and blending read the screen, so they show the difference -shadow makes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <xcb/xcb.h>
+#ifdef HAVE_XCB_RENDER
+#include <xcb/render.h>
+#endif
+
+#define unused __attribute__((unused))
+#define BENCH_SCROLL 16
+
+typedef struct {
+    xcb_connection_t *conn;
+    xcb_window_t win;
+    xcb_gcontext_t gc;
+    int width, height, depth;
+    uint8_t *image;
+#ifdef HAVE_XCB_RENDER
+    xcb_render_picture_t translucent, picture; // Translucent source of full window size and the window
+#endif
+} bench;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Round trip, all requests sent before it are done when it returns.
+static void roundtrip(bench *b) {
+    free(xcb_get_input_focus_reply(b->conn, xcb_get_input_focus(b->conn), NULL));
+}
+
+static void fill(bench *b, int frame) {
+    uint32_t color = frame & 1 ? 0x00336699 : 0x00996633;
+    xcb_rectangle_t rect = { 0, 0, b->width, b->height };
+
+    xcb_change_gc(b->conn, b->gc, XCB_GC_FOREGROUND, &color);
+    xcb_poly_fill_rectangle(b->conn, b->win, b->gc, 1, &rect);
+}
+
+static void vscroll(bench *b, unused int frame) {
+    xcb_copy_area(b->conn, b->win, b->win, b->gc, 0, BENCH_SCROLL, 0, 0, b->width, b->height - BENCH_SCROLL);
+}
+
+static void hscroll(bench *b, unused int frame) {
+    xcb_copy_area(b->conn, b->win, b->win, b->gc, BENCH_SCROLL, 0, 0, 0, b->width - BENCH_SCROLL, b->height);
+}
+
+// Image is sent in strips which fit into one request, every strip is still large enough to be drawn in bands.
+static void putimage(bench *b, unused int frame) {
+    uint32_t max = xcb_get_maximum_request_length(b->conn) * 4 - 64;
+    int stride = b->width * 4, rows = (int) (max / stride), y;
+
+    for (y = 0; y < b->height; y += rows) {
+        int h = y + rows > b->height ? b->height - y : rows;
+        xcb_put_image(b->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, b->win, b->gc, b->width, h, 0, y, 0, b->depth,
+                      h * stride, b->image + (size_t) y * stride);
+    }
+}
+
+#ifdef HAVE_XCB_RENDER
+static xcb_render_pictformat_t findFormat(const xcb_render_query_pict_formats_reply_t *formats, xcb_visualid_t visual) {
+    xcb_render_pictscreen_iterator_t screens = xcb_render_query_pict_formats_screens_iterator(formats);
+    for (; screens.rem; xcb_render_pictscreen_next(&screens)) {
+        xcb_render_pictdepth_iterator_t depths = xcb_render_pictscreen_depths_iterator(screens.data);
+        for (; depths.rem; xcb_render_pictdepth_next(&depths)) {
+            xcb_render_pictvisual_iterator_t visuals = xcb_render_pictdepth_visuals_iterator(depths.data);
+            for (; visuals.rem; xcb_render_pictvisual_next(&visuals))
+                if (visuals.data->visual == visual)
+                    return visuals.data->format;
+        }
+    }
+    return XCB_NONE;
+}
+
+static xcb_render_pictformat_t findArgb32(const xcb_render_query_pict_formats_reply_t *formats) {
+    xcb_render_pictforminfo_iterator_t i = xcb_render_query_pict_formats_formats_iterator(formats);
+    for (; i.rem; xcb_render_pictforminfo_next(&i))
+        if (i.data->type == XCB_RENDER_PICT_TYPE_DIRECT && i.data->depth == 32
+            && i.data->direct.alpha_mask == 0xff && i.data->direct.alpha_shift == 24
+            && i.data->direct.red_shift == 16 && i.data->direct.green_shift == 8 && i.data->direct.blue_shift == 0)
+            return i.data->id;
+    return XCB_NONE;
+}
+
+// Creates pictures for blend test, returns 0 if server has no RENDER.
+static int renderInit(bench *b, xcb_screen_t *screen) {
+    xcb_render_query_pict_formats_reply_t *formats;
+    xcb_render_pictformat_t argb, window;
+    xcb_render_color_t color = { 0x3000, 0x4000, 0x5000, 0x8000 }; // Premultiplied, half transparent
+    xcb_rectangle_t rect = { 0, 0, b->width, b->height };
+    xcb_pixmap_t pixmap;
+
+    if (!xcb_get_extension_data(b->conn, &xcb_render_id)->present)
+        return 0;
+    formats = xcb_render_query_pict_formats_reply(b->conn, xcb_render_query_pict_formats(b->conn), NULL);
+    if (!formats)
+        return 0;
+    argb = findArgb32(formats);
+    window = findFormat(formats, screen->root_visual);
+    free(formats);
+    if (argb == XCB_NONE || window == XCB_NONE)
+        return 0;
+
+    // Source is a pixmap rather than solid fill, pixman has fast paths for solid sources.
+    pixmap = xcb_generate_id(b->conn);
+    xcb_create_pixmap(b->conn, 32, pixmap, b->win, b->width, b->height);
+    b->translucent = xcb_generate_id(b->conn);
+    xcb_render_create_picture(b->conn, b->translucent, pixmap, argb, 0, NULL);
+    xcb_free_pixmap(b->conn, pixmap);
+    xcb_render_fill_rectangles(b->conn, XCB_RENDER_PICT_OP_SRC, b->translucent, color, 1, &rect);
+
+    b->picture = xcb_generate_id(b->conn);
+    xcb_render_create_picture(b->conn, b->picture, b->win, window, 0, NULL);
+    return 1;
+}
+
+// Translucent window over the whole screen, every pixel of the screen is read and written.
+static void blend(bench *b, unused int frame) {
+    xcb_render_composite(b->conn, XCB_RENDER_PICT_OP_OVER, b->translucent, XCB_NONE, b->picture,
+                         0, 0, 0, 0, 0, 0, b->width, b->height);
+}
+#endif
+
+static const struct {
+    const char *name;
+    void (*draw)(bench *b, int frame);
+} tests[] = {
+    { "fill", fill },
+    { "vscroll", vscroll },
+    { "hscroll", hscroll },
+    { "putimage", putimage },
+#ifdef HAVE_XCB_RENDER
+    { "blend", blend },
+#endif
+};
+
+static void run(bench *b, int index, int frames) {
+    double start, elapsed;
+    int i;
+
+    // First frame warms up caches and lets the server allocate everything it needs.
+    tests[index].draw(b, 0);
+    roundtrip(b);
+
+    start = now();
+    for (i = 1; i <= frames; i++)
+        tests[index].draw(b, i);
+    roundtrip(b);
+    elapsed = now() - start;
+
+    printf("%-10s %dx%d: %8.1f frames/s %10.1f Mpix/s\n", tests[index].name, b->width, b->height,
+           frames / elapsed, (double) frames * b->width * b->height / elapsed / 1e6);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    bench b = {0};
+    xcb_screen_t *screen;
+    uint32_t values[2];
+    int frames = 100, width = 3840, height = 2160, i, j, ran = 0;
+    size_t size;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2)
+            i++;
+        else {
+            fprintf(stderr, "usage: %s [-n frames] [-s WxH] [fill|vscroll|hscroll|putimage|blend...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    b.conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(b.conn)) {
+        fprintf(stderr, "can not connect to X server\n");
+        return 1;
+    }
+
+    screen = xcb_setup_roots_iterator(xcb_get_setup(b.conn)).data;
+    b.width = width < screen->width_in_pixels ? width : screen->width_in_pixels;
+    b.height = height < screen->height_in_pixels ? height : screen->height_in_pixels;
+    b.depth = screen->root_depth;
+    if (b.depth != 24 && b.depth != 32) {
+        fprintf(stderr, "depth %d is not supported\n", b.depth);
+        return 1;
+    }
+
+    size = (size_t) b.width * b.height * 4;
+    if (!(b.image = malloc(size))) {
+        fprintf(stderr, "can not allocate %zu bytes\n", size);
+        return 1;
+    }
+    for (i = 0; i < (int) (size / 4); i++)
+        ((uint32_t*) b.image)[i] = i * 2654435761u;
+
+    b.win = xcb_generate_id(b.conn);
+    values[0] = screen->black_pixel;
+    values[1] = 1;
+    xcb_create_window(b.conn, XCB_COPY_FROM_PARENT, b.win, screen->root, 0, 0, b.width, b.height, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                      XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT, values);
+    xcb_map_window(b.conn, b.win);
+
+    b.gc = xcb_generate_id(b.conn);
+    values[0] = 0;
+    xcb_create_gc(b.conn, b.gc, b.win, XCB_GC_GRAPHICS_EXPOSURES, values);
+#ifdef HAVE_XCB_RENDER
+    if (!renderInit(&b, screen)) {
+        fprintf(stderr, "server has no usable RENDER extension\n");
+        return 1;
+    }
+#endif
+    roundtrip(&b);
+
+    for (j = 0; j < (int) (sizeof(tests) / sizeof(tests[0])); j++) {
+        int selected = i == argc;
+        int k;
+
+        for (k = i; k < argc; k++)
+            selected |= !strcmp(argv[k], tests[j].name);
+        if (selected) {
+            run(&b, j, frames);
+            ran++;
+        }
+    }
+
+    free(b.image);
+    xcb_disconnect(b.conn);
+    return ran ? 0 : 1;
+}
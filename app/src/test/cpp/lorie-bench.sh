@@ -0,0 +1,20 @@
+#!/bin/sh
+# Runs lorie-bench against termux-x11 started with every given -rasterthreads value and extra options,
+# e.g. `lorie-bench.sh "1 2 4 8" -shadow`. Activity must stay in foreground while it runs.
+# Speedup of the shadow framebuffer is the difference of vscroll, hscroll and blend between
+# `lorie-bench.sh 1` and `lorie-bench.sh 1 -shadow`.
+set -e
+
+threads="${1:-1 2 4 8}"
+[ $# -gt 0 ] && shift
+display="${BENCH_DISPLAY:-:9}"
+
+for n in $threads; do
+    termux-x11 "$display" -rasterthreads "$n" "$@" >/dev/null 2>&1 &
+    server=$!
+    sleep 3
+    echo "-rasterthreads $n $*"
+    DISPLAY="$display" "$(dirname "$0")/lorie-bench" || true
+    kill "$server"
+    wait "$server" 2>/dev/null || true
+done
@@ -0,0 +1,381 @@
+/*
+ * Input latency of a running X server while another client saturates it with PutImage. Pointer motion stamped
+ * with CLOCK_MONOTONIC is sent the way activity sends it, a small window redraws itself on every motion, and
+ * QueryLatency histograms are collected for an idle phase and for a phase with full-screen PutImage load.
+ *
+ *     lorie-latency [-t seconds] [-r events/s] [-s WxH] [-b]
+ *
+ * Events go through the input ring by default, -b sends EventBatch requests instead. Ring is taken over
+ * from activity until the check exits, so run it against a server started for it by lorie-latency.sh.
+ * It must run on the same device, stamps are compared with monotonic clock of the server and TX11 is refused
+ * to remote clients.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+
+// Requests and structures of tx11.xml and inputring.h, the check does not depend on generated code.
+#define TX11_EVENT_BATCH 6
+#define TX11_INPUT_RING 7
+#define TX11_QUERY_LATENCY 8
+#define TX11_EVENT_KIND_MOUSE 1
+#define INPUT_RING_SIZE 1024
+
+typedef struct {
+    uint8_t kind, detail, down, relative;
+    uint32_t time, code;
+    float x, y;
+} tx11Event;
+
+typedef struct {
+    _Atomic uint32_t head;
+    uint8_t pad0[60];
+    _Atomic uint32_t tail;
+    uint8_t pad1[60];
+    tx11Event events[INPUT_RING_SIZE];
+} inputRing;
+
+static const char *stages[] = { "received", "queued", "delivered", "presented" };
+
+static xcb_extension_t tx11 = { "TX11", 0 };
+
+typedef struct {
+    xcb_connection_t *conn;
+    xcb_window_t win;
+    xcb_gcontext_t gc;
+    inputRing *ring;
+    int notify;
+} input;
+
+typedef struct {
+    pthread_t thread;
+    _Atomic int stop;
+    int width, height;
+    unsigned long frames;
+} load;
+
+static uint32_t monotonicMillis(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Sends TX11 request of `size` bytes (multiple of 4), xcb fills the first 4 bytes. Requests with fds are checked.
+static unsigned sendRequest(xcb_connection_t *conn, uint8_t opcode, int isvoid, void *data, size_t size,
+                            int *fds, unsigned nfds) {
+    xcb_protocol_request_t req = { .count = 1, .ext = &tx11, .opcode = opcode, .isvoid = isvoid };
+    struct iovec parts[3];
+
+    parts[2].iov_base = data;
+    parts[2].iov_len = size;
+    return nfds ? xcb_send_request_with_fds(conn, XCB_REQUEST_CHECKED, parts + 2, &req, nfds, fds)
+                : xcb_send_request(conn, 0, parts + 2, &req);
+}
+
+static int ringAttach(input *in) {
+    int fd = (int) syscall(SYS_memfd_create, "lorie-latency", 0), fds[2];
+    uint32_t req = 0;
+    xcb_generic_error_t *err;
+    void *map;
+    int ok;
+
+    if (fd < 0 || ftruncate(fd, sizeof(inputRing)) < 0
+        || (map = mmap(NULL, sizeof(inputRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return 0;
+    in->ring = map;
+    in->notify = eventfd(0, EFD_CLOEXEC);
+    fds[0] = fd;
+    fds[1] = dup(in->notify);
+
+    err = xcb_request_check(in->conn, (xcb_void_cookie_t) { sendRequest(in->conn, TX11_INPUT_RING, 1, &req, 4, fds, 2) });
+    ok = !err;
+    free(err);
+    return ok;
+}
+
+static void sendMotion(input *in, float x, float y) {
+    tx11Event ev = { .kind = TX11_EVENT_KIND_MOUSE, .time = monotonicMillis(), .x = x, .y = y };
+
+    if (in->ring) {
+        uint32_t head = atomic_load_explicit(&in->ring->head, memory_order_relaxed);
+        uint64_t one = 1;
+
+        // Full ring means server is not reading at all, activity would fall back to EventBatch here.
+        if (head - atomic_load_explicit(&in->ring->tail, memory_order_acquire) >= INPUT_RING_SIZE)
+            return;
+        in->ring->events[head & (INPUT_RING_SIZE - 1)] = ev;
+        atomic_store_explicit(&in->ring->head, head + 1, memory_order_release);
+        if (write(in->notify, &one, sizeof(one)) < 0)
+            return;
+    } else {
+        struct {
+            uint32_t header;
+            uint16_t count, pad;
+            uint32_t time; // Time the request was sent
+            tx11Event ev;
+        } req = { .count = 1, .time = ev.time, .ev = ev };
+
+        sendRequest(in->conn, TX11_EVENT_BATCH, 1, &req, sizeof(req), NULL, 0);
+        xcb_flush(in->conn);
+    }
+}
+
+// Returns counts of stage * buckets histograms and stores the number of buckets, NULL on error.
+static uint32_t *queryLatency(xcb_connection_t *conn, int *buckets) {
+    struct {
+        uint32_t header;
+        uint8_t reset, pad[3];
+    } req = { .reset = 1 };
+    xcb_generic_error_t *err = NULL;
+    uint8_t *reply = xcb_wait_for_reply(conn, sendRequest(conn, TX11_QUERY_LATENCY, 0, &req, sizeof(req), NULL, 0), &err);
+    uint16_t count[2];
+
+    free(err);
+    if (!reply)
+        return NULL;
+    memcpy(count, reply + 8, sizeof(count));
+    if (count[0] != sizeof(stages) / sizeof(stages[0]) || !count[1]) {
+        free(reply);
+        return NULL;
+    }
+    *buckets = count[1];
+    memmove(reply, reply + 32, count[0] * count[1] * 4);
+    return (uint32_t*) reply;
+}
+
+// Upper bound of bucket which holds given percentile, -1 if it is the last one or there are no events.
+static int percentile(const uint32_t *counts, int buckets, double p) {
+    unsigned long total = 0, sum = 0;
+    int i;
+
+    for (i = 0; i < buckets; i++)
+        total += counts[i];
+    for (i = 0; i < buckets - 1 && total; i++)
+        if ((sum += counts[i]) >= p * total)
+            return 1 << i;
+    return -1;
+}
+
+static void printHistograms(const char *phase, const uint32_t *counts, int buckets) {
+    int stage, i;
+
+    printf("%s\n%-14s", phase, "");
+    for (stage = 0; stage < 4; stage++)
+        printf("%11s", stages[stage]);
+    for (i = 0; i < buckets; i++) {
+        char label[32];
+        if (!i)
+            snprintf(label, sizeof(label), "< 1 ms");
+        else if (i < buckets - 1)
+            snprintf(label, sizeof(label), "%d-%d ms", 1 << (i - 1), 1 << i);
+        else
+            snprintf(label, sizeof(label), ">= %d ms", 1 << (i - 1));
+        printf("\n  %-12s", label);
+        for (stage = 0; stage < 4; stage++)
+            printf("%11u", counts[stage * buckets + i]);
+    }
+    for (i = 0; i < 2; i++) {
+        printf("\n  %-12s", i ? "p99 <" : "p50 <");
+        for (stage = 0; stage < 4; stage++) {
+            int bound = percentile(counts + stage * buckets, buckets, i ? 0.99 : 0.5);
+            if (bound < 0)
+                printf("%11s", "-");
+            else
+                printf("%8d ms", bound);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+// Full-screen PutImage as fast as server takes it, from its own connection.
+static void *loadThread(void *data) {
+    load *l = data;
+    xcb_connection_t *conn = xcb_connect(NULL, NULL);
+    xcb_screen_t *screen;
+    xcb_window_t win;
+    xcb_gcontext_t gc;
+    uint32_t values[2], max;
+    uint8_t *image;
+    int stride, rows, y, i;
+
+    if (xcb_connection_has_error(conn))
+        return NULL;
+    screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+    l->width = l->width < screen->width_in_pixels ? l->width : screen->width_in_pixels;
+    l->height = l->height < screen->height_in_pixels ? l->height : screen->height_in_pixels;
+    stride = l->width * 4;
+    max = xcb_get_maximum_request_length(conn) * 4 - 64;
+    rows = (int) (max / stride);
+    if (!(image = malloc((size_t) stride * l->height))) {
+        xcb_disconnect(conn);
+        return NULL;
+    }
+    for (i = 0; i < l->width * l->height; i++)
+        ((uint32_t*) image)[i] = i * 2654435761u;
+
+    win = xcb_generate_id(conn);
+    values[0] = screen->black_pixel;
+    values[1] = 1;
+    xcb_create_window(conn, XCB_COPY_FROM_PARENT, win, screen->root, 0, 0, l->width, l->height, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                      XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT, values);
+    // Below the input window, so pointer motion still goes to it.
+    values[0] = XCB_STACK_MODE_BELOW;
+    xcb_configure_window(conn, win, XCB_CONFIG_WINDOW_STACK_MODE, values);
+    xcb_map_window(conn, win);
+    gc = xcb_generate_id(conn);
+    values[0] = 0;
+    xcb_create_gc(conn, gc, win, XCB_GC_GRAPHICS_EXPOSURES, values);
+
+    while (!atomic_load(&l->stop)) {
+        for (y = 0; y < l->height; y += rows) {
+            int h = y + rows > l->height ? l->height - y : rows;
+            xcb_put_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, win, gc, l->width, h, 0, y, 0, screen->root_depth,
+                          h * stride, image + (size_t) y * stride);
+        }
+        // Keeps one frame in flight at most, like a client which waits for its frames to be done.
+        free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+        l->frames++;
+    }
+
+    free(image);
+    xcb_disconnect(conn);
+    return NULL;
+}
+
+// Pointer moves around a circle in the input window, every motion redraws a square under it.
+static void runPhase(input *in, double seconds, int rate) {
+    double start = now(), next = start;
+    xcb_generic_event_t *ev;
+    int i = 0;
+
+    while (now() - start < seconds) {
+        float angle = (float) (i++ % 360) * (float) M_PI / 180;
+        sendMotion(in, 128 + 100 * cosf(angle), 128 + 100 * sinf(angle));
+
+        next += 1.0 / rate;
+        do {
+            while ((ev = xcb_poll_for_event(in->conn))) {
+                if ((ev->response_type & 0x7f) == XCB_MOTION_NOTIFY) {
+                    xcb_motion_notify_event_t *motion = (xcb_motion_notify_event_t*) ev;
+                    xcb_rectangle_t rect = { motion->event_x - 8, motion->event_y - 8, 16, 16 };
+                    xcb_poly_fill_rectangle(in->conn, in->win, in->gc, 1, &rect);
+                    xcb_flush(in->conn);
+                }
+                free(ev);
+            }
+            usleep(500);
+        } while (now() < next);
+    }
+}
+
+static int collect(input *in, const char *phase) {
+    uint32_t *counts;
+    int buckets;
+
+    if (!(counts = queryLatency(in->conn, &buckets))) {
+        fprintf(stderr, "QueryLatency failed\n");
+        return 0;
+    }
+    printHistograms(phase, counts, buckets);
+    free(counts);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    input in = { .notify = -1 };
+    load l = { .width = 3840, .height = 2160 };
+    xcb_screen_t *screen;
+    uint32_t values[3];
+    double seconds = 5;
+    int rate = 120, batch = 0, buckets, i;
+    char phase[64];
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            rate = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &l.width, &l.height) == 2)
+            i++;
+        else if (!strcmp(argv[i], "-b"))
+            batch = 1;
+        else {
+            fprintf(stderr, "usage: %s [-t seconds] [-r events/s] [-s WxH] [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (rate <= 0 || seconds <= 0) {
+        fprintf(stderr, "rate and time must be positive\n");
+        return 1;
+    }
+
+    in.conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(in.conn)) {
+        fprintf(stderr, "can not connect to X server\n");
+        return 1;
+    }
+    if (!xcb_get_extension_data(in.conn, &tx11)->present) {
+        fprintf(stderr, "server has no TX11 extension\n");
+        return 1;
+    }
+    if (!batch && !ringAttach(&in)) {
+        fprintf(stderr, "can not attach input ring, use -b\n");
+        return 1;
+    }
+
+    screen = xcb_setup_roots_iterator(xcb_get_setup(in.conn)).data;
+    in.win = xcb_generate_id(in.conn);
+    values[0] = screen->white_pixel;
+    values[1] = 1;
+    values[2] = XCB_EVENT_MASK_POINTER_MOTION;
+    xcb_create_window(in.conn, XCB_COPY_FROM_PARENT, in.win, screen->root, 0, 0, 256, 256, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                      XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK, values);
+    xcb_map_window(in.conn, in.win);
+    in.gc = xcb_generate_id(in.conn);
+    values[0] = screen->black_pixel;
+    xcb_create_gc(in.conn, in.gc, in.win, XCB_GC_FOREGROUND, values);
+    xcb_flush(in.conn);
+
+    // Histograms collected before the check started are dropped.
+    free(queryLatency(in.conn, &buckets));
+    printf("%s, %d events/s, %.0f s per phase\n", batch ? "EventBatch" : "input ring", rate, seconds);
+
+    runPhase(&in, seconds, rate);
+    if (!collect(&in, "idle"))
+        return 1;
+
+    if (pthread_create(&l.thread, NULL, loadThread, &l)) {
+        fprintf(stderr, "can not start load\n");
+        return 1;
+    }
+    runPhase(&in, seconds, rate);
+    atomic_store(&l.stop, 1);
+    pthread_join(l.thread, NULL);
+    snprintf(phase, sizeof(phase), "putimage %dx%d, %.1f frames/s", l.width, l.height, l.frames / seconds);
+    if (!collect(&in, phase))
+        return 1;
+
+    xcb_disconnect(in.conn);
+    return 0;
+}
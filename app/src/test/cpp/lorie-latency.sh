@@ -0,0 +1,15 @@
+#!/bin/sh
+# Runs lorie-latency against termux-x11 started with the given options, e.g. `lorie-latency.sh -shadow`.
+# Server is started only for the check because its input ring is taken over from activity.
+# Activity must stay in foreground while it runs. LATENCY_ARGS are passed to lorie-latency.
+set -e
+
+display="${BENCH_DISPLAY:-:9}"
+
+termux-x11 "$display" "$@" >/dev/null 2>&1 &
+server=$!
+sleep 3
+echo "termux-x11 $*"
+DISPLAY="$display" "$(dirname "$0")/lorie-latency" $LATENCY_ARGS || true
+kill "$server"
+wait "$server" 2>/dev/null || true
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include "native_window.h"
+
+typedef struct AHardwareBuffer AHardwareBuffer;
+
+typedef struct AHardwareBuffer_Desc {
+    uint32_t width, height, layers, format;
+    uint64_t usage;
+    uint32_t stride, rfu0;
+    uint64_t rfu1;
+} AHardwareBuffer_Desc;
+
+enum {
+    AHARDWAREBUFFER_USAGE_CPU_READ_RARELY = 2UL,
+    AHARDWAREBUFFER_USAGE_CPU_WRITE_OFTEN = 3UL << 4,
+    AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE = 1UL << 8,
+    AHARDWAREBUFFER_USAGE_COMPOSER_OVERLAY = 1UL << 11,
+};
+
+int AHardwareBuffer_allocate(const AHardwareBuffer_Desc *desc, AHardwareBuffer **outBuffer);
+void AHardwareBuffer_release(AHardwareBuffer *buffer);
+void AHardwareBuffer_describe(const AHardwareBuffer *buffer, AHardwareBuffer_Desc *outDesc);
+int AHardwareBuffer_lock(AHardwareBuffer *buffer, uint64_t usage, int32_t fence, const ARect *rect, void **outVirtualAddress);
+int AHardwareBuffer_unlock(AHardwareBuffer *buffer, int32_t *fence);
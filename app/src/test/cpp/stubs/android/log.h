@@ -0,0 +1,5 @@
+#pragma once
+#include <stdio.h>
+
+#define ANDROID_LOG_DEBUG 3
+#define __android_log_print(prio, tag, ...) (fprintf(stderr, "%s: ", tag), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+
+typedef struct ANativeWindow ANativeWindow;
+
+typedef struct ARect {
+    int32_t left, top, right, bottom;
+} ARect;
+
+int32_t ANativeWindow_getWidth(ANativeWindow *window);
+int32_t ANativeWindow_getHeight(ANativeWindow *window);
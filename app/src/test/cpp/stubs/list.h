@@ -0,0 +1,39 @@
+#pragma once
+// Same intrusive list as X server's list.h, only what lorie code uses.
+#include <stddef.h>
+
+struct xorg_list {
+    struct xorg_list *next, *prev;
+};
+
+static inline void xorg_list_init(struct xorg_list *list) {
+    list->next = list->prev = list;
+}
+
+static inline void xorg_list_add(struct xorg_list *entry, struct xorg_list *head) {
+    entry->next = head->next;
+    entry->prev = head;
+    head->next->prev = entry;
+    head->next = entry;
+}
+
+static inline void xorg_list_append(struct xorg_list *entry, struct xorg_list *head) {
+    xorg_list_add(entry, head->prev);
+}
+
+static inline void xorg_list_del(struct xorg_list *entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    xorg_list_init(entry);
+}
+
+static inline int xorg_list_is_empty(struct xorg_list *head) {
+    return head->next == head;
+}
+
+#define xorg_list_entry(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+#define xorg_list_for_each_entry(pos, head, member)                                   \
+    for (pos = xorg_list_entry((head)->next, __typeof__(*pos), member);            \
+         &pos->member != (head);                                                   \
+         pos = xorg_list_entry(pos->member.next, __typeof__(*pos), member))
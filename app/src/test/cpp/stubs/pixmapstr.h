@@ -0,0 +1,16 @@
+#pragma once
+#include "scrnintstr.h"
+
+typedef struct {
+    unsigned short width, height;
+    unsigned char depth, bitsPerPixel;
+} DrawableRec;
+
+typedef struct _Pixmap {
+    DrawableRec drawable;
+    int refcnt;
+    int devKind;
+    union {
+        void *ptr;
+    } devPrivate;
+} PixmapRec;
@@ -0,0 +1,134 @@
+#pragma once
+/*
+ * Region stand-in. Boxes are kept as given and may overlap, which is enough for code which only
+ * copies or marks the area covered by a region. Extents are exact.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int Bool;
+typedef uint32_t CARD32;
+typedef uint16_t CARD16;
+typedef int16_t INT16;
+typedef uint8_t CARD8;
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+// Same layout as pixman_box16_t.
+typedef struct {
+    int16_t x1, y1, x2, y2;
+} BoxRec, *BoxPtr;
+
+typedef struct {
+    BoxRec extents;
+    BoxRec *boxes;
+    int count, size;
+} RegionRec, *RegionPtr;
+
+static inline int RegionNumRects(RegionPtr reg) {
+    return reg->count;
+}
+
+static inline BoxPtr RegionRects(RegionPtr reg) {
+    return reg->boxes;
+}
+
+static inline BoxPtr RegionExtents(RegionPtr reg) {
+    return &reg->extents;
+}
+
+static inline Bool RegionNotEmpty(RegionPtr reg) {
+    return reg->count > 0;
+}
+
+static inline void RegionNull(RegionPtr reg) {
+    memset(reg, 0, sizeof(*reg));
+}
+
+static inline void RegionUninit(RegionPtr reg) {
+    free(reg->boxes);
+    RegionNull(reg);
+}
+
+static inline void RegionEmpty(RegionPtr reg) {
+    reg->count = 0;
+    memset(&reg->extents, 0, sizeof(reg->extents));
+}
+
+static inline void RegionAppendBox(RegionPtr reg, const BoxRec *box) {
+    if (box->x1 >= box->x2 || box->y1 >= box->y2)
+        return;
+    if (reg->count == reg->size) {
+        reg->size = reg->size ? reg->size * 2 : 4;
+        reg->boxes = realloc(reg->boxes, reg->size * sizeof(BoxRec));
+    }
+    if (!reg->count)
+        reg->extents = *box;
+    else {
+        reg->extents.x1 = min(reg->extents.x1, box->x1);
+        reg->extents.y1 = min(reg->extents.y1, box->y1);
+        reg->extents.x2 = max(reg->extents.x2, box->x2);
+        reg->extents.y2 = max(reg->extents.y2, box->y2);
+    }
+    reg->boxes[reg->count++] = *box;
+}
+
+static inline void RegionInit(RegionPtr reg, BoxPtr box, int size) {
+    RegionNull(reg);
+    if (box)
+        RegionAppendBox(reg, box);
+}
+
+static inline void RegionReset(RegionPtr reg, BoxPtr box) {
+    RegionEmpty(reg);
+    RegionAppendBox(reg, box);
+}
+
+static inline Bool RegionCopy(RegionPtr dst, RegionPtr src) {
+    int i;
+    if (dst == src)
+        return TRUE;
+    RegionEmpty(dst);
+    for (i = 0; i < src->count; i++)
+        RegionAppendBox(dst, &src->boxes[i]);
+    return TRUE;
+}
+
+static inline Bool RegionUnion(RegionPtr dst, RegionPtr a, RegionPtr b) {
+    RegionRec tmp;
+    int i;
+
+    RegionNull(&tmp);
+    for (i = 0; i < a->count; i++)
+        RegionAppendBox(&tmp, &a->boxes[i]);
+    for (i = 0; i < b->count; i++)
+        RegionAppendBox(&tmp, &b->boxes[i]);
+    RegionUninit(dst);
+    *dst = tmp;
+    return TRUE;
+}
+
+static inline Bool RegionIntersect(RegionPtr dst, RegionPtr a, RegionPtr b) {
+    RegionRec tmp;
+    int i, j;
+
+    RegionNull(&tmp);
+    for (i = 0; i < a->count; i++)
+        for (j = 0; j < b->count; j++) {
+            BoxRec box = {
+                max(a->boxes[i].x1, b->boxes[j].x1), max(a->boxes[i].y1, b->boxes[j].y1),
+                min(a->boxes[i].x2, b->boxes[j].x2), min(a->boxes[i].y2, b->boxes[j].y2),
+            };
+            RegionAppendBox(&tmp, &box);
+        }
+    RegionUninit(dst);
+    *dst = tmp;
+    return TRUE;
+}
@@ -0,0 +1,27 @@
+#pragma once
+/*
+ * Minimal stand-ins for X server headers, just enough for lorie sources which only use
+ * basic types, boxes and regions. Layouts match the server where lorie code depends on them.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "regionstr.h"
+
+typedef struct _Client *ClientPtr;
+typedef struct _Pixmap *PixmapPtr;
+typedef struct _Window *WindowPtr;
+
+typedef struct _Screen {
+    int width, height;
+} ScreenRec, *ScreenPtr;
+
+typedef struct {
+    ScreenPtr screens[1];
+} ScreenInfo;
+
+extern ScreenInfo screenInfo;
+
+static inline void *xallocarray(size_t n, size_t size) {
+    return n && size > SIZE_MAX / n ? NULL : malloc(n * size);
+}
@@ -0,0 +1,265 @@
+/*
+ * Buffer and surface bookkeeping of layers.c against the fake platform layer.
+ */
+
+#include <string.h>
+#include "pixmapstr.h"
+#include "fake-android.h"
+#include "test.h"
+
+static ScreenRec screen = { 640, 480 };
+ScreenInfo screenInfo = { { &screen } };
+
+static ANativeWindow window = { 640, 480 };
+
+typedef struct {
+    PixmapRec pixmap;
+    uint32_t data[64 * 32];
+} testPixmap;
+
+static void pixmapInit(testPixmap *p, int width, int height, uint32_t color) {
+    int i;
+
+    p->pixmap = (PixmapRec) { .drawable = { width, height, 24, 32 }, .devKind = width * 4, .devPrivate.ptr = p->data };
+    for (i = 0; i < width * height; i++)
+        p->data[i] = color + i;
+}
+
+// Buffer has exactly the contents of the pixmap.
+static int bufferMatches(AHardwareBuffer *buf, testPixmap *p) {
+    int y;
+
+    if (!buf || buf->desc.width != p->pixmap.drawable.width || buf->desc.height != p->pixmap.drawable.height)
+        return 0;
+    for (y = 0; y < p->pixmap.drawable.height; y++)
+        if (memcmp(buf->data + y * buf->desc.stride, p->data + y * p->pixmap.drawable.width, p->pixmap.drawable.width * 4))
+            return 0;
+    return 1;
+}
+
+static void update(lorieLayerPtr layer, testPixmap *p, int x1, int y1, int x2, int y2) {
+    BoxRec box = { x1, y1, x2, y2 };
+    RegionRec damage;
+
+    RegionInit(&damage, &box, 1);
+    lorieLayerUpdate(layer, &p->pixmap, &damage);
+    RegionUninit(&damage);
+    lorieLayersCommit();
+}
+
+static void draw(testPixmap *p, int x, int y, uint32_t color) {
+    p->data[y * p->pixmap.drawable.width + x] = color;
+}
+
+static void testFirstUpdate(void) {
+    lorieLayerPtr layer = lorieLayerCreate();
+    ASurfaceControl *sc;
+    testPixmap p;
+
+    pixmapInit(&p, 16, 8, 0x100);
+    lorieLayerUpdate(layer, &p.pixmap, NULL);
+    lorieLayersCommit();
+
+    sc = fakeSurfaceControl(fakeSurfaceControls() - 1);
+    CHECK(sc && sc->parent == &window);
+    CHECK(sc && sc->buffers == 1);
+    CHECK(sc && bufferMatches(sc->buffer, &p));
+    CHECK(fakeBuffersAllocated == 3);
+
+    lorieLayerDestroy(layer);
+    CHECK(sc && sc->released && !sc->parent);
+    CHECK(fakeBuffersAllocated == 0);
+    fakeSurfaceComplete();
+}
+
+// Every posted buffer gets damage which was only written to other buffers.
+static void testDamageCatchUp(void) {
+    lorieLayerPtr layer = lorieLayerCreate();
+    ASurfaceControl *sc;
+    AHardwareBuffer *first, *second;
+    testPixmap p;
+
+    pixmapInit(&p, 16, 8, 0x200);
+    lorieLayerUpdate(layer, &p.pixmap, NULL);
+    lorieLayersCommit();
+    sc = fakeSurfaceControl(fakeSurfaceControls() - 1);
+    first = sc->buffer;
+
+    draw(&p, 3, 2, 0xAAAA);
+    update(layer, &p, 3, 2, 4, 3);
+    second = sc->buffer;
+    CHECK(second != first);
+    CHECK(bufferMatches(second, &p));
+    CHECK(sc->damage.left == 3 && sc->damage.top == 2 && sc->damage.right == 4 && sc->damage.bottom == 3);
+
+    fakeSurfaceComplete();
+    draw(&p, 10, 5, 0xBBBB);
+    update(layer, &p, 10, 5, 11, 6);
+    CHECK(sc->buffer != second);
+    CHECK(bufferMatches(sc->buffer, &p));
+    CHECK(sc->buffers == 3);
+
+    lorieLayerDestroy(layer);
+    fakeSurfaceComplete();
+}
+
+// Buffers which compositor did not release are not written, damage waits for one of them.
+static void testHeldBuffers(void) {
+    lorieLayerPtr layer = lorieLayerCreate();
+    ASurfaceControl *sc;
+    AHardwareBuffer *front;
+    testPixmap p;
+    int locks;
+
+    pixmapInit(&p, 16, 8, 0x300);
+    lorieLayerUpdate(layer, &p.pixmap, NULL);
+    lorieLayersCommit();
+    sc = fakeSurfaceControl(fakeSurfaceControls() - 1);
+
+    draw(&p, 1, 1, 0x1111);
+    update(layer, &p, 1, 1, 2, 2);
+    draw(&p, 2, 2, 0x2222);
+    update(layer, &p, 2, 2, 3, 3);
+    CHECK(sc->buffers == 3);
+
+    // Both buffers replaced so far are still held, nothing is posted and front buffer is untouched.
+    front = sc->buffer;
+    locks = front->locks;
+    draw(&p, 3, 3, 0x3333);
+    update(layer, &p, 3, 3, 4, 4);
+    CHECK(sc->buffers == 3);
+    CHECK(sc->buffer == front);
+    CHECK(front->locks == locks);
+
+    // Compositor releases them, pending damage is posted even though this update has none.
+    CHECK(fakeSurfaceComplete() == 2);
+    update(layer, &p, 0, 0, 0, 0);
+    CHECK(sc->buffers == 4);
+    CHECK(sc->buffer != front);
+    CHECK(bufferMatches(sc->buffer, &p));
+    CHECK(sc->damage.left == 3 && sc->damage.top == 3 && sc->damage.right == 4 && sc->damage.bottom == 4);
+    CHECK(sc->buffer->lastFence >= 0); // Release fence was waited for by lock
+
+    // Nothing changed, nothing is posted.
+    update(layer, &p, 0, 0, 0, 0);
+    CHECK(sc->buffers == 4);
+
+    lorieLayerDestroy(layer);
+    fakeSurfaceComplete();
+}
+
+// Late release of buffers which were replaced by resize does not touch the new ones.
+static void testResize(void) {
+    lorieLayerPtr layer = lorieLayerCreate();
+    ASurfaceControl *sc;
+    testPixmap p;
+
+    pixmapInit(&p, 16, 8, 0x400);
+    lorieLayerUpdate(layer, &p.pixmap, NULL);
+    lorieLayersCommit();
+    update(layer, &p, 0, 0, 16, 8);
+    update(layer, &p, 0, 0, 16, 8);
+    sc = fakeSurfaceControl(fakeSurfaceControls() - 1);
+
+    pixmapInit(&p, 32, 16, 0x500);
+    update(layer, &p, 0, 0, 4, 4);
+    CHECK(fakeBuffersAllocated == 3);
+    CHECK(bufferMatches(sc->buffer, &p));
+    fakeSurfaceComplete();
+
+    // New buffers: first is front, the other two are free.
+    draw(&p, 20, 10, 0x5555);
+    update(layer, &p, 20, 10, 21, 11);
+    draw(&p, 21, 10, 0x6666);
+    update(layer, &p, 21, 10, 22, 11);
+    CHECK(sc->buffers == 6);
+    CHECK(bufferMatches(sc->buffer, &p));
+
+    lorieLayerDestroy(layer);
+    fakeSurfaceComplete();
+}
+
+// New parent surface gets the buffer which was shown last, without copying anything.
+static void testReattach(void) {
+    ANativeWindow other = { 640, 480 };
+    lorieLayerPtr layer = lorieLayerCreate();
+    ASurfaceControl *sc, *next;
+    AHardwareBuffer *front;
+    testPixmap p;
+    int locks;
+
+    pixmapInit(&p, 16, 8, 0x600);
+    lorieLayerUpdate(layer, &p.pixmap, NULL);
+    lorieLayersCommit();
+    sc = fakeSurfaceControl(fakeSurfaceControls() - 1);
+    front = sc->buffer;
+    locks = front->locks;
+
+    lorieLayersSetParent(&other);
+    CHECK(sc->released && !sc->parent);
+
+    update(layer, &p, 0, 0, 0, 0);
+    next = fakeSurfaceControl(fakeSurfaceControls() - 1);
+    CHECK(next != sc && next->parent == &other);
+    CHECK(next->buffer == front && next->buffers == 1);
+    CHECK(front->locks == locks);
+
+    // Damage after reattaching goes to another buffer, previous surface is not asked for its fence.
+    draw(&p, 0, 0, 0x7777);
+    update(layer, &p, 0, 0, 1, 1);
+    CHECK(next->buffer != front && bufferMatches(next->buffer, &p));
+    fakeSurfaceComplete();
+
+    lorieLayersSetParent(&window);
+    lorieLayerDestroy(layer);
+    fakeSurfaceComplete();
+}
+
+// Only changes of order and visibility are sent.
+static void testStack(void) {
+    lorieLayerPtr a = lorieLayerCreate(), b = lorieLayerCreate(), list[2];
+    ASurfaceControl *sa, *sb;
+    testPixmap p;
+
+    pixmapInit(&p, 16, 8, 0x700);
+    lorieLayerUpdate(a, &p.pixmap, NULL);
+    sa = fakeSurfaceControl(fakeSurfaceControls() - 1);
+    lorieLayerUpdate(b, &p.pixmap, NULL);
+    sb = fakeSurfaceControl(fakeSurfaceControls() - 1);
+    lorieLayerPlace(a, 10, 20, FALSE);
+    lorieLayerPlace(b, 30, 40, TRUE);
+    CHECK(sa->dst.left == 10 && sa->dst.top == 20 && sa->dst.right == 26 && sa->dst.bottom == 28);
+
+    list[0] = a;
+    list[1] = b;
+    lorieLayersStack(list, 2);
+    lorieLayersCommit();
+    CHECK(sa->z == 1 && sb->z == 2 && sa->visible && sb->visible);
+
+    lorieLayersStack(list, 2);
+    lorieLayersCommit();
+    CHECK(sa->zChanges == 1 && sb->zChanges == 1 && sa->visibilityChanges == 1);
+
+    list[0] = b;
+    lorieLayersStack(list, 1);
+    lorieLayersCommit();
+    CHECK(!sa->visible && sa->visibilityChanges == 2);
+    CHECK(sb->z == 1 && sb->zChanges == 2);
+
+    lorieLayerDestroy(a);
+    lorieLayerDestroy(b);
+    fakeSurfaceComplete();
+}
+
+int main(void) {
+    lorieLayersLoad(&fakeSurfaceApi);
+    lorieLayersSetParent(&window);
+
+    RUN(testFirstUpdate);
+    RUN(testDamageCatchUp);
+    RUN(testHeldBuffers);
+    RUN(testResize);
+    RUN(testReattach);
+    RUN(testStack);
+    return failures != 0;
+}
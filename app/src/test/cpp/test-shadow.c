@@ -0,0 +1,134 @@
+/*
+ * Shadow writeback of shadow.c: damaged boxes of the shadow are copied to the screen buffer
+ * or to the part of the screen shown by an additional output.
+ */
+
+#include <string.h>
+#include "scrnintstr.h"
+#include "lorie.h"
+#include "test.h"
+
+#define W 100
+#define H 60
+#define SENTINEL 0xDEADBEEF
+
+static uint32_t shadow[H][W];
+
+static void shadowInit(void) {
+    int x, y;
+    for (y = 0; y < H; y++)
+        for (x = 0; x < W; x++)
+            shadow[y][x] = (uint32_t) (y << 16 | x);
+}
+
+static void fill(uint32_t *buf, size_t count) {
+    size_t i;
+    for (i = 0; i < count; i++)
+        buf[i] = SENTINEL;
+}
+
+// Pixel of buffer with given stride (in pixels) which shows `clip` part of the screen, as writeback must leave it.
+static uint32_t expected(const BoxRec *clip, const BoxRec *boxes, int n, int x, int y) {
+    int sx = x + clip->x1, sy = y + clip->y1, i;
+
+    if (sx < max(clip->x1, 0) || sx >= min(clip->x2, W) || sy < max(clip->y1, 0) || sy >= min(clip->y2, H))
+        return SENTINEL;
+    for (i = 0; i < n; i++)
+        if (sx >= boxes[i].x1 && sx < boxes[i].x2 && sy >= boxes[i].y1 && sy < boxes[i].y2)
+            return shadow[sy][sx];
+    return SENTINEL;
+}
+
+static int matches(const uint32_t *buf, int stride, int rows, const BoxRec *clip, const BoxRec *boxes, int n) {
+    int x, y;
+    for (y = 0; y < rows; y++)
+        for (x = 0; x < stride; x++)
+            if (buf[y * stride + x] != expected(clip, boxes, n, x, y))
+                return 0;
+    return 1;
+}
+
+static void testWholeScreen(void) {
+    static uint32_t buf[H][W + 28];
+    BoxRec screen = { 0, 0, W, H };
+
+    fill(&buf[0][0], sizeof(buf) / 4);
+    lorieCopyBoxes(buf, sizeof(buf[0]), &screen, shadow, sizeof(shadow[0]), W, H, &screen, 1);
+    CHECK(matches(&buf[0][0], W + 28, H, &screen, &screen, 1));
+}
+
+static void testDamagedBoxes(void) {
+    static uint32_t buf[H][W];
+    BoxRec screen = { 0, 0, W, H };
+    BoxRec boxes[] = {
+        { 10, 10, 20, 15 },
+        { 50, 0, 51, 60 },
+        { -20, -20, 5, 5 }, // Clipped to the screen
+        { 90, 50, 200, 200 },
+        { 30, 30, 30, 40 }, // Empty
+        { 40, 45, 45, 40 }, // Inverted
+    };
+    int n = sizeof(boxes) / sizeof(boxes[0]);
+
+    fill(&buf[0][0], sizeof(buf) / 4);
+    lorieCopyBoxes(buf, sizeof(buf[0]), &screen, shadow, sizeof(shadow[0]), W, H, boxes, n);
+    CHECK(matches(&buf[0][0], W, H, &screen, boxes, n));
+}
+
+// Additional output shows a part of the screen which starts at its own origin.
+static void testOutputClip(void) {
+    static uint32_t buf[40][48];
+    BoxRec clip = { 70, 30, 110, 70 }; // Partly outside of the screen
+    BoxRec boxes[] = { { 0, 0, W, 35 }, { 75, 40, 80, 200 } };
+    int n = sizeof(boxes) / sizeof(boxes[0]);
+
+    fill(&buf[0][0], sizeof(buf) / 4);
+    lorieCopyBoxes(buf, sizeof(buf[0]), &clip, shadow, sizeof(shadow[0]), W, H, boxes, n);
+    CHECK(matches(&buf[0][0], 48, 40, &clip, boxes, n));
+    CHECK(buf[0][0] == shadow[30][70]);
+    CHECK(buf[10][5] == shadow[40][75]);
+    CHECK(buf[10][0] == SENTINEL);
+}
+
+static void testRandom(void) {
+    static uint32_t buf[H + 10][W + 16];
+    unsigned seed = 7;
+    int round, i;
+
+    for (round = 0; round < 500; round++) {
+        BoxRec clip, boxes[8];
+        int n = 1 + round % 8;
+
+#define RND(n) ((int) (((seed = seed * 1103515245 + 12345) >> 8) % (n)))
+        clip.x1 = RND(W) - 10;
+        clip.y1 = RND(H) - 10;
+        clip.x2 = clip.x1 + 1 + RND(W + 16);
+        clip.y2 = clip.y1 + 1 + RND(H + 10);
+        for (i = 0; i < n; i++) {
+            boxes[i].x1 = RND(W + 40) - 20;
+            boxes[i].y1 = RND(H + 40) - 20;
+            boxes[i].x2 = boxes[i].x1 + RND(60);
+            boxes[i].y2 = boxes[i].y1 + RND(40);
+        }
+#undef RND
+
+        // Writes below clip origin are only valid if clip starts inside of the screen, like outputs do.
+        clip.x1 = max(clip.x1, 0);
+        clip.y1 = max(clip.y1, 0);
+        if (clip.x2 <= clip.x1 || clip.y2 <= clip.y1 || clip.x2 - clip.x1 > W + 16 || clip.y2 - clip.y1 > H + 10)
+            continue;
+
+        fill(&buf[0][0], sizeof(buf) / 4);
+        lorieCopyBoxes(buf, sizeof(buf[0]), &clip, shadow, sizeof(shadow[0]), W, H, boxes, n);
+        CHECK(matches(&buf[0][0], W + 16, H + 10, &clip, boxes, n));
+    }
+}
+
+int main(void) {
+    shadowInit();
+    RUN(testWholeScreen);
+    RUN(testDamagedBoxes);
+    RUN(testOutputClip);
+    RUN(testRandom);
+    return failures != 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Tile damage of tiledamage.c: marking boxes and converting dirty tiles back to boxes.
+ */
+
+#include <string.h>
+#include "scrnintstr.h"
+#include "lorie.h"
+#include "test.h"
+
+#define TILE 64
+
+static int boxEquals(const BoxRec *box, int x1, int y1, int x2, int y2) {
+    return box->x1 == x1 && box->y1 == y1 && box->x2 == x2 && box->y2 == y2;
+}
+
+static void addBox(lorieTileDamagePtr tiles, int x1, int y1, int x2, int y2) {
+    BoxRec box = { x1, y1, x2, y2 };
+    lorieTileDamageAddBox(tiles, &box);
+}
+
+static void testEmpty(void) {
+    lorieTileDamagePtr tiles = lorieTileDamageCreate(640, 480);
+    BoxRec boxes[4];
+
+    CHECK(!lorieTileDamageNotEmpty(tiles));
+    CHECK(lorieTileDamageSpans(tiles, boxes, 4) == 0);
+
+    // Boxes outside of the screen or without area do not damage anything.
+    addBox(tiles, 700, 10, 800, 20);
+    addBox(tiles, -50, -50, 0, 0);
+    addBox(tiles, 10, 10, 10, 20);
+    CHECK(!lorieTileDamageNotEmpty(tiles));
+    CHECK(lorieTileDamageSpans(tiles, boxes, 4) == 0);
+
+    lorieTileDamageDestroy(tiles);
+}
+
+static void testSingleTile(void) {
+    lorieTileDamagePtr tiles = lorieTileDamageCreate(640, 480);
+    BoxRec boxes[4];
+
+    addBox(tiles, 70, 70, 71, 71);
+    CHECK(lorieTileDamageNotEmpty(tiles));
+    CHECK(lorieTileDamageSpans(tiles, boxes, 4) == 1);
+    CHECK(boxEquals(&boxes[0], 64, 64, 128, 128));
+
+    lorieTileDamageEmpty(tiles);
+    CHECK(!lorieTileDamageNotEmpty(tiles));
+    CHECK(lorieTileDamageSpans(tiles, boxes, 4) == 0);
+
+    lorieTileDamageDestroy(tiles);
+}
+
+// Partial tiles at right and bottom edges are clipped to the screen.
+static void testEdges(void) {
+    lorieTileDamagePtr tiles = lorieTileDamageCreate(100, 70);
+    BoxRec boxes[4];
+
+    addBox(tiles, -10, -10, 200, 200);
+    CHECK(lorieTileDamageSpans(tiles, boxes, 4) == 1);
+    CHECK(boxEquals(&boxes[0], 0, 0, 100, 70));
+
+    lorieTileDamageDestroy(tiles);
+}
+
+// Runs of dirty tiles are merged across 64-bit words of the bitmap.
+static void testWordBoundary(void) {
+    lorieTileDamagePtr tiles = lorieTileDamageCreate(TILE * 200, TILE);
+    BoxRec boxes[4];
+
+    addBox(tiles, TILE * 60, 0, TILE * 70, 1);
+    CHECK(lorieTileDamageSpans(tiles, boxes, 4) == 1);
+    CHECK(boxEquals(&boxes[0], TILE * 60, 0, TILE * 70, TILE));
+
+    // Run which ends exactly at the end of a word and one which spans a whole word.
+    lorieTileDamageEmpty(tiles);
+    addBox(tiles, TILE * 0, 0, TILE * 64, 1);
+    addBox(tiles, TILE * 100, 0, TILE * 200, 1);
+    CHECK(lorieTileDamageSpans(tiles, boxes, 4) == 2);
+    CHECK(boxEquals(&boxes[0], 0, 0, TILE * 64, TILE));
+    CHECK(boxEquals(&boxes[1], TILE * 100, 0, TILE * 200, TILE));
+
+    lorieTileDamageDestroy(tiles);
+}
+
+// Rows with the same dirty tiles extend spans of the previous row.
+static void testRowMerge(void) {
+    lorieTileDamagePtr tiles = lorieTileDamageCreate(640, 480);
+    BoxRec boxes[8];
+
+    addBox(tiles, 10, 10, 20, 200); // Column 0, rows 0-3
+    addBox(tiles, 300, 10, 310, 200); // Column 4, rows 0-3
+    addBox(tiles, 10, 300, 200, 310); // Columns 0-3, row 4
+    CHECK(lorieTileDamageSpans(tiles, boxes, 8) == 3);
+    CHECK(boxEquals(&boxes[0], 0, 0, 64, 256));
+    CHECK(boxEquals(&boxes[1], 256, 0, 320, 256));
+    CHECK(boxEquals(&boxes[2], 0, 256, 256, 320));
+
+    lorieTileDamageDestroy(tiles);
+}
+
+static void testOverflow(void) {
+    lorieTileDamagePtr tiles = lorieTileDamageCreate(640, 480);
+    BoxRec boxes[2];
+
+    addBox(tiles, 0, 0, 1, 1);
+    addBox(tiles, 128, 0, 129, 1);
+    addBox(tiles, 256, 0, 257, 1);
+    CHECK(lorieTileDamageSpans(tiles, boxes, 2) == -1);
+
+    lorieTileDamageDestroy(tiles);
+}
+
+// Region of several boxes, as reported by damage layer.
+static void testRegion(void) {
+    lorieTileDamagePtr tiles = lorieTileDamageCreate(640, 480);
+    BoxRec a = { 0, 0, 10, 10 }, b = { 600, 400, 640, 480 }, boxes[4];
+    RegionRec region;
+
+    RegionInit(&region, &a, 1);
+    RegionAppendBox(&region, &b);
+    lorieTileDamageAddRegion(tiles, &region);
+    RegionUninit(&region);
+
+    CHECK(lorieTileDamageSpans(tiles, boxes, 4) == 2);
+    CHECK(boxEquals(&boxes[0], 0, 0, 64, 64));
+    CHECK(boxEquals(&boxes[1], 576, 384, 640, 480));
+
+    lorieTileDamageDestroy(tiles);
+}
+
+/*
+ * Random boxes on a screen which is not a multiple of tile size: spans must cover every damaged pixel,
+ * must not overlap and must only contain tiles which were damaged.
+ */
+static void testRandom(void) {
+    enum { W = 1000, H = 700, COLUMNS = (W + TILE - 1) / TILE, ROWS = (H + TILE - 1) / TILE };
+    static BoxRec boxes[COLUMNS * ROWS];
+    unsigned seed = 1;
+    int round, i, x, y;
+
+    for (round = 0; round < 200; round++) {
+        lorieTileDamagePtr tiles = lorieTileDamageCreate(W, H);
+        unsigned char dirty[ROWS][COLUMNS] = {{0}}, covered[ROWS][COLUMNS] = {{0}};
+        int n, count = 1 + round % 20, ok = 1;
+
+        for (i = 0; i < count; i++) {
+            int x1 = (int) ((seed = seed * 1103515245 + 12345) >> 8) % (W + 100) - 50;
+            int y1 = (int) ((seed = seed * 1103515245 + 12345) >> 8) % (H + 100) - 50;
+            int w = (int) ((seed = seed * 1103515245 + 12345) >> 8) % 300;
+            int h = (int) ((seed = seed * 1103515245 + 12345) >> 8) % 300;
+
+            addBox(tiles, x1, y1, x1 + w, y1 + h);
+            for (y = max(y1, 0); y < min(y1 + h, H); y++)
+                for (x = max(x1, 0); x < min(x1 + w, W); x++)
+                    dirty[y / TILE][x / TILE] = 1;
+        }
+
+        n = lorieTileDamageSpans(tiles, boxes, COLUMNS * ROWS);
+        for (i = 0; i < n; i++) {
+            ok &= boxes[i].x1 % TILE == 0 && boxes[i].y1 % TILE == 0 && boxes[i].x2 <= W && boxes[i].y2 <= H;
+            for (y = boxes[i].y1 / TILE; y < (boxes[i].y2 + TILE - 1) / TILE; y++)
+                for (x = boxes[i].x1 / TILE; x < (boxes[i].x2 + TILE - 1) / TILE; x++) {
+                    ok &= dirty[y][x] && !covered[y][x];
+                    covered[y][x] = 1;
+                }
+        }
+        CHECK(n >= 0 && ok);
+        CHECK(!memcmp(dirty, covered, sizeof(dirty)));
+
+        lorieTileDamageDestroy(tiles);
+    }
+}
+
+int main(void) {
+    RUN(testEmpty);
+    RUN(testSingleTile);
+    RUN(testEdges);
+    RUN(testWordBoundary);
+    RUN(testRowMerge);
+    RUN(testOverflow);
+    RUN(testRegion);
+    RUN(testRandom);
+    return failures != 0;
+}
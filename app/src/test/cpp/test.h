@@ -0,0 +1,21 @@
+#pragma once
+/*
+ * Tests are plain functions which check conditions with CHECK and are listed in main with RUN.
+ * Executable fails if any check failed, ctest runs every test executable.
+ */
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(cond) do {                                                     \
+    if (!(cond)) {                                                           \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++;                                                          \
+    }                                                                        \
+} while (0)
+
+#define RUN(test) do {                                                       \
+    int before = failures;                                                   \
+    test();                                                                  \
+    printf("%s %s\n", failures == before ? "PASS" : "FAIL", #test);         \
+} while (0)